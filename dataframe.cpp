@@ -1,39 +1,923 @@
 #include "qgenlib/dataframe.h"
 #include "qgenlib/qgen_error.h"
 #include "qgenlib/tsv_reader.h"
+#include "qgenlib/tsv_parallel_scan.h"
+#include "qgenlib/dataframe_index.h"
 
-bool dataframe_t::load(const char* tsvfile) {
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+const char* dataframe_column_t::bool_names[3][2] = { { "false", "true" }, { "FALSE", "TRUE" }, { "False", "True" } };
+
+// a number without a '+' sign or leading zeros (e.g. zip codes or barcodes
+// such as 00123 stay strings)
+static bool is_plain_number(const char* s, const char* end) {
+  const char* p = s;
+  if ( ( p < end ) && ( *p == '-' ) ) ++p;
+  if ( p == end ) return false;
+  if ( ( *p == '0' ) && ( p + 1 < end ) && ( p[1] >= '0' ) && ( p[1] <= '9' ) ) return false;
+  return ( *p == '.' ) || ( ( *p >= '0' ) && ( *p <= '9' ) );
+}
+
+// the shortest representation that reads back as the same double
+static void format_double(double v, std::string& out) {
+  char buf[32];
+  for(int32_t prec = 15; prec <= 17; ++prec) {
+    snprintf(buf, sizeof(buf), "%.*g", prec, v);
+    if ( ( prec == 17 ) || ( strtod(buf, NULL) == v ) || ( v != v ) ) break;
+  }
+  out.assign(buf);
+}
+
+// true if format_double(v) gives back the text [s, end), so that the value is
+// written back as it was read (1.50, 1e5 or 12345678901234567890 stay strings)
+static bool is_canonical_double(const char* s, const char* end, double v) {
+  const char* p = ( *s == '-' ) ? s + 1 : s;
+  const char* q = p;
+  while( ( q < end ) && ( *q >= '0' ) && ( *q <= '9' ) ) ++q;
+  int32_t nint = (int32_t)( q - p );
+  if ( nint == 0 ) return false; // .5 is written as 0.5
+  // up to 15 significant digits in fixed notation come back from %.15g as they are
+  if ( q == end ) {
+    if ( nint <= 15 ) return true;
+  }
+  else if ( *q == '.' ) {
+    const char* f = ++q;
+    while( ( q < end ) && ( *q >= '0' ) && ( *q <= '9' ) ) ++q;
+    if ( ( q == end ) && ( q > f ) && ( q[-1] != '0' ) ) {
+      const char* r = f;
+      if ( ( nint == 1 ) && ( *p == '0' ) ) // 0.000123 is fixed, 0.0000123 is not
+        while( *r == '0' ) ++r;
+      if ( ( r - f <= 3 ) && ( ( ( *p == '0' ) ? 0 : nint ) + ( q - r ) <= 15 ) ) return true;
+    }
+  }
+  std::string buf;
+  format_double(v, buf);
+  return ( buf.size() == (size_t)( end - s ) ) && ( memcmp(buf.data(), s, buf.size()) == 0 );
+}
+
+// an integer in int64 range, written as std::to_string() would write it
+static bool parse_plain_int64(const char* s, const char* end, int64_t& v) {
+  if ( !is_plain_number(s, end) || !parse_int64(s, end, v) )
+    return false;
+  return ( v != 0 ) || ( *s != '-' ); // -0 is not written back as is
+}
+
+// a double written as format_double() would write it
+static bool parse_plain_double(const char* s, const char* end, double& v) {
+  return is_plain_number(s, end) && parse_double(s, end, v) && is_canonical_double(s, end, v);
+}
+
+// returns the spelling of a boolean value, or -1; sets v to the value
+static int32_t parse_bool(const char* s, const char* end, uint8_t& v) {
+  size_t len = end - s;
+  for(int32_t i=0; i < 3; ++i) {
+    for(int32_t j=0; j < 2; ++j) {
+      const char* name = dataframe_column_t::bool_names[i][j];
+      if ( ( strlen(name) == len ) && ( memcmp(name, s, len) == 0 ) ) {
+        v = (uint8_t)j;
+        return i;
+      }
+    }
+  }
+  return -1;
+}
+
+void dataframe_arena_t::new_chunk(size_t min_size) {
+  size_t cap = chunks.empty() ? DF_ARENA_MIN_CHUNK : chunks.back().capacity() * 2;
+  if ( cap > DF_ARENA_MAX_CHUNK ) cap = DF_ARENA_MAX_CHUNK;
+  if ( cap < min_size ) cap = min_size;
+  chunks.push_back(std::vector<char>());
+  chunks.back().reserve(cap);
+}
+
+size_t dataframe_arena_t::bytes() const {
+  size_t n = 0;
+  for(size_t i=0; i < chunks.size(); ++i)
+    n += chunks[i].capacity();
+  return n;
+}
+
+uint64_t dataframe_arena_t::absorb(dataframe_arena_t& other) {
+  uint64_t base = (uint64_t)chunks.size() << 32;
+  for(size_t i=0; i < other.chunks.size(); ++i) {
+    chunks.push_back(std::vector<char>());
+    chunks.back().swap(other.chunks[i]);
+  }
+  other.chunks.clear();
+  return base;
+}
+
+size_t dataframe_column_t::size() const {
+  switch( type ) {
+  case DF_TYPE_INT64:  return ints.size();
+  case DF_TYPE_DOUBLE: return dbls.size();
+  case DF_TYPE_BOOL:   return bools.size();
+  default:
+    switch( str_enc ) {
+    case DF_STR_DICT:  return codes.size() / code_width;
+    case DF_STR_ARENA: return offs.size();
+    default:           return strs.size();
+    }
+  }
+}
+
+void dataframe_column_t::resize(size_t n, dataframe_arena_t& arena) {
+  switch( type ) {
+  case DF_TYPE_INT64:  ints.resize(n); break;
+  case DF_TYPE_DOUBLE: dbls.resize(n); break;
+  case DF_TYPE_BOOL:   bools.resize(n); break;
+  default:
+    switch( str_enc ) {
+    case DF_STR_DICT:
+      if ( n > size() ) {
+        uint32_t code = add_code("", 0, arena);
+        for(size_t i=size(); i < n; ++i)
+          put_code(i, code);
+      }
+      else
+        codes.resize(n * code_width);
+      break;
+    case DF_STR_ARENA: offs.resize(n, 0); break; // offset 0 is the empty string
+    default:           strs.resize(n);
+    }
+  }
+}
+
+uint32_t dataframe_column_t::add_code(const char* s, size_t len, dataframe_arena_t& arena, const uint64_t* off) {
+  if ( dict_slots.empty() )
+    rehash(16, arena);
+  size_t mask = dict_slots.size() - 1;
+  for(size_t i = df_hash_bytes(s, len) & mask; ; i = ( i + 1 ) & mask) {
+    int32_t k = dict_slots[i];
+    if ( k < 0 ) {
+      k = (int32_t)dict_offs.size();
+      dict_offs.push_back(off != NULL ? *off : arena.add(s, len));
+      dict_lens.push_back((uint32_t)len);
+      dict_slots[i] = k;
+      if ( dict_offs.size() * 2 > dict_slots.size() )
+        rehash(dict_slots.size() * 2, arena);
+      return (uint32_t)k;
+    }
+    if ( ( dict_lens[k] == len ) && ( memcmp(arena.at(dict_offs[k]), s, len) == 0 ) )
+      return (uint32_t)k;
+  }
+}
+
+int64_t dataframe_column_t::find_code(const char* s, size_t len, const dataframe_arena_t& arena) const {
+  if ( dict_slots.empty() )
+    return -1;
+  size_t mask = dict_slots.size() - 1;
+  for(size_t i = df_hash_bytes(s, len) & mask; ; i = ( i + 1 ) & mask) {
+    int32_t k = dict_slots[i];
+    if ( k < 0 )
+      return -1;
+    if ( ( dict_lens[k] == len ) && ( memcmp(arena.at(dict_offs[k]), s, len) == 0 ) )
+      return k;
+  }
+}
+
+void dataframe_column_t::rehash(size_t nslots, const dataframe_arena_t& arena) {
+  dict_slots.assign(nslots, -1);
+  size_t mask = nslots - 1;
+  for(size_t k=0; k < dict_offs.size(); ++k) {
+    size_t i = df_hash_bytes(arena.at(dict_offs[k]), dict_lens[k]) & mask;
+    while( dict_slots[i] >= 0 ) i = ( i + 1 ) & mask;
+    dict_slots[i] = (int32_t)k;
+  }
+}
+
+void dataframe_column_t::widen_codes(int32_t width) {
+  size_t n = codes.size() / code_width;
+  std::vector<uint8_t> wide(n * width);
+  for(size_t i=0; i < n; ++i) {
+    if ( width == 2 ) { uint16_t c = (uint16_t)code_at(i); memcpy(&wide[i * 2], &c, 2); }
+    else { uint32_t c = code_at(i); memcpy(&wide[i * 4], &c, 4); }
+  }
+  codes.swap(wide);
+  code_width = width;
+}
+
+void dataframe_column_t::put_code(size_t row, uint32_t code) {
+  int32_t width = code < 256 ? 1 : ( code < 65536 ? 2 : 4 );
+  if ( width > code_width )
+    widen_codes(width);
+  if ( row * code_width == codes.size() )
+    codes.resize(codes.size() + code_width);
+  switch( code_width ) {
+  case 1:  codes[row] = (uint8_t)code; break;
+  case 2:  { uint16_t c = (uint16_t)code; memcpy(&codes[row * 2], &c, 2); break; }
+  default: memcpy(&codes[row * 4], &code, 4);
+  }
+}
+
+bool dataframe_column_t::append(const char* s, const char* end, dataframe_arena_t& arena) {
+  switch( type ) {
+  case DF_TYPE_INT64: {
+    int64_t v;
+    if ( !parse_plain_int64(s, end, v) ) return false;
+    ints.push_back(v);
+    return true;
+  }
+  case DF_TYPE_DOUBLE: {
+    double v;
+    if ( !parse_plain_double(s, end, v) ) return false;
+    dbls.push_back(v);
+    return true;
+  }
+  case DF_TYPE_BOOL: { // the first value sets the spelling
+    uint8_t v;
+    int32_t style = parse_bool(s, end, v);
+    if ( ( style < 0 ) || ( ( style != bool_style ) && !bools.empty() ) ) return false;
+    bool_style = style;
+    bools.push_back(v);
+    return true;
+  }
+  default:
+    switch( str_enc ) {
+    case DF_STR_DICT: {
+      size_t row = size();
+      uint32_t code = add_code(s, end - s, arena);
+      if ( ( code == 65536 ) && ( code_width == 2 ) && ( dict_offs.size() * 2 > row + 1 ) ) { // mostly distinct values
+        uint64_t off = dict_offs[code]; // set_str_enc() drops the dictionary
+        set_str_enc(DF_STR_ARENA, arena);
+        offs.push_back(off);
+      }
+      else
+        put_code(row, code);
+      return true;
+    }
+    case DF_STR_ARENA:
+      offs.push_back(arena.add(s, end - s));
+      return true;
+    default:
+      strs.emplace_back(s, end - s);
+      return true;
+    }
+  }
+}
+
+bool dataframe_column_t::set(size_t row, const char* s, const char* end, dataframe_arena_t& arena) {
+  switch( type ) {
+  case DF_TYPE_INT64: { // parsed into v, as the text may be rejected after parsing
+    int64_t v;
+    if ( !parse_plain_int64(s, end, v) ) return false;
+    ints[row] = v;
+    return true;
+  }
+  case DF_TYPE_DOUBLE: {
+    double v;
+    if ( !parse_plain_double(s, end, v) ) return false;
+    dbls[row] = v;
+    return true;
+  }
+  case DF_TYPE_BOOL: {
+    uint8_t v;
+    if ( parse_bool(s, end, v) != bool_style ) return false;
+    bools[row] = v;
+    return true;
+  }
+  default:
+    switch( str_enc ) {
+    case DF_STR_DICT:  put_code(row, add_code(s, end - s, arena)); break;
+    case DF_STR_ARENA: offs[row] = arena.add(s, end - s); break;
+    default:           strs[row].assign(s, end - s);
+    }
+    return true;
+  }
+}
+
+void dataframe_column_t::to_string(size_t row, std::string& out, const dataframe_arena_t& arena) const {
+  switch( type ) {
+  case DF_TYPE_INT64:
+    out = std::to_string(ints[row]);
+    break;
+  case DF_TYPE_DOUBLE:
+    format_double(dbls[row], out);
+    break;
+  case DF_TYPE_BOOL:
+    out.assign(bool_names[bool_style][bools[row]]);
+    break;
+  default: {
+    int32_t len;
+    const char* p = str_view(row, arena, &len);
+    out.assign(p, len);
+  }
+  }
+}
+
+void dataframe_column_t::concat(dataframe_column_t& other, uint64_t base, dataframe_arena_t& arena) {
+  if ( ( other.type != type ) || ( ( type == DF_TYPE_STRING ) && ( other.str_enc != str_enc ) ) )
+    error("[E:%s:%d %s] Cannot concatenate columns of different types", __FILE__, __LINE__, __FUNCTION__);
+  switch( type ) {
+  case DF_TYPE_INT64:  ints.insert(ints.end(), other.ints.begin(), other.ints.end()); break;
+  case DF_TYPE_DOUBLE: dbls.insert(dbls.end(), other.dbls.begin(), other.dbls.end()); break;
+  case DF_TYPE_BOOL:   bools.insert(bools.end(), other.bools.begin(), other.bools.end()); break;
+  default:
+    switch( str_enc ) {
+    case DF_STR_DICT: { // map the codes of other to codes of this dictionary
+      std::vector<uint32_t> remap(other.dict_offs.size());
+      for(size_t k=0; k < remap.size(); ++k) {
+        uint64_t off = other.dict_offs[k] + base;
+        remap[k] = add_code(arena.at(off), other.dict_lens[k], arena, &off);
+      }
+      size_t n0 = size(), n = other.size();
+      for(size_t i=0; i < n; ++i)
+        put_code(n0 + i, remap[other.code_at(i)]);
+      break;
+    }
+    case DF_STR_ARENA:
+      for(size_t i=0; i < other.offs.size(); ++i)
+        offs.push_back(other.offs[i] + base);
+      break;
+    default:
+      strs.insert(strs.end(), other.strs.begin(), other.strs.end());
+    }
+  }
+  other = dataframe_column_t(); // release the values
+}
+
+void dataframe_column_t::rebase(uint64_t base) {
+  if ( type != DF_TYPE_STRING ) return;
+  for(size_t k=0; k < dict_offs.size(); ++k)
+    dict_offs[k] += base;
+  for(size_t i=0; i < offs.size(); ++i)
+    offs[i] += base;
+}
+
+void dataframe_column_t::gather(const dataframe_column_t& src, const dataframe_arena_t& src_arena, const std::vector<int32_t>& rows, dataframe_arena_t& arena) {
+  size_t n = rows.size();
+  bool missing = false;
+  for(size_t i=0; ( i < n ) && !missing; ++i)
+    missing = ( rows[i] < 0 );
+  *this = dataframe_column_t();
+  if ( ( src.type != DF_TYPE_STRING ) && !missing ) {
+    type = src.type;
+    bool_style = src.bool_style;
+    switch( type ) {
+    case DF_TYPE_INT64:
+      ints.resize(n);
+      for(size_t i=0; i < n; ++i) ints[i] = src.ints[rows[i]];
+      break;
+    case DF_TYPE_DOUBLE:
+      dbls.resize(n);
+      for(size_t i=0; i < n; ++i) dbls[i] = src.dbls[rows[i]];
+      break;
+    default:
+      bools.resize(n);
+      for(size_t i=0; i < n; ++i) bools[i] = src.bools[rows[i]];
+    }
+    return;
+  }
+  if ( ( src.type == DF_TYPE_STRING ) && ( src.str_enc != DF_STR_DICT ) ) { // copy each value
+    str_enc = DF_STR_ARENA;
+    offs.resize(n, 0);
+    for(size_t i=0; i < n; ++i) {
+      if ( rows[i] < 0 ) continue;
+      int32_t len;
+      const char* p = src.str_view(rows[i], src_arena, &len);
+      offs[i] = ( len > 0 ) ? arena.add(p, len) : 0;
+    }
+    return;
+  }
+  // copy each dictionary entry (or formatted value) once
+  std::vector<int64_t> remap( src.type == DF_TYPE_STRING ? src.dict_offs.size() : 0, -1 );
+  std::string buf;
+  for(size_t i=0; i < n; ++i) {
+    uint32_t code;
+    if ( rows[i] < 0 )
+      code = add_code("", 0, arena);
+    else {
+      if ( src.type == DF_TYPE_STRING ) {
+        uint32_t k = src.code_at(rows[i]);
+        if ( remap[k] < 0 )
+          remap[k] = add_code(src_arena.at(src.dict_offs[k]), src.dict_lens[k], arena);
+        code = (uint32_t)remap[k];
+      }
+      else {
+        src.to_string(rows[i], buf, src_arena);
+        code = add_code(buf.data(), buf.size(), arena);
+      }
+    }
+    put_code(i, code);
+  }
+  check_cardinality(arena);
+}
+
+// Strings are parsed once per dictionary entry when the column is dictionary-encoded.
+bool dataframe_column_t::convert(int32_t newtype, dataframe_arena_t& arena, int32_t new_bool_style) {
+  if ( newtype == type )
+    return ( type != DF_TYPE_BOOL ) || ( new_bool_style == bool_style ) || bools.empty();
+  size_t n = size();
+  if ( newtype == DF_TYPE_STRING ) {
+    std::string buf;
+    str_enc = DF_STR_DICT;
+    code_width = 1;
+    for(size_t i=0; i < n; ++i) {
+      to_string(i, buf, arena);
+      put_code(i, add_code(buf.data(), buf.size(), arena));
+    }
+  }
+  else if ( type == DF_TYPE_STRING ) {
+    dataframe_column_t c;
+    c.type = newtype;
+    c.bool_style = new_bool_style;
+    bool dict = ( str_enc == DF_STR_DICT );
+    size_t m = dict ? dict_offs.size() : n;
+    for(size_t i=0; i < m; ++i) { // dictionary entries, or rows
+      int32_t len;
+      const char* p = dict ? arena.at(dict_offs[i]) : str_view(i, arena, &len);
+      if ( dict ) len = (int32_t)dict_lens[i];
+      if ( !c.append(p, p + len, arena) )
+        return false;
+    }
+    if ( dict ) { // map the codes to the values
+      switch( newtype ) {
+      case DF_TYPE_INT64:  ints.resize(n);  for(size_t i=0; i < n; ++i) ints[i] = c.ints[code_at(i)]; break;
+      case DF_TYPE_DOUBLE: dbls.resize(n);  for(size_t i=0; i < n; ++i) dbls[i] = c.dbls[code_at(i)]; break;
+      default:             bools.resize(n); for(size_t i=0; i < n; ++i) bools[i] = c.bools[code_at(i)];
+      }
+    }
+    else {
+      ints.swap(c.ints);
+      dbls.swap(c.dbls);
+      bools.swap(c.bools);
+    }
+    new_bool_style = c.bool_style;
+  }
+  else if ( ( type == DF_TYPE_INT64 ) && ( newtype == DF_TYPE_DOUBLE ) ) {
+    dbls.resize(ints.size());
+    for(size_t i=0; i < ints.size(); ++i) {
+      if ( ( ints[i] > ( (int64_t)1 << 53 ) ) || ( ints[i] < -( (int64_t)1 << 53 ) ) ) {
+        std::vector<double>().swap(dbls);
+        return false;
+      }
+      dbls[i] = (double)ints[i];
+    }
+  }
+  else
+    return false;
+  switch( type ) { // release the old values
+  case DF_TYPE_INT64:  std::vector<int64_t>().swap(ints); break;
+  case DF_TYPE_DOUBLE: std::vector<double>().swap(dbls); break;
+  case DF_TYPE_BOOL:   std::vector<uint8_t>().swap(bools); break;
+  default:
+    std::vector<uint8_t>().swap(codes);
+    std::vector<uint64_t>().swap(dict_offs);
+    std::vector<uint32_t>().swap(dict_lens);
+    std::vector<int32_t>().swap(dict_slots);
+    std::vector<uint64_t>().swap(offs);
+    std::vector<std::string>().swap(strs);
+    str_enc = DF_STR_DICT;
+    code_width = 1;
+  }
+  type = newtype;
+  bool_style = new_bool_style;
+  if ( type == DF_TYPE_STRING )
+    check_cardinality(arena);
+  return true;
+}
+
+void dataframe_column_t::set_str_enc(int32_t enc, dataframe_arena_t& arena) {
+  if ( ( type != DF_TYPE_STRING ) || ( enc == str_enc ) )
+    return;
+  size_t n = size();
+  dataframe_column_t c;
+  c.str_enc = enc;
+  if ( ( str_enc == DF_STR_DICT ) && ( enc == DF_STR_ARENA ) ) { // the dictionary entries are already in the arena
+    c.offs.resize(n);
+    for(size_t i=0; i < n; ++i)
+      c.offs[i] = dict_offs[code_at(i)];
+  }
+  else {
+    for(size_t i=0; i < n; ++i) {
+      int32_t len;
+      const char* p = str_view(i, arena, &len);
+      c.append(p, p + len, arena);
+    }
+  }
+  std::swap(*this, c);
+}
+
+void dataframe_column_t::check_cardinality(dataframe_arena_t& arena) {
+  if ( ( type == DF_TYPE_STRING ) && ( str_enc == DF_STR_DICT ) && ( dict_offs.size() > DF_DICT_MIN_ARENA ) && ( dict_offs.size() * 2 > size() ) )
+    set_str_enc(DF_STR_ARENA, arena);
+}
+
+int32_t dataframe_column_t::infer_type(int32_t& inferred_bool_style, const dataframe_arena_t& arena) const {
+  inferred_bool_style = bool_style;
+  if ( ( type != DF_TYPE_STRING ) || ( size() == 0 ) )
+    return type;
+  bool dict = ( str_enc == DF_STR_DICT );
+  size_t m = dict ? dict_offs.size() : size();
+  bool is_int = true, is_double = true, is_bool = true;
+  int32_t style = -1;
+  for(size_t i=0; ( i < m ) && ( is_int || is_double || is_bool ); ++i) { // dictionary entries, or rows
+    int32_t len;
+    const char* s = dict ? arena.at(dict_offs[i]) : str_view(i, arena, &len);
+    if ( dict ) len = (int32_t)dict_lens[i];
+    const char* end = s + len;
+    int64_t iv;
+    double dv;
+    uint8_t bv;
+    if ( is_int && !parse_plain_int64(s, end, iv) ) is_int = false;
+    if ( is_double && !is_int && !parse_plain_double(s, end, dv) ) is_double = false;
+    if ( is_bool ) {
+      int32_t st = parse_bool(s, end, bv);
+      if ( ( st < 0 ) || ( ( style >= 0 ) && ( st != style ) ) ) is_bool = false;
+      style = st;
+    }
+  }
+  inferred_bool_style = is_bool ? style : 0;
+  if ( is_int ) return DF_TYPE_INT64;
+  if ( is_double ) return DF_TYPE_DOUBLE;
+  if ( is_bool ) return DF_TYPE_BOOL;
+  return DF_TYPE_STRING;
+}
+
+void dataframe_column_t::widen_for(const char* s, const char* end, dataframe_arena_t& arena) {
+  double v;
+  if ( ( type == DF_TYPE_INT64 ) && parse_plain_double(s, end, v) && convert(DF_TYPE_DOUBLE, arena) )
+    return;
+  convert(DF_TYPE_STRING, arena);
+}
+
+// columns and filters of dataframe_t::load(), resolved to column indices of the file
+struct dataframe_load_plan_t {
+  int32_t nfile_cols;              // number of columns in the header
+  std::vector<int32_t> src;        // column of the file loaded into each column
+  std::vector<bool> fixed;         // columns of types given in dataframe_load_opts_t::coltypes
+  std::vector<int32_t> filter_src; // column of the file tested by each filter
+  std::vector<int32_t> projection; // columns of the file to tokenize (empty for all)
+  int32_t min_fields;              // lines with fewer fields are rejected
+};
+
+dataframe_filter_t dataframe_filter_t::text_eq(const char* colname, const char* value) {
+  dataframe_filter_t f;
+  f.colname = colname;
+  f.op = DF_FILTER_TEXT_EQ;
+  f.values.push_back(value);
+  return f;
+}
+
+dataframe_filter_t dataframe_filter_t::text_in(const char* colname, const std::vector<std::string>& values) {
+  dataframe_filter_t f;
+  f.colname = colname;
+  f.op = DF_FILTER_TEXT_IN;
+  f.values = values;
+  std::sort(f.values.begin(), f.values.end());
+  return f;
+}
+
+dataframe_filter_t dataframe_filter_t::num_range(const char* colname, double lo, double hi) {
+  dataframe_filter_t f;
+  f.colname = colname;
+  f.op = DF_FILTER_NUM_RANGE;
+  f.lo = lo;
+  f.hi = hi;
+  return f;
+}
+
+dataframe_filter_t dataframe_filter_t::int_range(const char* colname, int64_t lo, int64_t hi) {
+  dataframe_filter_t f;
+  f.colname = colname;
+  f.op = DF_FILTER_INT_RANGE;
+  f.ilo = lo;
+  f.ihi = hi;
+  return f;
+}
+
+// compares [s, s+len) with a string as std::string::compare() does
+static inline int32_t compare_view(const char* s, size_t len, const std::string& v) {
+  int32_t c = memcmp(s, v.data(), len < v.size() ? len : v.size());
+  if ( c != 0 ) return c;
+  return len < v.size() ? -1 : ( len > v.size() ? 1 : 0 );
+}
+
+bool dataframe_filter_t::match(const char* s, const char* end) const {
+  size_t len = end - s;
+  switch( op ) {
+  case DF_FILTER_TEXT_EQ:
+    return ( len == values[0].size() ) && ( memcmp(s, values[0].data(), len) == 0 );
+  case DF_FILTER_TEXT_IN: { // binary search without copying the field
+    size_t a = 0, b = values.size();
+    while( a < b ) {
+      size_t m = ( a + b ) / 2;
+      int32_t c = compare_view(s, len, values[m]);
+      if ( c == 0 ) return true;
+      if ( c < 0 ) b = m;
+      else a = m + 1;
+    }
+    return false;
+  }
+  case DF_FILTER_NUM_RANGE: {
+    double v;
+    return parse_double(s, end, v) && ( v >= lo ) && ( v <= hi );
+  }
+  default: {
+    int64_t v;
+    return parse_int64(s, end, v) && ( v >= ilo ) && ( v <= ihi );
+  }
+  }
+}
+
+bool dataframe_t::load(const char* tsvfile, const dataframe_load_opts_t& opts) {
   tsv_reader tr(tsvfile);
 
+  colnames.clear();
+  col2idx.clear();
+  columns.clear();
+  arena.clear();
+
   // read header line;
-  ncols = tr.read_line();
+  dataframe_load_plan_t plan;
+  plan.nfile_cols = tr.read_line();
+  std::map<std::string,int32_t> file2idx;
+  for(int32_t i=0; i < plan.nfile_cols; ++i) {
+    const char* name = tr.str_field_at(i);
+    if ( file2idx.find(name) == file2idx.end() )
+      file2idx[name] = i;
+    else
+      error("Duplicated column name %s", name);
+  }
+
+  // select the columns to load
+  if ( opts.columns.empty() ) {
+    for(int32_t i=0; i < plan.nfile_cols; ++i)
+      plan.src.push_back(i);
+  }
+  for(int32_t i=0; i < (int32_t)opts.columns.size(); ++i) {
+    std::map<std::string,int32_t>::iterator it = file2idx.find(opts.columns[i]);
+    if ( it == file2idx.end() )
+      error("[E:%s:%d %s] Column %s is not found in %s", __FILE__, __LINE__, __FUNCTION__, opts.columns[i].c_str(), tsvfile);
+    plan.src.push_back(it->second);
+  }
+  ncols = (int32_t)plan.src.size();
   for(int32_t i=0; i < ncols; ++i) {
-    colnames.push_back(tr.str_field_at(i));
-    if ( col2idx.find(colnames[i]) == col2idx.end() ) 
+    colnames.push_back(tr.str_field_at(plan.src[i]));
+    if ( col2idx.find(colnames[i]) == col2idx.end() )
       col2idx[colnames[i]] = i;
     else
-      error("Duplicated column name %s", colnames[i].c_str());      
+      error("Duplicated column name %s", colnames[i].c_str());
   }
   nrows = 0;
   columns.resize(ncols);
 
+  // columns of given types are typed from the first row, and never widened
+  plan.fixed.assign(ncols, false);
+  for(std::map<std::string,int32_t>::const_iterator it = opts.coltypes.begin(); it != opts.coltypes.end(); ++it) {
+    if ( file2idx.find(it->first) == file2idx.end() )
+      error("[E:%s:%d %s] Column %s is not found in %s", __FILE__, __LINE__, __FUNCTION__, it->first.c_str(), tsvfile);
+    std::map<std::string,uint32_t>::iterator ic = col2idx.find(it->first);
+    if ( ic == col2idx.end() ) continue; // not loaded
+    columns[ic->second].type = it->second;
+    plan.fixed[ic->second] = true;
+  }
+
+  for(int32_t i=0; i < (int32_t)opts.filters.size(); ++i) {
+    std::map<std::string,int32_t>::iterator it = file2idx.find(opts.filters[i].colname);
+    if ( it == file2idx.end() )
+      error("[E:%s:%d %s] Column %s is not found in %s", __FILE__, __LINE__, __FUNCTION__, opts.filters[i].colname.c_str(), tsvfile);
+    if ( ( opts.filters[i].op <= DF_FILTER_TEXT_IN ) && opts.filters[i].values.empty() )
+      error("[E:%s:%d %s] No values are given to the filter on column %s", __FILE__, __LINE__, __FUNCTION__, opts.filters[i].colname.c_str());
+    plan.filter_src.push_back(it->second);
+  }
+
+  // tokenize only the needed columns when some are left out
+  plan.min_fields = plan.nfile_cols;
+  if ( !opts.columns.empty() ) {
+    std::vector<bool> needed(plan.nfile_cols, false);
+    for(int32_t i=0; i < ncols; ++i) needed[plan.src[i]] = true;
+    for(int32_t i=0; i < (int32_t)plan.filter_src.size(); ++i) needed[plan.filter_src[i]] = true;
+    for(int32_t i=0; i < plan.nfile_cols; ++i)
+      if ( needed[i] ) plan.projection.push_back(i);
+    plan.min_fields = plan.projection.empty() ? 0 : plan.projection.back() + 1;
+  }
+
+  if ( opts.nthreads > 1 ) {
+    tr.close();
+    return load_parallel(tsvfile, opts, plan);
+  }
+  if ( !plan.projection.empty() )
+    tr.set_projection(plan.projection);
+  read_rows(tr, opts, plan, tsvfile);
+  tr.close();
+  return true;
+}
+
+// Rows are kept as dictionary-encoded strings until infer_rows rows are read,
+// then each column is converted to the inferred type. A later value that does
+// not fit widens the column: int64 to double, and anything else to string.
+void dataframe_t::read_rows(tsv_reader& tr, const dataframe_load_opts_t& opts, const dataframe_load_plan_t& plan, const char* tsvfile) {
+  bool inferred = !opts.infer_types;
+  int32_t nfilters = (int32_t)opts.filters.size();
+  bool projected = !plan.projection.empty();
   while( tr.read_line() ) {
-    if ( tr.nfields != ncols )
-      error("dataframe_t expects the same number of columns %d in each row, but observed %d", ncols, tr.nfields);
+    if ( projected ? ( tr.nfields < plan.min_fields ) : ( tr.nfields != plan.nfile_cols ) )
+      error("dataframe_t expects the same number of columns %d in each row, but observed %d", plan.nfile_cols, tr.nfields);
+    int32_t k;
+    for(k=0; k < nfilters; ++k) {
+      int32_t len;
+      const char* s = tr.str_field_view(plan.filter_src[k], &len);
+      if ( !opts.filters[k].match(s, s + len) ) break;
+    }
+    if ( k < nfilters ) continue;
+    if ( !inferred && ( nrows == opts.infer_rows ) ) {
+      for(int32_t i=0; i < ncols; ++i) {
+        int32_t style;
+        int32_t type = columns[i].infer_type(style, arena);
+        if ( !plan.fixed[i] ) columns[i].convert(type, arena, style);
+        columns[i].check_cardinality(arena);
+      }
+      inferred = true;
+    }
     for(int32_t i=0; i < ncols; ++i) {
-      columns[i].push_back(tr.str_field_at(i));
+      int32_t len;
+      const char* s = tr.str_field_view(plan.src[i], &len);
+      if ( columns[i].append(s, s + len, arena) )
+        continue;
+      if ( plan.fixed[i] )
+        error("[E:%s:%d %s] Cannot read '%.*s' in column %s of %s as the type %d given to the column", __FILE__, __LINE__, __FUNCTION__, len, s, colnames[i].c_str(), tsvfile, columns[i].type);
+      columns[i].widen_for(s, s + len, arena);
+      columns[i].append(s, s + len, arena);
     }
     ++nrows;
   }
+  if ( !inferred ) {
+    for(int32_t i=0; i < ncols; ++i) {
+      int32_t style;
+      int32_t type = columns[i].infer_type(style, arena);
+      if ( !plan.fixed[i] ) columns[i].convert(type, arena, style);
+    }
+  }
+  for(int32_t i=0; i < ncols; ++i)
+    columns[i].check_cardinality(arena);
+}
+
+// Each chunk of the file is loaded into a separate dataframe_t with its own
+// arena, inferring its own types as load() does. The chunks are then brought
+// to the widest type of each column, and concatenated in file order; the
+// arenas are concatenated by moving their chunks, without copying strings.
+bool dataframe_t::load_parallel(const char* tsvfile, const dataframe_load_opts_t& opts, const dataframe_load_plan_t& plan) {
+  tsv_parallel_scan scan(tsvfile, opts.nthreads);
+  scan.projection = plan.projection;
+  scan.plan();
+  int32_t nparts = (int32_t)scan.chunks.size();
+  std::vector<dataframe_t> parts(nparts);
+  for(int32_t p=0; p < nparts; ++p) {
+    parts[p].colnames = colnames;
+    parts[p].columns = columns; // empty columns of the given types
+    parts[p].ncols = ncols;
+  }
+  scan.scan_batches([&](tsv_reader& tr, tsv_scan_chunk& c) {
+    if ( ( c.index == 0 ) && ( tr.read_line() == 0 ) ) // skip the header line
+      return;
+    parts[c.index].read_rows(tr, opts, plan, tsvfile);
+  });
 
-  tr.close();
+  for(int32_t i=0; i < ncols; ++i) {
+    // the widest type of the non-empty parts
+    int32_t type = -1, style = 0;
+    for(int32_t p=0; p < nparts; ++p) {
+      const dataframe_column_t& c = parts[p].columns[i];
+      if ( parts[p].nrows == 0 ) continue;
+      if ( type < 0 ) { type = c.type; style = c.bool_style; }
+      else if ( ( type == DF_TYPE_BOOL ) && ( c.type == DF_TYPE_BOOL ) && ( style != c.bool_style ) ) type = DF_TYPE_STRING;
+      else if ( type != c.type )
+        type = ( ( type == DF_TYPE_INT64 || type == DF_TYPE_DOUBLE ) && ( c.type == DF_TYPE_INT64 || c.type == DF_TYPE_DOUBLE ) ) ? DF_TYPE_DOUBLE : DF_TYPE_STRING;
+    }
+    if ( type < 0 ) type = columns[i].type;
+    for(int32_t p=0; p < nparts; ++p) {
+      if ( !parts[p].columns[i].convert(type, parts[p].arena, style) ) { // int64 beyond 2^53
+        type = DF_TYPE_STRING;
+        p = -1;
+      }
+    }
+    // converted parts may have switched to arena offsets, so the encoding is chosen after the conversion
+    bool to_arena = false;
+    for(int32_t p=0; ( type == DF_TYPE_STRING ) && ( p < nparts ); ++p)
+      to_arena = to_arena || ( parts[p].columns[i].str_enc == DF_STR_ARENA );
+    for(int32_t p=0; to_arena && ( p < nparts ); ++p)
+      parts[p].columns[i].set_str_enc(DF_STR_ARENA, parts[p].arena);
+    columns[i].type = type;
+    columns[i].bool_style = style;
+    if ( type == DF_TYPE_STRING ) columns[i].str_enc = to_arena ? DF_STR_ARENA : DF_STR_DICT;
+  }
+
+  for(int32_t p=0; p < nparts; ++p) {
+    uint64_t base = arena.absorb(parts[p].arena);
+    for(int32_t i=0; i < ncols; ++i)
+      columns[i].concat(parts[p].columns[i], base, arena);
+    nrows += parts[p].nrows;
+    std::vector<dataframe_column_t>().swap(parts[p].columns); // release the part
+  }
+  for(int32_t i=0; i < ncols; ++i)
+    columns[i].check_cardinality(arena);
   return true;
 }
 
+bool dataframe_t::load(const char* tsvfile) {
+  return load(tsvfile, dataframe_load_opts_t());
+}
+
+const dataframe_column_t& dataframe_t::typed_column(int32_t col, int32_t type) const {
+  if ( columns[col].type != type )
+    error("[E:%s:%d %s] Column %s has the type %d, not %d", __FILE__, __LINE__, __FUNCTION__, colnames[col].c_str(), columns[col].type, type);
+  return columns[col];
+}
+
+void dataframe_t::get_double_values(int32_t col, std::vector<double>& values) const {
+  const dataframe_column_t& c = columns[col];
+  switch( c.type ) {
+  case DF_TYPE_INT64:  values.assign(c.ints.begin(), c.ints.end()); break;
+  case DF_TYPE_DOUBLE: values = c.dbls; break;
+  case DF_TYPE_BOOL:   values.assign(c.bools.begin(), c.bools.end()); break;
+  default:
+    error("[E:%s:%d %s] Column %s holds strings, not numbers", __FILE__, __LINE__, __FUNCTION__, colnames[col].c_str());
+  }
+}
+
+const dataframe_column_t& dataframe_t::dict_column(int32_t col) const {
+  if ( !is_dict_column(col) )
+    error("[E:%s:%d %s] Column %s is not dictionary-encoded", __FILE__, __LINE__, __FUNCTION__, colnames[col].c_str());
+  return columns[col];
+}
+
+int32_t dataframe_t::find_rows(int32_t col, const char* value, std::vector<int32_t>& rows) const {
+  const dataframe_column_t& c = columns[col];
+  const char* end = value + strlen(value);
+  rows.clear();
+  switch( c.type ) {
+  case DF_TYPE_INT64: {
+    int64_t v;
+    if ( parse_int64(value, end, v) ) {
+      for(int32_t i=0; i < nrows; ++i)
+        if ( c.ints[i] == v ) rows.push_back(i);
+    }
+    break;
+  }
+  case DF_TYPE_DOUBLE: {
+    double v;
+    if ( parse_double(value, end, v) ) {
+      for(int32_t i=0; i < nrows; ++i)
+        if ( c.dbls[i] == v ) rows.push_back(i);
+    }
+    break;
+  }
+  case DF_TYPE_BOOL: {
+    uint8_t v;
+    if ( parse_bool(value, end, v) >= 0 ) {
+      for(int32_t i=0; i < nrows; ++i)
+        if ( c.bools[i] == v ) rows.push_back(i);
+    }
+    break;
+  }
+  default:
+    if ( c.str_enc == DF_STR_DICT ) { // compare the codes
+      int64_t code = c.find_code(value, end - value, arena);
+      if ( code >= 0 ) {
+        for(int32_t i=0; i < nrows; ++i)
+          if ( c.code_at(i) == (uint32_t)code ) rows.push_back(i);
+      }
+    }
+    else {
+      int32_t vlen = (int32_t)( end - value );
+      for(int32_t i=0; i < nrows; ++i) {
+        int32_t len;
+        const char* p = c.str_view(i, arena, &len);
+        if ( ( len == vlen ) && ( memcmp(p, value, len) == 0 ) ) rows.push_back(i);
+      }
+    }
+  }
+  return (int32_t)rows.size();
+}
+
+void dataframe_t::join(const dataframe_t& right, const std::vector<std::string>& left_keys, const std::vector<std::string>& right_keys,
+                       int32_t how, dataframe_t& out, int32_t nthreads) const {
+  std::vector<int32_t> left_cols;
+  for(size_t j=0; j < left_keys.size(); ++j) {
+    std::map<std::string,uint32_t>::const_iterator it = col2idx.find(left_keys[j]);
+    if ( it == col2idx.end() )
+      error("[E:%s:%d %s] Cannot find column %s", __FILE__, __LINE__, __FUNCTION__, left_keys[j].c_str());
+    left_cols.push_back((int32_t)it->second);
+  }
+  dataframe_index_t index;
+  index.build(right, right_keys, nthreads);
+  index.join(*this, left_cols, how, out, nthreads);
+}
+
+std::vector<std::string>& dataframe_t::get_column(int32_t col) {
+  columns[col].convert(DF_TYPE_STRING, arena);
+  columns[col].set_str_enc(DF_STR_VECTOR, arena);
+  return columns[col].strs;
+}
+
 int32_t dataframe_t::add_empty_column(const char* colname) {
   colnames.push_back(colname);
   columns.resize(ncols+1);
-  columns[ncols].resize(nrows);
+  columns[ncols].resize(nrows, arena);
   if ( col2idx.find(colnames[ncols]) == col2idx.end() )
     col2idx[colnames[ncols]] = ncols;
   else
@@ -45,16 +929,18 @@ int32_t dataframe_t::add_empty_column(const char* colname) {
 int32_t dataframe_t::add_empty_row() {
   ++nrows;
   for(int32_t i=0; i < ncols; ++i)
-    columns[i].resize(nrows);
+    columns[i].resize(nrows, arena);
   return nrows-1;
 }
 
 void dataframe_t::set_str_elem(const char*s, int32_t row, int32_t col) {
-  columns[col][row].assign(s);
+  const char* end = s + strlen(s);
+  if ( !columns[col].set(row, s, end, arena) ) {
+    columns[col].widen_for(s, end, arena);
+    columns[col].set(row, s, end, arena);
+  }
 }
 
 void dataframe_t::set_str_elem(const char*s, int32_t row, const char* colname) {
-  get_column(colname).at(row).assign(s);
+  set_str_elem(s, checked_row(row), (int32_t)col2idx.at(colname));
 }
-
-
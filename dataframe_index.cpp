@@ -0,0 +1,447 @@
+#include "qgenlib/dataframe_index.h"
+#include "qgenlib/qgen_error.h"
+
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <atomic>
+
+#define DF_KEY_STR  0
+#define DF_KEY_INT  1 // integers, and doubles with an integral value that fits in int64
+#define DF_KEY_DBL  2
+#define DF_KEY_BOOL 3
+
+// one component of a key, pointing into a dataframe or a scratch buffer
+struct df_key_ref {
+  int32_t kind; // DF_KEY_*
+  const char* s;
+  int32_t len;
+  int64_t i;
+  double d;
+};
+
+static inline uint64_t mix64(uint64_t x) { // splitmix64 finalizer
+  x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+  return x ^ ( x >> 31 );
+}
+
+static inline uint64_t combine_hash(uint64_t h, uint64_t v) {
+  return mix64(h ^ ( v + 0x9e3779b97f4a7c15ULL + ( h << 6 ) + ( h >> 2 ) ));
+}
+
+static inline void set_num_key(double d, df_key_ref& k) {
+  if ( ( d >= -9223372036854775808.0 ) && ( d < 9223372036854775808.0 ) && ( d == (double)(int64_t)d ) ) {
+    k.kind = DF_KEY_INT;
+    k.i = (int64_t)d;
+  }
+  else {
+    k.kind = DF_KEY_DBL;
+    k.d = d;
+  }
+}
+
+static inline uint64_t hash_key(const df_key_ref& k) {
+  switch( k.kind ) {
+  case DF_KEY_STR:  return df_hash_bytes(k.s, k.len);
+  case DF_KEY_DBL:  { uint64_t u; memcpy(&u, &k.d, 8); return mix64(u); } // never 0, which is DF_KEY_INT
+  case DF_KEY_BOOL: return mix64((uint64_t)k.i ^ 0x5bd1e9955bd1e995ULL);
+  default:          return mix64((uint64_t)k.i);
+  }
+}
+
+static inline bool key_equal(const df_key_ref& a, const df_key_ref& b) {
+  if ( a.kind != b.kind ) return false;
+  switch( a.kind ) {
+  case DF_KEY_STR: return ( a.len == b.len ) && ( memcmp(a.s, b.s, a.len) == 0 );
+  case DF_KEY_DBL: return a.d == b.d;
+  default:         return a.i == b.i;
+  }
+}
+
+static inline bool same_category(int32_t t1, int32_t t2) {
+  if ( ( t1 == DF_TYPE_INT64 ) || ( t1 == DF_TYPE_DOUBLE ) )
+    return ( t2 == DF_TYPE_INT64 ) || ( t2 == DF_TYPE_DOUBLE );
+  return t1 == t2;
+}
+
+// the key of a value of a column
+static inline void column_key(const dataframe_column_t& c, const dataframe_arena_t& arena, int32_t row, df_key_ref& k) {
+  switch( c.type ) {
+  case DF_TYPE_INT64:  k.kind = DF_KEY_INT; k.i = c.ints[row]; break;
+  case DF_TYPE_DOUBLE: set_num_key(c.dbls[row], k); break;
+  case DF_TYPE_BOOL:   k.kind = DF_KEY_BOOL; k.i = c.bools[row]; break;
+  default:             k.kind = DF_KEY_STR; k.s = c.str_view(row, arena, &k.len);
+  }
+}
+
+// the key of a text compared with a column of the given type; returns false
+// if the text cannot be a value of the column
+static bool text_key(int32_t type, const char* s, int32_t len, df_key_ref& k) {
+  const char* end = s + len;
+  switch( type ) {
+  case DF_TYPE_INT64:
+  case DF_TYPE_DOUBLE: {
+    int64_t i;
+    double d;
+    if ( parse_int64(s, end, i) ) { k.kind = DF_KEY_INT; k.i = i; return true; }
+    if ( !parse_double(s, end, d) ) return false;
+    set_num_key(d, k);
+    return true;
+  }
+  case DF_TYPE_BOOL:
+    for(int32_t i=0; i < 3; ++i) {
+      for(int32_t j=0; j < 2; ++j) {
+        const char* name = dataframe_column_t::bool_names[i][j];
+        if ( ( (int32_t)strlen(name) == len ) && ( memcmp(name, s, len) == 0 ) ) {
+          k.kind = DF_KEY_BOOL;
+          k.i = j;
+          return true;
+        }
+      }
+    }
+    return false;
+  default:
+    k.kind = DF_KEY_STR;
+    k.s = s;
+    k.len = len;
+    return true;
+  }
+}
+
+// reads the keys of the rows of a dataframe, to be compared with key columns
+// of the given types. Values of another category (e.g. a string column
+// against an int64 column) are compared as text. The hashes of the entries of
+// dictionary-encoded columns are computed once.
+struct df_key_reader {
+  const dataframe_t* df;
+  std::vector<int32_t> cols;
+  std::vector<int32_t> types;
+  std::vector<bool> as_text;
+  std::vector<std::vector<uint64_t> > dict_hashes;
+
+  df_key_reader(const dataframe_t& _df, const std::vector<int32_t>& _cols, const std::vector<int32_t>& _types)
+    : df(&_df), cols(_cols), types(_types), as_text(_cols.size()), dict_hashes(_cols.size()) {
+    for(size_t j=0; j < cols.size(); ++j) {
+      const dataframe_column_t& c = df->columns[cols[j]];
+      as_text[j] = !same_category(c.type, types[j]);
+      if ( !as_text[j] && df->is_dict_column(cols[j]) ) {
+        std::vector<uint64_t>& dh = dict_hashes[j];
+        dh.resize(c.dict_offs.size());
+        for(size_t k=0; k < dh.size(); ++k)
+          dh[k] = df_hash_bytes(df->arena.at(c.dict_offs[k]), c.dict_lens[k]);
+      }
+    }
+  }
+
+  // the keys and their hash; returns false if the row cannot match any key.
+  // bufs (one per key column) hold the text of converted values
+  inline bool read(int32_t row, df_key_ref* keys, std::string* bufs, uint64_t& h) const {
+    h = 0;
+    for(size_t j=0; j < cols.size(); ++j) {
+      const dataframe_column_t& c = df->columns[cols[j]];
+      if ( as_text[j] ) {
+        c.to_string(row, bufs[j], df->arena);
+        if ( !text_key(types[j], bufs[j].data(), (int32_t)bufs[j].size(), keys[j]) )
+          return false;
+        h = combine_hash(h, hash_key(keys[j]));
+      }
+      else if ( !dict_hashes[j].empty() ) {
+        uint32_t code = c.code_at(row);
+        keys[j].kind = DF_KEY_STR;
+        keys[j].len = (int32_t)c.dict_lens[code];
+        keys[j].s = df->arena.at(c.dict_offs[code]);
+        h = combine_hash(h, dict_hashes[j][code]);
+      }
+      else {
+        column_key(c, df->arena, row, keys[j]);
+        h = combine_hash(h, hash_key(keys[j]));
+      }
+    }
+    return true;
+  }
+};
+
+// the number of threads working on n rows, each with at least DF_INDEX_MIN_BLOCK rows
+static int32_t num_blocks(int64_t n, int32_t nthreads) {
+  int64_t nb = n / DF_INDEX_MIN_BLOCK;
+  if ( nb > nthreads ) nb = nthreads;
+  return nb < 1 ? 1 : (int32_t)nb;
+}
+
+// run fn(i) for i in [0, ntasks) with up to nthreads threads
+static void run_tasks(int32_t ntasks, int32_t nthreads, const std::function<void(int32_t)>& fn) {
+  if ( ( nthreads <= 1 ) || ( ntasks <= 1 ) ) {
+    for(int32_t i=0; i < ntasks; ++i) fn(i);
+    return;
+  }
+  std::atomic<int32_t> next(0);
+  std::vector<std::thread> threads;
+  for(int32_t t=0; ( t < nthreads ) && ( t < ntasks ); ++t) {
+    threads.emplace_back([&]() {
+      int32_t i;
+      while( ( i = next++ ) < ntasks )
+        fn(i);
+    });
+  }
+  for(size_t t=0; t < threads.size(); ++t)
+    threads[t].join();
+}
+
+static int32_t part_bits() {
+  int32_t b = 0;
+  while( ( 1 << b ) < DF_INDEX_PARTS ) ++b;
+  return b;
+}
+
+static inline int32_t part_of(uint64_t h) {
+  static const int32_t bits = part_bits();
+  return bits == 0 ? 0 : (int32_t)( h >> ( 64 - bits ) );
+}
+
+void dataframe_index_t::build(const dataframe_t& _df, const std::vector<int32_t>& _cols, int32_t nthreads) {
+  if ( _cols.empty() )
+    error("[E:%s:%d %s] No key columns to index", __FILE__, __LINE__, __FUNCTION__);
+  for(size_t j=0; j < _cols.size(); ++j) {
+    if ( ( _cols[j] < 0 ) || ( _cols[j] >= _df.ncols ) )
+      error("[E:%s:%d %s] Column %d is out of range [0, %d)", __FILE__, __LINE__, __FUNCTION__, _cols[j], _df.ncols);
+  }
+  df = &_df;
+  cols = _cols;
+  int32_t n = df->nrows;
+  int32_t nk = (int32_t)cols.size();
+  std::vector<int32_t> types(nk);
+  for(int32_t j=0; j < nk; ++j)
+    types[j] = df->columns[cols[j]].type;
+  df_key_reader reader(*df, cols, types);
+
+  // hash the rows
+  hashes.resize(n);
+  int32_t nb = num_blocks(n, nthreads);
+  run_tasks(nb, nb, [&](int32_t b) {
+    std::vector<df_key_ref> keys(nk);
+    std::vector<std::string> bufs(nk);
+    for(int32_t r = (int32_t)( (int64_t)n * b / nb ); r < (int32_t)( (int64_t)n * ( b + 1 ) / nb ); ++r)
+      reader.read(r, keys.data(), bufs.data(), hashes[r]);
+  });
+
+  // split the rows into partitions, in row order
+  std::vector<std::vector<int32_t> > part_rows(DF_INDEX_PARTS);
+  {
+    std::vector<int32_t> counts(DF_INDEX_PARTS, 0);
+    for(int32_t r=0; r < n; ++r) ++counts[part_of(hashes[r])];
+    for(int32_t p=0; p < DF_INDEX_PARTS; ++p) part_rows[p].reserve(counts[p]);
+    for(int32_t r=0; r < n; ++r) part_rows[part_of(hashes[r])].push_back(r);
+  }
+
+  // build the hash table of each partition, chaining the rows of each key
+  next_row.assign(n, -1);
+  slots.assign(DF_INDEX_PARTS, std::vector<int32_t>());
+  std::vector<int32_t> part_keys(DF_INDEX_PARTS, 0);
+  run_tasks(DF_INDEX_PARTS, nthreads, [&](int32_t p) {
+    const std::vector<int32_t>& rows = part_rows[p];
+    if ( rows.empty() ) return;
+    size_t nslots = 16;
+    while( nslots < rows.size() * 2 ) nslots *= 2;
+    size_t mask = nslots - 1;
+    std::vector<int32_t>& s = slots[p];
+    std::vector<int32_t> tails(nslots, -1); // last row of the key in each slot
+    s.assign(nslots, -1);
+    std::vector<df_key_ref> keys(nk), keys0(nk);
+    for(size_t k=0; k < rows.size(); ++k) {
+      int32_t r = rows[k];
+      uint64_t h = hashes[r];
+      for(int32_t j=0; j < nk; ++j)
+        column_key(df->columns[cols[j]], df->arena, r, keys[j]);
+      for(size_t i = h & mask; ; i = ( i + 1 ) & mask) {
+        int32_t r0 = s[i];
+        if ( r0 < 0 ) {
+          s[i] = tails[i] = r;
+          ++part_keys[p];
+          break;
+        }
+        if ( hashes[r0] != h ) continue;
+        bool eq = true;
+        for(int32_t j=0; ( j < nk ) && eq; ++j) {
+          column_key(df->columns[cols[j]], df->arena, r0, keys0[j]);
+          eq = key_equal(keys[j], keys0[j]);
+        }
+        if ( eq ) {
+          next_row[tails[i]] = r;
+          tails[i] = r;
+          break;
+        }
+      }
+    }
+  });
+  nkeys = 0;
+  for(int32_t p=0; p < DF_INDEX_PARTS; ++p)
+    nkeys += part_keys[p];
+}
+
+void dataframe_index_t::build(const dataframe_t& _df, const std::vector<std::string>& colnames, int32_t nthreads) {
+  std::vector<int32_t> _cols;
+  for(size_t j=0; j < colnames.size(); ++j) {
+    std::map<std::string,uint32_t>::const_iterator it = _df.col2idx.find(colnames[j]);
+    if ( it == _df.col2idx.end() )
+      error("[E:%s:%d %s] Cannot find column %s", __FILE__, __LINE__, __FUNCTION__, colnames[j].c_str());
+    _cols.push_back((int32_t)it->second);
+  }
+  build(_df, _cols, nthreads);
+}
+
+int32_t dataframe_index_t::probe(uint64_t h, const df_key_ref* keys) const {
+  const std::vector<int32_t>& s = slots[part_of(h)];
+  if ( s.empty() ) return -1;
+  size_t mask = s.size() - 1;
+  int32_t nk = (int32_t)cols.size();
+  df_key_ref k0;
+  for(size_t i = h & mask; ; i = ( i + 1 ) & mask) {
+    int32_t r0 = s[i];
+    if ( r0 < 0 ) return -1;
+    if ( hashes[r0] != h ) continue;
+    bool eq = true;
+    for(int32_t j=0; ( j < nk ) && eq; ++j) {
+      column_key(df->columns[cols[j]], df->arena, r0, k0);
+      eq = key_equal(keys[j], k0);
+    }
+    if ( eq ) return r0;
+  }
+}
+
+int32_t dataframe_index_t::find(const std::vector<std::string>& key) const {
+  if ( key.size() != cols.size() )
+    error("[E:%s:%d %s] The key has %zu values for %zu key columns", __FILE__, __LINE__, __FUNCTION__, key.size(), cols.size());
+  if ( df == NULL ) return -1;
+  std::vector<df_key_ref> keys(cols.size());
+  uint64_t h = 0;
+  for(size_t j=0; j < cols.size(); ++j) {
+    if ( !text_key(df->columns[cols[j]].type, key[j].data(), (int32_t)key[j].size(), keys[j]) )
+      return -1;
+    h = combine_hash(h, hash_key(keys[j]));
+  }
+  return probe(h, keys.data());
+}
+
+int32_t dataframe_index_t::find(const char* key) const {
+  return find(std::vector<std::string>(1, key));
+}
+
+int32_t dataframe_index_t::find_row(const dataframe_t& other, const std::vector<int32_t>& other_cols, int32_t row) const {
+  if ( other_cols.size() != cols.size() )
+    error("[E:%s:%d %s] %zu key columns are compared with %zu indexed columns", __FILE__, __LINE__, __FUNCTION__, other_cols.size(), cols.size());
+  if ( df == NULL ) return -1;
+  int32_t nk = (int32_t)cols.size();
+  std::vector<df_key_ref> keys(nk);
+  std::vector<std::string> bufs(nk);
+  uint64_t h = 0;
+  for(int32_t j=0; j < nk; ++j) {
+    const dataframe_column_t& c = other.columns[other_cols[j]];
+    int32_t type = df->columns[cols[j]].type;
+    if ( same_category(c.type, type) )
+      column_key(c, other.arena, row, keys[j]);
+    else {
+      c.to_string(row, bufs[j], other.arena);
+      if ( !text_key(type, bufs[j].data(), (int32_t)bufs[j].size(), keys[j]) )
+        return -1;
+    }
+    h = combine_hash(h, hash_key(keys[j]));
+  }
+  return probe(h, keys.data());
+}
+
+// The left rows are probed by blocks in parallel, keeping the pairs of each
+// block in order. The columns of out are then gathered in parallel, each with
+// its own arena, which is moved into the arena of out.
+void dataframe_index_t::join(const dataframe_t& left, const std::vector<int32_t>& left_cols, int32_t how, dataframe_t& out, int32_t nthreads, const char* suffix) const {
+  if ( df == NULL )
+    error("[E:%s:%d %s] The index is not built", __FILE__, __LINE__, __FUNCTION__);
+  if ( left_cols.size() != cols.size() )
+    error("[E:%s:%d %s] %zu key columns are joined with %zu indexed columns", __FILE__, __LINE__, __FUNCTION__, left_cols.size(), cols.size());
+  if ( ( how != DF_JOIN_INNER ) && ( how != DF_JOIN_LEFT ) )
+    error("[E:%s:%d %s] Unknown join type %d", __FILE__, __LINE__, __FUNCTION__, how);
+  if ( ( &out == &left ) || ( &out == df ) )
+    error("[E:%s:%d %s] The output of a join cannot be one of its inputs", __FILE__, __LINE__, __FUNCTION__);
+
+  // pair the left rows with the matching rows
+  int32_t nk = (int32_t)cols.size();
+  std::vector<int32_t> types(nk);
+  for(int32_t j=0; j < nk; ++j)
+    types[j] = df->columns[cols[j]].type;
+  df_key_reader reader(left, left_cols, types);
+  int32_t nb = num_blocks(left.nrows, nthreads);
+  std::vector<std::vector<int32_t> > blk_lrows(nb), blk_rrows(nb);
+  run_tasks(nb, nb, [&](int32_t b) {
+    std::vector<df_key_ref> keys(nk);
+    std::vector<std::string> bufs(nk);
+    std::vector<int32_t>& lrows = blk_lrows[b];
+    std::vector<int32_t>& rrows = blk_rrows[b];
+    for(int32_t r = (int32_t)( (int64_t)left.nrows * b / nb ); r < (int32_t)( (int64_t)left.nrows * ( b + 1 ) / nb ); ++r) {
+      uint64_t h;
+      int32_t r2 = reader.read(r, keys.data(), bufs.data(), h) ? probe(h, keys.data()) : -1;
+      if ( r2 < 0 ) {
+        if ( how == DF_JOIN_LEFT ) {
+          lrows.push_back(r);
+          rrows.push_back(-1);
+        }
+        continue;
+      }
+      for(; r2 >= 0; r2 = next_row[r2]) {
+        lrows.push_back(r);
+        rrows.push_back(r2);
+      }
+    }
+  });
+  std::vector<int32_t> lrows, rrows;
+  for(int32_t b=0; b < nb; ++b) {
+    lrows.insert(lrows.end(), blk_lrows[b].begin(), blk_lrows[b].end());
+    rrows.insert(rrows.end(), blk_rrows[b].begin(), blk_rrows[b].end());
+    std::vector<int32_t>().swap(blk_lrows[b]);
+    std::vector<int32_t>().swap(blk_rrows[b]);
+  }
+
+  // the output columns: all left columns, then the non-key right columns
+  std::vector<const dataframe_t*> srcs;
+  std::vector<int32_t> src_cols;
+  out.colnames.clear();
+  out.col2idx.clear();
+  for(int32_t i=0; i < left.ncols; ++i) {
+    srcs.push_back(&left);
+    src_cols.push_back(i);
+    out.colnames.push_back(left.colnames[i]);
+  }
+  for(int32_t i=0; i < df->ncols; ++i) {
+    bool is_key = false;
+    for(int32_t j=0; j < nk; ++j)
+      if ( cols[j] == i ) is_key = true;
+    if ( is_key ) continue;
+    srcs.push_back(df);
+    src_cols.push_back(i);
+    out.colnames.push_back(df->colnames[i]);
+  }
+  for(size_t i=0; i < out.colnames.size(); ++i) {
+    if ( out.col2idx.find(out.colnames[i]) != out.col2idx.end() ) {
+      out.colnames[i] += suffix;
+      if ( out.col2idx.find(out.colnames[i]) != out.col2idx.end() )
+        error("[E:%s:%d %s] Duplicate column name %s in the joined dataframe", __FILE__, __LINE__, __FUNCTION__, out.colnames[i].c_str());
+    }
+    out.col2idx[out.colnames[i]] = (uint32_t)i;
+  }
+
+  // gather the values of each column
+  int32_t nc = (int32_t)out.colnames.size();
+  std::vector<dataframe_arena_t> arenas(nc);
+  out.columns.assign(nc, dataframe_column_t());
+  run_tasks(nc, nthreads, [&](int32_t i) {
+    out.columns[i].gather(srcs[i]->columns[src_cols[i]], srcs[i]->arena, srcs[i] == &left ? lrows : rrows, arenas[i]);
+  });
+  out.arena.clear();
+  std::vector<uint64_t> bases(nc);
+  for(int32_t i=0; i < nc; ++i)
+    bases[i] = out.arena.absorb(arenas[i]);
+  run_tasks(nc, nthreads, [&](int32_t i) {
+    out.columns[i].rebase(bases[i]);
+  });
+  out.ncols = nc;
+  out.nrows = (int32_t)lrows.size();
+}
@@ -0,0 +1,111 @@
+/* The MIT License
+
+   Copyright (c) 2016-2022 Hyun Min Kang <hmkang@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "qgenlib/mmap_reader.h"
+#include "qgenlib/qgen_error.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+bool mmap_reader::open(const char* _filename, uint64_t _window) {
+  filename = _filename;
+  fd = ::open(_filename, O_RDONLY);
+  if ( fd < 0 )
+    return false;
+
+  struct stat st;
+  if ( ( fstat(fd, &st) != 0 ) || !S_ISREG(st.st_mode) ) { // pipes and devices cannot be mapped
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+  size = (uint64_t)st.st_size;
+
+  uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+  window = ( _window < page ) ? page : ( _window / page * page );
+  pos = line_beg = 0;
+  if ( !map() ) {
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+  return true;
+}
+
+// Pages are mapped copy-on-write, so a caller may modify a line in place
+// without affecting the file, at the cost of copying the touched pages.
+bool mmap_reader::map() {
+  released = 0;
+  if ( size == 0 ) { // empty files cannot be mapped
+    base = NULL;
+    return true;
+  }
+  void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if ( p == MAP_FAILED ) {
+    base = NULL;
+    return false;
+  }
+  base = (char*)p;
+  madvise(base, size, MADV_SEQUENTIAL);
+  return true;
+}
+
+// unmap the windows entirely before upto, and ask the kernel to read ahead the next one
+void mmap_reader::release(uint64_t upto) {
+  uint64_t aligned = upto / window * window;
+  if ( aligned > released ) {
+    munmap(base + released, aligned - released);
+    released = aligned;
+    uint64_t ahead = released + window; // the window following the current one
+    if ( ahead < size )
+      madvise(base + ahead, ( size - ahead < window ) ? size - ahead : window, MADV_WILLNEED);
+  }
+}
+
+bool mmap_reader::seek(uint64_t offset) {
+  if ( !is_open() || ( offset > size ) )
+    return false;
+  if ( offset < released ) { // the window was already unmapped
+    if ( size > released )
+      munmap(base + released, size - released);
+    if ( !map() )
+      error("[E:%s:%d %s] Cannot map file %s again", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+  }
+  pos = offset;
+  return true;
+}
+
+bool mmap_reader::close() {
+  if ( !is_open() )
+    return false;
+  if ( ( base != NULL ) && ( size > released ) )
+    munmap(base + released, size - released);
+  base = NULL;
+  released = pos = line_beg = size = 0;
+  pinned = UINT64_MAX;
+  int32_t ret = ::close(fd);
+  fd = -1;
+  return ret == 0;
+}
@@ -0,0 +1,144 @@
+/* The MIT License
+
+   Copyright (c) 2016-2022 Hyun Min Kang <hmkang@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "qgenlib/num_parser.h"
+
+#include <cstdlib>
+#include <string>
+#ifdef __GLIBC__
+#include <locale.h>
+#endif
+
+// powers of ten that are exactly representable as doubles
+static const double exact_pow10[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define MAX_EXACT_MANTISSA ( (uint64_t)1 << 53 )
+
+// strtod() on a copy of [s, end), interpreted in the C locale where possible
+static const char* strtod_fallback(const char* s, const char* end, double& v) {
+  char sbuf[128];
+  std::string lbuf;
+  char* buf = sbuf;
+  size_t len = end - s;
+  if ( len >= sizeof(sbuf) ) {
+    lbuf.assign(s, len);
+    buf = &lbuf[0];
+  }
+  else {
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+  }
+  char* pend;
+#ifdef __GLIBC__
+  static locale_t c_locale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+  v = strtod_l(buf, &pend, c_locale);
+#else
+  v = strtod(buf, &pend);
+#endif
+  return s + ( pend - buf );
+}
+
+const char* num_parser_detail::parse_double(const char* s, const char* end, double& v) {
+  const char* p = s;
+  bool neg = false;
+  if ( ( p < end ) && ( ( *p == '-' ) || ( *p == '+' ) ) ) {
+    neg = ( *p == '-' );
+    ++p;
+  }
+  if ( ( end - p > 1 ) && ( p[0] == '0' ) && ( ( p[1] == 'x' ) || ( p[1] == 'X' ) ) ) // hexadecimal, as strtod() reads it
+    return strtod_fallback(s, end, v);
+
+  uint64_t m = 0;         // up to 19 significant digits
+  int32_t nsig = 0;       // number of significant digits in m
+  int32_t ndigits = 0;    // number of digits seen in the mantissa
+  int64_t exp10 = 0;      // decimal exponent applied to m
+  bool truncated = false; // true if a nonzero digit did not fit into m
+
+  for(; ( p < end ) && ( (unsigned char)( *p - '0' ) < 10 ); ++p, ++ndigits) {
+    uint32_t d = *p - '0';
+    if ( ( m == 0 ) && ( d == 0 ) ) continue;
+    if ( nsig < 19 ) { m = m * 10 + d; ++nsig; }
+    else { ++exp10; truncated |= ( d != 0 ); }
+  }
+  if ( ( p < end ) && ( *p == '.' ) ) {
+    ++p;
+    for(; ( p < end ) && ( (unsigned char)( *p - '0' ) < 10 ); ++p, ++ndigits) {
+      uint32_t d = *p - '0';
+      if ( ( m == 0 ) && ( d == 0 ) ) { --exp10; continue; }
+      if ( nsig < 19 ) { m = m * 10 + d; ++nsig; --exp10; }
+      else truncated |= ( d != 0 );
+    }
+  }
+  if ( ndigits == 0 ) { // no decimal digits: inf, nan, or not a number at all
+    const char* q = ( p > s ) && ( *(p-1) == '.' ) ? p - 1 : p;
+    if ( ( q < end ) && ( ( *q == 'i' ) || ( *q == 'I' ) || ( *q == 'n' ) || ( *q == 'N' ) ) )
+      return strtod_fallback(s, end, v);
+    v = 0;
+    return s;
+  }
+
+  if ( ( p < end ) && ( ( *p == 'e' ) || ( *p == 'E' ) ) ) {
+    const char* q = p + 1;
+    bool eneg = false;
+    if ( ( q < end ) && ( ( *q == '-' ) || ( *q == '+' ) ) ) {
+      eneg = ( *q == '-' );
+      ++q;
+    }
+    if ( ( q < end ) && ( (unsigned char)( *q - '0' ) < 10 ) ) { // otherwise 'e' is not part of the number
+      int64_t e = 0;
+      for(; ( q < end ) && ( (unsigned char)( *q - '0' ) < 10 ); ++q)
+        if ( e < 100000 ) e = e * 10 + ( *q - '0' );
+      exp10 += ( eneg ? -e : e );
+      p = q;
+    }
+  }
+
+  if ( m == 0 ) {
+    v = neg ? -0.0 : 0.0;
+    return p;
+  }
+  if ( !truncated && ( m <= MAX_EXACT_MANTISSA ) ) {
+    // both m and 10^|exp10| are exact, so a single rounding gives the correctly rounded result
+    if ( ( exp10 >= -22 ) && ( exp10 <= 22 ) ) {
+      double d = (double)m;
+      d = ( exp10 < 0 ) ? d / exact_pow10[-exp10] : d * exact_pow10[exp10];
+      v = neg ? -d : d;
+      return p;
+    }
+    else if ( ( exp10 > 22 ) && ( exp10 <= 22 + 15 ) ) { // shift the excess exponent into the mantissa if it stays exact
+      while( ( exp10 > 22 ) && ( m <= MAX_EXACT_MANTISSA / 10 ) ) {
+        m *= 10;
+        --exp10;
+      }
+      if ( exp10 == 22 ) {
+        double d = (double)m * exact_pow10[22];
+        v = neg ? -d : d;
+        return p;
+      }
+    }
+  }
+  return strtod_fallback(s, p, v);
+}
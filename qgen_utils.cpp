@@ -188,3 +188,10 @@ bool check_file_existence(const char* filename) {
     struct stat buffer;
     return (stat(filename, &buffer) == 0);
 }
+
+bool get_file_size(const char* filename, uint64_t& size) {
+  struct stat st;
+  if ( stat(filename, &st) != 0 ) return false;
+  size = (uint64_t)st.st_size;
+  return true;
+}
@@ -5,43 +5,378 @@
 #include <cstdint>
 #include <string>
 #include <map>
+#include <cstring>
+
+#include "qgen_error.h"
+#include "num_parser.h"
+
+class tsv_reader;
+
+// FNV-1a hash of a string, used by the dictionaries and by dataframe_index_t
+inline uint64_t df_hash_bytes(const char* s, size_t len) {
+  uint64_t h = 14695981039346656037ULL;
+  for(size_t i=0; i < len; ++i) {
+    h ^= (uint8_t)s[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+#define DF_TYPE_STRING 0 // text, dictionary-encoded or stored in the string arena
+#define DF_TYPE_INT64  1 // integers without leading zeros, stored as int64_t
+#define DF_TYPE_DOUBLE 2 // other numbers, stored as double
+#define DF_TYPE_BOOL   3 // true/false in a single spelling (true, TRUE or True), stored as uint8_t
+
+#define DF_STR_DICT   0 // DF_TYPE_STRING as codes (1, 2 or 4 bytes) into a dictionary of distinct values
+#define DF_STR_ARENA  1 // DF_TYPE_STRING as offsets of each value in the arena (high-cardinality columns)
+#define DF_STR_VECTOR 2 // DF_TYPE_STRING as std::string values (after get_column())
+
+#define DF_INFER_ROWS 10000 // default number of rows sampled to infer the column types
+#define DF_DICT_MIN_ARENA 256 // dictionaries with more entries than half the rows become arena offsets
+#define DF_ARENA_MIN_CHUNK (64 << 10)  // size of the first chunk of the string arena
+#define DF_ARENA_MAX_CHUNK (16 << 20)  // chunks double in size up to this
+
+// an append-only store of '\0'-terminated strings shared by the columns of a
+// dataframe_t. Strings are addressed by 64-bit offsets (chunk index in the
+// upper 32 bits), and never move, so views into the arena stay valid as long
+// as the arena does. Offset 0 is the empty string.
+class dataframe_arena_t {
+public:
+  std::vector<std::vector<char> > chunks; // each chunk is reserved once and never reallocated
+
+  dataframe_arena_t() { add("", 0); }
+
+  inline uint64_t add(const char* s, size_t len) {
+    if ( chunks.empty() || ( chunks.back().size() + len + 1 > chunks.back().capacity() ) )
+      new_chunk(len + 1);
+    std::vector<char>& c = chunks.back();
+    uint64_t off = ( (uint64_t)( chunks.size() - 1 ) << 32 ) | (uint64_t)c.size();
+    c.insert(c.end(), s, s + len);
+    c.push_back('\0');
+    return off;
+  }
+
+  inline const char* at(uint64_t off) const {
+    return chunks[off >> 32].data() + ( off & 0xffffffffULL );
+  }
+
+  // move the chunks of other to the end of this arena, emptying other; returns
+  // the value to add to the offsets of other's strings
+  uint64_t absorb(dataframe_arena_t& other);
+
+  size_t bytes() const; // allocated bytes
+  void clear() { chunks.clear(); add("", 0); }
+
+protected:
+  void new_chunk(size_t min_size);
+};
+
+// a column of dataframe_t, stored in the vector of its type. String columns
+// are dictionary-encoded, and switch to plain arena offsets when most values
+// are distinct. The arena is owned by the dataframe_t and passed to the
+// methods that read or add strings.
+//
+// Numeric and boolean values are converted back to text on demand, in a
+// canonical form: integers as is, doubles with the fewest digits that give
+// back the same value, and booleans in the spelling of the column.
+class dataframe_column_t {
+public:
+  int32_t type;                  // DF_TYPE_*
+  int32_t bool_style;            // spelling of DF_TYPE_BOOL values (index into bool_names)
+  int32_t str_enc;               // DF_STR_* encoding of DF_TYPE_STRING values
+  int32_t code_width;            // bytes per code in DF_STR_DICT (1, 2 or 4)
+  std::vector<uint8_t> codes;    // DF_STR_DICT codes, code_width bytes each
+  std::vector<uint64_t> dict_offs; // arena offset of each dictionary entry
+  std::vector<uint32_t> dict_lens; // length of each dictionary entry
+  std::vector<int32_t> dict_slots; // open-addressing table of dictionary entries, -1 if empty
+  std::vector<uint64_t> offs;    // DF_STR_ARENA arena offsets
+  std::vector<std::string> strs; // DF_STR_VECTOR values
+  std::vector<int64_t> ints;     // DF_TYPE_INT64 values
+  std::vector<double> dbls;      // DF_TYPE_DOUBLE values
+  std::vector<uint8_t> bools;    // DF_TYPE_BOOL values
+
+  static const char* bool_names[3][2]; // false/true in each spelling
+
+  dataframe_column_t() : type(DF_TYPE_STRING), bool_style(0), str_enc(DF_STR_DICT), code_width(1) {}
+
+  size_t size() const;
+  void resize(size_t n, dataframe_arena_t& arena); // new values are empty strings, 0 or false
+
+  // append or set a value; returns false, leaving the column unchanged, if it does not fit the type
+  bool append(const char* s, const char* end, dataframe_arena_t& arena);
+  bool set(size_t row, const char* s, const char* end, dataframe_arena_t& arena);
+
+  void to_string(size_t row, std::string& out, const dataframe_arena_t& arena) const; // the value at row as text
+
+  // a view of a DF_TYPE_STRING value, '\0'-terminated
+  inline const char* str_view(size_t row, const dataframe_arena_t& arena, int32_t* len) const {
+    switch( str_enc ) {
+    case DF_STR_DICT: {
+      uint32_t k = code_at(row);
+      *len = (int32_t)dict_lens[k];
+      return arena.at(dict_offs[k]);
+    }
+    case DF_STR_ARENA: {
+      const char* p = arena.at(offs[row]);
+      *len = (int32_t)strlen(p);
+      return p;
+    }
+    default:
+      *len = (int32_t)strs[row].size();
+      return strs[row].c_str();
+    }
+  }
+
+  inline uint32_t code_at(size_t row) const {
+    switch( code_width ) {
+    case 1:  return codes[row];
+    case 2:  { uint16_t c; memcpy(&c, &codes[row * 2], 2); return c; }
+    default: { uint32_t c; memcpy(&c, &codes[row * 4], 4); return c; }
+    }
+  }
+
+  // append the values of a column of the same type and encoding, whose strings were moved into
+  // arena by absorb() with the returned base; other is emptied
+  void concat(dataframe_column_t& other, uint64_t base, dataframe_arena_t& arena);
+  // replace the values by those of src at rows, whose strings are in src_arena. Rows -1 give
+  // empty strings, and make a typed column a DF_TYPE_STRING column
+  void gather(const dataframe_column_t& src, const dataframe_arena_t& src_arena, const std::vector<int32_t>& rows, dataframe_arena_t& arena);
+  // add base to the arena offsets of the strings, after their arena was moved by absorb()
+  void rebase(uint64_t base);
+
+  // dictionary code of a string, or -1 if it is not in the dictionary
+  int64_t find_code(const char* s, size_t len, const dataframe_arena_t& arena) const;
+
+  // change the type of the column; only conversions to DF_TYPE_STRING, from
+  // DF_TYPE_STRING (returns false if some value does not fit) and from
+  // DF_TYPE_INT64 to DF_TYPE_DOUBLE (returns false beyond 2^53) are supported
+  bool convert(int32_t newtype, dataframe_arena_t& arena, int32_t new_bool_style = 0);
+  // change the encoding of a DF_TYPE_STRING column
+  void set_str_enc(int32_t enc, dataframe_arena_t& arena);
+  // turn a dictionary with more than DF_DICT_MIN_ARENA entries, covering more than half the rows, into arena offsets
+  void check_cardinality(dataframe_arena_t& arena);
+
+  // the narrowest type that holds all string values (DF_TYPE_STRING if there are none)
+  int32_t infer_type(int32_t& inferred_bool_style, const dataframe_arena_t& arena) const;
+  // widen the type so that a value fits, ending at DF_TYPE_STRING
+  void widen_for(const char* s, const char* end, dataframe_arena_t& arena);
+
+protected:
+  // find or add a dictionary entry; a new entry is copied into arena unless its offset is given
+  uint32_t add_code(const char* s, size_t len, dataframe_arena_t& arena, const uint64_t* off = NULL);
+  void put_code(size_t row, uint32_t code); // row may be size() to append
+  void widen_codes(int32_t width);
+  void rehash(size_t nslots, const dataframe_arena_t& arena);
+};
+
+#define DF_FILTER_TEXT_EQ   0 // the field is value
+#define DF_FILTER_TEXT_IN   1 // the field is one of values
+#define DF_FILTER_NUM_RANGE 2 // the field is a number in [lo, hi]
+#define DF_FILTER_INT_RANGE 3 // the field is an integer in [ilo, ihi]
+
+// a condition on a column, evaluated on the text of each field while a file
+// is loaded (see dataframe_load_opts_t::filters). Fields that are not numbers
+// never match the numeric conditions.
+struct dataframe_filter_t {
+  std::string colname;
+  int32_t op;                       // DF_FILTER_*
+  std::vector<std::string> values;  // value of DF_FILTER_TEXT_EQ, or sorted values of DF_FILTER_TEXT_IN
+  double lo, hi;                    // bounds of DF_FILTER_NUM_RANGE
+  int64_t ilo, ihi;                 // bounds of DF_FILTER_INT_RANGE
+
+  dataframe_filter_t() : op(DF_FILTER_TEXT_EQ), lo(0), hi(0), ilo(0), ihi(0) {}
+
+  static dataframe_filter_t text_eq(const char* colname, const char* value);
+  static dataframe_filter_t text_in(const char* colname, const std::vector<std::string>& values);
+  static dataframe_filter_t num_range(const char* colname, double lo, double hi);
+  static dataframe_filter_t num_eq(const char* colname, double value) { return num_range(colname, value, value); }
+  static dataframe_filter_t int_range(const char* colname, int64_t lo, int64_t hi);
+
+  bool match(const char* s, const char* end) const; // does the field [s, end) satisfy the condition?
+};
+
+struct dataframe_load_plan_t;
+
+// options of dataframe_t::load()
+struct dataframe_load_opts_t {
+  bool infer_types;    // store numeric and boolean columns in typed arrays
+  int32_t infer_rows;  // number of rows sampled to choose the types; later rows widen the type if needed
+  std::map<std::string,int32_t> coltypes; // types of some columns, given by name instead of inferred
+  int32_t nthreads;    // parse parts of the file in parallel with this many threads (see tsv_parallel_scan)
+  // columns to load, in this order (empty for all columns). The other columns are not tokenized
+  // past the last needed one, so only rows too short to hold the needed columns are rejected
+  std::vector<std::string> columns;
+  std::vector<dataframe_filter_t> filters; // load only the rows satisfying all conditions
+
+  dataframe_load_opts_t() : infer_types(true), infer_rows(DF_INFER_ROWS), nthreads(0) {}
+};
 
 class dataframe_t {
 public:
   std::vector<std::string> colnames;
   std::map<std::string,uint32_t> col2idx;
-  std::vector<std::vector<std::string> > columns;
+  std::vector<dataframe_column_t> columns;
+  dataframe_arena_t arena; // strings of all columns
   int32_t ncols;
   int32_t nrows;
 
+  // load a tsv file with a header line. By default, the type of each column is
+  // inferred from the first rows (see dataframe_load_opts_t). With
+  // opts.nthreads > 1, parts of a plain or bgzipped file are loaded in
+  // parallel, each inferring its own types, and the columns are widened to
+  // the widest type of all parts. opts.columns and opts.filters select the
+  // columns and rows while the file is read, so that the other cells are never stored
   bool load(const char* tsvfile);
+  bool load(const char* tsvfile, const dataframe_load_opts_t& opts);
 
-  inline const std::string& get_str_elem(int32_t row, int32_t col) {
-    return columns[col][row];
+  inline int32_t get_coltype(int32_t col) const {
+    return columns[col].type;
   }
-  
+
+  // the element as text, formatted for typed columns
+  inline std::string get_str_elem(int32_t row, int32_t col) {
+    std::string s;
+    columns[col].to_string(row, s, arena);
+    return s;
+  }
+
+  // a view of an element of a string column, '\0'-terminated; it stays valid
+  // until the dataframe is modified or destroyed
+  inline const char* get_str_view(int32_t row, int32_t col, int32_t* len) const {
+    return typed_column(col, DF_TYPE_STRING).str_view(row, arena, len);
+  }
+
+  // dictionary codes of string columns, to group or filter rows by integer comparisons
+  inline bool is_dict_column(int32_t col) const {
+    return ( columns[col].type == DF_TYPE_STRING ) && ( columns[col].str_enc == DF_STR_DICT );
+  }
+
+  inline uint32_t get_str_code(int32_t row, int32_t col) const {
+    return dict_column(col).code_at(row);
+  }
+
+  inline int32_t get_dict_size(int32_t col) const {
+    return (int32_t)dict_column(col).dict_offs.size();
+  }
+
+  inline const char* get_dict_str(int32_t col, uint32_t code, int32_t* len) const {
+    const dataframe_column_t& c = dict_column(col);
+    *len = (int32_t)c.dict_lens.at(code);
+    return arena.at(c.dict_offs[code]);
+  }
+
+  // the code of a value in a dictionary-encoded column, or -1 if no row has the value
+  inline int64_t find_str_code(int32_t col, const char* s) const {
+    return dict_column(col).find_code(s, strlen(s), arena);
+  }
+
+  // rows whose element equals value as text (or as a number, in numeric columns); returns the number of rows
+  int32_t find_rows(int32_t col, const char* value, std::vector<int32_t>& rows) const;
+
+  // hash join with right on the key columns (see dataframe_index_t::join); how is DF_JOIN_INNER or DF_JOIN_LEFT
+  void join(const dataframe_t& right, const std::vector<std::string>& left_keys, const std::vector<std::string>& right_keys,
+            int32_t how, dataframe_t& out, int32_t nthreads = 1) const;
+
   inline int32_t get_int_elem(int32_t row, int32_t col) {
-    return strtol(columns[col][row].c_str(), NULL, 10);
+    const dataframe_column_t& c = columns[col];
+    switch( c.type ) {
+    case DF_TYPE_INT64:  return (int32_t)clamp_int64(c.ints[row], INT32_MIN, INT32_MAX);
+    case DF_TYPE_DOUBLE: return (int32_t)clamp_double(c.dbls[row], INT32_MIN, INT32_MAX);
+    case DF_TYPE_BOOL:   return c.bools[row];
+    default:             { int32_t len; const char* p = c.str_view(row, arena, &len); return fast_atoi32(p, p + len); }
+    }
   }
-  
+
   inline int64_t get_int64_elem(int32_t row, int32_t col) {
-    return strtoll(columns[col][row].c_str(), NULL, 10);
+    const dataframe_column_t& c = columns[col];
+    switch( c.type ) {
+    case DF_TYPE_INT64:  return c.ints[row];
+    case DF_TYPE_DOUBLE: return (int64_t)clamp_double(c.dbls[row], (double)INT64_MIN, 9223372036854774784.0);
+    case DF_TYPE_BOOL:   return c.bools[row];
+    default:             { int32_t len; const char* p = c.str_view(row, arena, &len); return fast_atoi64(p, p + len); }
+    }
   }
-  
+
   inline uint64_t get_uint64_elem(int32_t row, int32_t col) {
-    return strtoull(columns[col][row].c_str(), NULL, 10);
+    const dataframe_column_t& c = columns[col];
+    switch( c.type ) {
+    case DF_TYPE_INT64:  return c.ints[row] < 0 ? 0 : (uint64_t)c.ints[row]; // like fast_atou64(), which reads no sign
+    case DF_TYPE_DOUBLE: return (uint64_t)clamp_double(c.dbls[row], 0, 18446744073709549568.0);
+    case DF_TYPE_BOOL:   return c.bools[row];
+    default:             { int32_t len; const char* p = c.str_view(row, arena, &len); return fast_atou64(p, p + len); }
+    }
   }
 
   inline double get_double_elem(int32_t row, int32_t col) {
-    return strtod(columns[col][row].c_str(), NULL);
+    const dataframe_column_t& c = columns[col];
+    switch( c.type ) {
+    case DF_TYPE_INT64:  return (double)c.ints[row];
+    case DF_TYPE_DOUBLE: return c.dbls[row];
+    case DF_TYPE_BOOL:   return c.bools[row];
+    default:             { int32_t len; const char* p = c.str_view(row, arena, &len); return fast_atof(p, p + len); }
+    }
+  }
+
+  // checked versions: return false if the element is not entirely a number representable in the type
+  inline bool get_int_elem(int32_t row, int32_t col, int32_t& value) {
+    int64_t v;
+    if ( !get_int64_elem(row, col, v) || ( v < INT32_MIN ) || ( v > INT32_MAX ) ) return false;
+    value = (int32_t)v;
+    return true;
+  }
+
+  inline bool get_int64_elem(int32_t row, int32_t col, int64_t& value) {
+    const dataframe_column_t& c = columns[col];
+    switch( c.type ) {
+    case DF_TYPE_INT64:  value = c.ints[row]; return true;
+    case DF_TYPE_DOUBLE: return false; // not written as an integer
+    case DF_TYPE_BOOL:   return false;
+    default:             { int32_t len; const char* p = c.str_view(row, arena, &len); return parse_int64(p, p + len, value); }
+    }
   }
 
-  inline std::vector<std::string>& get_column(int32_t col) {
-    return columns[col];
+  inline bool get_uint64_elem(int32_t row, int32_t col, uint64_t& value) {
+    const dataframe_column_t& c = columns[col];
+    switch( c.type ) {
+    case DF_TYPE_INT64:  value = (uint64_t)c.ints[row]; return c.ints[row] >= 0;
+    case DF_TYPE_DOUBLE: return false;
+    case DF_TYPE_BOOL:   return false;
+    default:             { int32_t len; const char* p = c.str_view(row, arena, &len); return parse_uint64(p, p + len, value); }
+    }
   }
-  
+
+  inline bool get_double_elem(int32_t row, int32_t col, double& value) {
+    const dataframe_column_t& c = columns[col];
+    switch( c.type ) {
+    case DF_TYPE_INT64:  value = (double)c.ints[row]; return true;
+    case DF_TYPE_DOUBLE: value = c.dbls[row]; return true;
+    case DF_TYPE_BOOL:   return false;
+    default:             { int32_t len; const char* p = c.str_view(row, arena, &len); return parse_double(p, p + len, value); }
+    }
+  }
+
+  // typed views of a column, which must be of that type
+  inline const std::vector<int64_t>& get_int64_column(int32_t col) const {
+    return typed_column(col, DF_TYPE_INT64).ints;
+  }
+
+  inline const std::vector<double>& get_double_column(int32_t col) const {
+    return typed_column(col, DF_TYPE_DOUBLE).dbls;
+  }
+
+  inline const std::vector<uint8_t>& get_bool_column(int32_t col) const {
+    return typed_column(col, DF_TYPE_BOOL).bools;
+  }
+
+  // copy a numeric or boolean column into a vector of doubles
+  void get_double_values(int32_t col, std::vector<double>& values) const;
+
+  // the column as std::string values; the column is converted to DF_TYPE_STRING
+  // and DF_STR_VECTOR first, which gives up the dictionary encoding
+  std::vector<std::string>& get_column(int32_t col);
+
   inline std::vector<std::string>& get_column(const char* colname) {
-    return columns[col2idx[colname]];
+    return get_column((int32_t)col2idx.at(colname));
   }
 
   inline bool has_column(const char* colname) {
@@ -53,33 +388,57 @@ public:
     else return -1;
   }
 
-  inline const std::string& get_str_elem(int32_t row, const char* colname) {
-    return get_column(colname).at(row);
-  }  
-  
+  inline std::string get_str_elem(int32_t row, const char* colname) {
+    return get_str_elem(checked_row(row), (int32_t)col2idx.at(colname));
+  }
+
   inline int32_t get_int_elem(int32_t row, const char* colname) {
-    return strtol(get_column(colname).at(row).c_str(), NULL, 10);
+    return get_int_elem(checked_row(row), (int32_t)col2idx.at(colname));
   }
 
   inline int64_t get_int64_elem(int32_t row, const char* colname) {
-    return strtoll(get_column(colname).at(row).c_str(), NULL, 10);
-  }  
+    return get_int64_elem(checked_row(row), (int32_t)col2idx.at(colname));
+  }
 
   inline uint64_t get_uint64_elem(int32_t row, const char* colname) {
-    return strtoull(get_column(colname).at(row).c_str(), NULL, 10);
+    return get_uint64_elem(checked_row(row), (int32_t)col2idx.at(colname));
   }
 
   inline double get_double_elem(int32_t row, const char* colname) {
-    return strtod(get_column(colname).at(row).c_str(), NULL);
+    return get_double_elem(checked_row(row), (int32_t)col2idx.at(colname));
   }
 
   int32_t add_empty_column(const char* colname);
   int32_t add_empty_row();
+  // set an element from text; a typed column is widened if the text does not fit its type
   void set_str_elem(const char *s, int32_t row, int32_t col);
   void set_str_elem(const char* s, int32_t row, const char* colname);
 
-  dataframe_t() : nrows(0), ncols(0) {} // default constructor does not do anything
-  dataframe_t(const char* tsvfile) { load(tsvfile); }
+  dataframe_t() : ncols(0), nrows(0) {} // default constructor does not do anything
+  dataframe_t(const char* tsvfile) : ncols(0), nrows(0) { load(tsvfile); }
+
+protected:
+  // read the rows of tr that pass the filters into the columns, inferring their types
+  void read_rows(tsv_reader& tr, const dataframe_load_opts_t& opts, const dataframe_load_plan_t& plan, const char* tsvfile);
+  // read the rows after the header with opts.nthreads threads
+  bool load_parallel(const char* tsvfile, const dataframe_load_opts_t& opts, const dataframe_load_plan_t& plan);
+
+  const dataframe_column_t& typed_column(int32_t col, int32_t type) const;
+  const dataframe_column_t& dict_column(int32_t col) const;
+
+  inline int32_t checked_row(int32_t row) const {
+    if ( ( row < 0 ) || ( row >= nrows ) )
+      error("[E:%s:%d %s] Row %d is out of range [0, %d)", __FILE__, __LINE__, __FUNCTION__, row, nrows);
+    return row;
+  }
+
+  static inline int64_t clamp_int64(int64_t v, int64_t vmin, int64_t vmax) {
+    return v < vmin ? vmin : ( v > vmax ? vmax : v );
+  }
+
+  static inline double clamp_double(double v, double vmin, double vmax) {
+    return v < vmin ? vmin : ( v > vmax ? vmax : ( v == v ? v : 0 ) );
+  }
 };
 
 #endif
@@ -0,0 +1,62 @@
+#ifndef __DATAFRAME_INDEX_H
+#define __DATAFRAME_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dataframe.h"
+
+#define DF_JOIN_INNER 0 // rows of the left table with a match, once per matching row of the right table
+#define DF_JOIN_LEFT  1 // also rows of the left table without a match, with empty right columns
+
+#define DF_INDEX_PARTS 64 // number of hash table partitions (a power of 2), built independently
+#define DF_INDEX_MIN_BLOCK 65536 // rows hashed or probed by a thread at least
+
+struct df_key_ref;
+
+// an open-addressing hash index on one or more key columns of a dataframe_t.
+//
+// Keys are compared by value: strings by their bytes, and numbers
+// numerically, so that an int64 key matches an equal double key. Rows with
+// the same key are chained in row order. The hash table is split into
+// partitions by the upper bits of the hashes, so that the rows are hashed,
+// and the partitions built, by several threads.
+//
+// The index keeps a pointer to the dataframe, which must not be modified or
+// destroyed while the index is used.
+class dataframe_index_t {
+public:
+  const dataframe_t* df;     // indexed dataframe
+  std::vector<int32_t> cols; // key columns
+  int32_t nkeys;             // number of distinct keys
+
+  dataframe_index_t() : df(NULL), nkeys(0) {}
+
+  void build(const dataframe_t& _df, const std::vector<int32_t>& _cols, int32_t nthreads = 1);
+  void build(const dataframe_t& _df, const std::vector<std::string>& colnames, int32_t nthreads = 1);
+
+  // first row with a key given as text (one value per key column), or -1 if none
+  int32_t find(const std::vector<std::string>& key) const;
+  int32_t find(const char* key) const; // single key column
+  // first row with the key of row `row` of another dataframe (key columns other_cols), or -1 if none
+  int32_t find_row(const dataframe_t& other, const std::vector<int32_t>& other_cols, int32_t row) const;
+  // next row with the same key, or -1
+  inline int32_t next(int32_t row) const { return next_row[row]; }
+
+  // join the rows of left (key columns left_cols) with the indexed rows, in the
+  // order of the left rows. out holds the columns of left, then the non-key
+  // columns of the indexed dataframe, whose names get suffix if already used.
+  // In a left join, the right columns of unmatched rows are empty strings, and
+  // typed right columns are turned into string columns if there are any.
+  void join(const dataframe_t& left, const std::vector<int32_t>& left_cols, int32_t how, dataframe_t& out, int32_t nthreads = 1, const char* suffix = "_right") const;
+
+protected:
+  std::vector<uint64_t> hashes;               // hash of each row
+  std::vector<int32_t> next_row;              // next row with the same key, -1 at the end of a chain
+  std::vector<std::vector<int32_t> > slots;   // per partition, first row of each key, -1 if empty
+
+  int32_t probe(uint64_t h, const df_key_ref* keys) const; // first row with the keys of hash h, or -1
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __MMAP_READER_H
+#define __MMAP_READER_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// a class to read lines from an uncompressed local file through a read-only
+// view of the memory-mapped file, without copying any byte.
+//
+// The whole file is mapped at once with MADV_SEQUENTIAL, and the part that
+// the scan has moved past is unmapped one window at a time, so that the
+// resident set stays bounded while a line can be of any length.
+class mmap_reader {
+public:
+  std::string filename; // file name to read
+  int fd;               // file descriptor, -1 if not open
+  char* base;           // start of the mapping (covers the whole file)
+  uint64_t size;        // size of the file (and of the mapping)
+  uint64_t pos;         // offset of the next line
+  uint64_t line_beg;    // offset of the line returned by the last next_line() call
+  uint64_t released;    // bytes at the beginning of the mapping already unmapped
+  uint64_t window;      // granularity of unmapping and read-ahead, multiple of the page size
+  uint64_t pinned;      // bytes from this offset on stay mapped (UINT64_MAX if none are pinned)
+
+  mmap_reader() : fd(-1), base(NULL), size(0), pos(0), line_beg(0), released(0), window(0), pinned(UINT64_MAX) {}
+
+  bool open(const char* _filename, uint64_t _window = (64ULL << 20)); // returns false if the file cannot be mapped
+  bool close();
+  inline bool is_open() const { return fd >= 0; }
+
+  // returns a pointer to the next line, and sets len to its length including
+  // the trailing '\n' if any. Returns NULL at the end of the file.
+  // The line is NOT '\0'-terminated. The windows of the previous lines may be
+  // unmapped, except from the pinned offset on.
+  inline const char* next_line(int64_t& len) {
+    if ( pos >= size ) {
+      len = 0;
+      return NULL;
+    }
+    const char* p = base + pos;
+    const char* nl = (const char*)memchr(p, '\n', size - pos);
+    len = ( nl == NULL ) ? (int64_t)(size - pos) : (int64_t)(nl - p + 1);
+    line_beg = pos;
+    pos += len;
+    uint64_t upto = ( pinned < line_beg ) ? pinned : line_beg;
+    if ( upto >= released + 2 * window )
+      release(upto);
+    return p;
+  }
+
+  // keep the bytes from offset on mapped while the next lines are read, e.g.
+  // for a record spanning several lines, until unpin()
+  inline void pin(uint64_t offset) { pinned = offset; }
+  inline void unpin() { pinned = UINT64_MAX; }
+
+  bool seek(uint64_t offset); // move to an offset, mapping the file again if needed
+
+protected:
+  bool map();
+  void release(uint64_t upto);
+};
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef __NUM_PARSER_H
+#define __NUM_PARSER_H
+
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <cmath>
+
+// Locale-independent parsers for numbers in the range [s, end) of a text buffer,
+// which does not need to be '\0'-terminated.
+//
+// The fast_* functions behave like atoi()/strtoll()/strtoull()/atof(): they
+// parse the longest numeric prefix after leading blanks, return 0 if there is
+// none, and clamp integers on overflow.
+// The parse_* functions are the checked variants: they return false unless the
+// whole range is a number representable in the requested type. A decimal that
+// overflows a double is rejected, while "inf" and "nan" are accepted.
+
+#if defined(__BYTE_ORDER__) && ( __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ )
+#define NUM_PARSER_SWAR
+#endif
+
+namespace num_parser_detail {
+  // true if all 8 bytes of a little-endian word are ASCII digits
+  inline bool is_8digits(uint64_t w) {
+    return ( ( ( w & 0xF0F0F0F0F0F0F0F0ULL ) |
+               ( ( ( w + 0x0606060606060606ULL ) & 0xF0F0F0F0F0F0F0F0ULL ) >> 4 ) ) == 0x3333333333333333ULL );
+  }
+
+  // convert 8 ASCII digits in a little-endian word into an integer with 3 multiplications
+  inline uint32_t parse_8digits(uint64_t w) {
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 0x000F424000000064ULL; // 100 + (1000000ULL << 32)
+    const uint64_t mul2 = 0x0000271000000001ULL; // 1 + (10000ULL << 32)
+    w -= 0x3030303030303030ULL;
+    w = ( w * 10 ) + ( w >> 8 );
+    w = ( ( ( w & mask ) * mul1 ) + ( ( ( w >> 16 ) & mask ) * mul2 ) ) >> 32;
+    return (uint32_t)w;
+  }
+
+  // parse an unsigned decimal at p, advancing p past the digits.
+  // Returns the number of digits consumed; overflow is set if the value exceeds UINT64_MAX
+  inline int32_t parse_digits(const char*& p, const char* end, uint64_t& v, bool& overflow) {
+    const char* start = p;
+    while( ( p < end ) && ( *p == '0' ) ) ++p; // leading zeros do not count toward overflow
+    const char* sig = p;
+    v = 0;
+#ifdef NUM_PARSER_SWAR
+    while( end - p >= 8 ) {
+      uint64_t w;
+      memcpy(&w, p, 8);
+      if ( !is_8digits(w) ) break;
+      v = v * 100000000ULL + parse_8digits(w);
+      p += 8;
+    }
+#endif
+    while( ( p < end ) && ( (unsigned char)( *p - '0' ) < 10 ) ) {
+      v = v * 10 + (uint64_t)( *p - '0' );
+      ++p;
+    }
+    int32_t nsig = (int32_t)( p - sig );
+    // a 20-digit value fits only if it starts with '1', and then wraps below 10^19 on overflow
+    overflow = ( nsig > 20 ) || ( ( nsig == 20 ) && ( ( *sig > '1' ) || ( v < 10000000000000000000ULL ) ) );
+    return (int32_t)( p - start );
+  }
+
+  inline const char* skip_blanks(const char* p, const char* end) {
+    while( ( p < end ) && ( ( *p == ' ' ) || ( (unsigned char)( *p - 9 ) <= 4 ) ) ) ++p;
+    return p;
+  }
+
+  // parse an optionally signed integer within [vmin, vmax]; returns the end of the
+  // parsed prefix, or s if no digits were found. range_ok is false if clamped
+  inline const char* parse_signed(const char* s, const char* end, int64_t vmin, int64_t vmax, int64_t& v, bool& range_ok) {
+    const char* p = s;
+    bool neg = false;
+    if ( ( p < end ) && ( ( *p == '-' ) || ( *p == '+' ) ) ) {
+      neg = ( *p == '-' );
+      ++p;
+    }
+    uint64_t u;
+    bool overflow;
+    if ( parse_digits(p, end, u, overflow) == 0 ) {
+      v = 0;
+      range_ok = false;
+      return s;
+    }
+    range_ok = true;
+    if ( neg ) {
+      if ( overflow || ( u > (uint64_t)(-(vmin + 1)) + 1 ) ) { v = vmin; range_ok = false; }
+      else v = ( u == 0 ) ? 0 : -(int64_t)( u - 1 ) - 1;
+    }
+    else {
+      if ( overflow || ( u > (uint64_t)vmax ) ) { v = vmax; range_ok = false; }
+      else v = (int64_t)u;
+    }
+    return p;
+  }
+
+  // parse a double, returning the end of the parsed prefix (s if none).
+  // Decimal inputs with up to 19 significant digits and a small exponent are
+  // converted exactly with Clinger's fast path; others are handed to strtod().
+  const char* parse_double(const char* s, const char* end, double& v);
+}
+
+inline int64_t fast_atoi64(const char* s, const char* end) {
+  int64_t v;
+  bool ok;
+  num_parser_detail::parse_signed(num_parser_detail::skip_blanks(s, end), end, INT64_MIN, INT64_MAX, v, ok);
+  return v;
+}
+
+inline int32_t fast_atoi32(const char* s, const char* end) {
+  int64_t v;
+  bool ok;
+  num_parser_detail::parse_signed(num_parser_detail::skip_blanks(s, end), end, INT32_MIN, INT32_MAX, v, ok);
+  return (int32_t)v;
+}
+
+inline uint64_t fast_atou64(const char* s, const char* end) {
+  const char* p = num_parser_detail::skip_blanks(s, end);
+  if ( ( p < end ) && ( *p == '+' ) ) ++p;
+  uint64_t v;
+  bool overflow;
+  num_parser_detail::parse_digits(p, end, v, overflow);
+  return overflow ? UINT64_MAX : v;
+}
+
+inline double fast_atof(const char* s, const char* end) {
+  double v;
+  num_parser_detail::parse_double(num_parser_detail::skip_blanks(s, end), end, v);
+  return v;
+}
+
+inline bool parse_int64(const char* s, const char* end, int64_t& v) {
+  bool ok;
+  return ( num_parser_detail::parse_signed(s, end, INT64_MIN, INT64_MAX, v, ok) == end ) && ok;
+}
+
+inline bool parse_int32(const char* s, const char* end, int32_t& v) {
+  int64_t v64;
+  bool ok;
+  const char* p = num_parser_detail::parse_signed(s, end, INT32_MIN, INT32_MAX, v64, ok);
+  v = (int32_t)v64;
+  return ( p == end ) && ok;
+}
+
+inline bool parse_uint64(const char* s, const char* end, uint64_t& v) {
+  const char* p = s;
+  if ( ( p < end ) && ( *p == '+' ) ) ++p;
+  bool overflow;
+  return ( num_parser_detail::parse_digits(p, end, v, overflow) > 0 ) && ( p == end ) && !overflow;
+}
+
+inline bool parse_double(const char* s, const char* end, double& v) {
+  if ( ( s >= end ) || ( num_parser_detail::parse_double(s, end, v) != end ) )
+    return false;
+  if ( std::isfinite(v) )
+    return true;
+  const char* p = ( ( *s == '-' ) || ( *s == '+' ) ) ? s + 1 : s; // inf or nan spelled out, not an overflow
+  return ( p < end ) && ( ( ( *p | 0x20 ) == 'i' ) || ( ( *p | 0x20 ) == 'n' ) );
+}
+
+// versions for '\0'-terminated strings
+inline int32_t  fast_atoi32(const char* s) { return fast_atoi32(s, s + strlen(s)); }
+inline int64_t  fast_atoi64(const char* s) { return fast_atoi64(s, s + strlen(s)); }
+inline uint64_t fast_atou64(const char* s) { return fast_atou64(s, s + strlen(s)); }
+inline double   fast_atof(const char* s)   { return fast_atof(s, s + strlen(s)); }
+inline bool parse_int32(const char* s, int32_t& v)   { return parse_int32(s, s + strlen(s), v); }
+inline bool parse_int64(const char* s, int64_t& v)   { return parse_int64(s, s + strlen(s), v); }
+inline bool parse_uint64(const char* s, uint64_t& v) { return parse_uint64(s, s + strlen(s), v); }
+inline bool parse_double(const char* s, double& v)   { return parse_double(s, s + strlen(s), v); }
+
+#endif
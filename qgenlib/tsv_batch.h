@@ -0,0 +1,100 @@
+#ifndef __TSV_BATCH_H
+#define __TSV_BATCH_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "qgen_error.h"
+#include "num_parser.h"
+
+// a batch of lines read by tsv_reader::read_batch(), stored column-addressable:
+// the lines are copied back to back into a single buffer, and the fields are
+// located by flat nlines x ncols matrices of offsets into that buffer.
+//
+// A batch owns all its memory, so it can be moved to another thread, and it
+// can be reused across read_batch() calls without reallocating.
+class tsv_batch {
+public:
+  std::vector<char> buf;             // lines back to back, each field terminated by '\0'
+  std::vector<int32_t> line_offsets; // starting offset of each line in buf
+  std::vector<int32_t> nfields;      // number of fields tokenized in each line
+  std::vector<int32_t> offsets;      // row-major nlines x ncols starting offsets of the fields in buf, -1 if absent
+  std::vector<int32_t> ends;         // row-major nlines x ncols offsets one past the end of the fields, -1 if absent
+  int32_t nlines;                    // number of lines in the batch
+  int32_t ncols;                     // number of columns of the matrices
+
+  tsv_batch() : nlines(0), ncols(0) {}
+
+  // remove all lines, keeping the allocated memory
+  inline void clear() {
+    buf.clear();
+    line_offsets.clear();
+    nfields.clear();
+    offsets.clear();
+    ends.clear();
+    nlines = ncols = 0;
+  }
+
+  // copy a line of len bytes at the end of buf, and return the copy ('\0'-terminated)
+  char* append_line(const char* s, int32_t len);
+
+  // add the fields of the last appended line, given by offsets relative to the
+  // line. If cols is not NULL, only these columns are kept, in that order;
+  // otherwise the matrices are widened as needed to hold all nf fields
+  void add_row(int32_t nf, const int32_t* field_offsets, const int32_t* field_ends, const std::vector<int32_t>* cols = NULL);
+
+  inline const int32_t* row_offsets(int32_t row) const { return &offsets[(size_t)row * ncols]; }
+  inline const int32_t* row_ends(int32_t row) const { return &ends[(size_t)row * ncols]; }
+
+  inline bool has_field(int32_t row, int32_t col) const {
+    return ( col >= 0 ) && ( col < ncols ) && ( offsets[(size_t)row * ncols + col] >= 0 );
+  }
+
+  // returns the start of a field and sets end to one past its last character
+  inline const char* field_range(int32_t row, int32_t col, const char*& end) const {
+    if ( ( row < 0 ) || ( row >= nlines ) || !has_field(row, col) )
+      error("[E:%s:%d %s] Cannot access field %d of line %d in a batch of %d lines", __FILE__, __LINE__, __FUNCTION__, col, row, nlines);
+    size_t k = (size_t)row * ncols + col;
+    end = buf.data() + ends[k];
+    return buf.data() + offsets[k];
+  }
+
+  inline const char* str_field_at(int32_t row, int32_t col) const {
+    const char* end;
+    return field_range(row, col, end);
+  }
+
+  inline const char* str_field_view(int32_t row, int32_t col, int32_t* len) const {
+    const char* end;
+    const char* p = field_range(row, col, end);
+    *len = (int32_t)( end - p );
+    return p;
+  }
+
+  inline int32_t int_field_at(int32_t row, int32_t col) const {
+    const char* end;
+    const char* p = field_range(row, col, end);
+    return fast_atoi32(p, end);
+  }
+
+  inline int64_t int64_field_at(int32_t row, int32_t col) const {
+    const char* end;
+    const char* p = field_range(row, col, end);
+    return fast_atoi64(p, end);
+  }
+
+  inline uint64_t uint64_field_at(int32_t row, int32_t col) const {
+    const char* end;
+    const char* p = field_range(row, col, end);
+    return fast_atou64(p, end);
+  }
+
+  inline double double_field_at(int32_t row, int32_t col) const {
+    const char* end;
+    const char* p = field_range(row, col, end);
+    return fast_atof(p, end);
+  }
+};
+
+#endif
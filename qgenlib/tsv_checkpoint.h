@@ -0,0 +1,51 @@
+#ifndef __TSV_CHECKPOINT_H
+#define __TSV_CHECKPOINT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+
+// a resumable position of tsv_reader, text_line_reader or dsv_hdr_reader.
+//
+// A checkpoint is taken between two lines with get_checkpoint(), or every N
+// lines by a hook (see tsv_reader::set_checkpoint_hook()), and saved into a
+// small file. After a restart, the file is opened again and resume() moves
+// the reader to the line following the checkpoint, with its line count and
+// state (the range of set_range(), or the header of dsv_hdr_reader). The
+// position is a byte offset for plain files and a BGZF virtual offset for
+// bgzipped files; non-BGZF gzip files cannot be resumed. The size of the
+// file is recorded, so that a checkpoint of a modified file is rejected.
+struct tsv_checkpoint;
+
+// called with a checkpoint taken every N lines, e.g. to store the caller state and save it
+typedef std::function<void(tsv_checkpoint&)> tsv_checkpoint_hook_t;
+
+struct tsv_checkpoint {
+  std::string filename;   // file being read
+  uint64_t file_size;     // size of the file, to detect a modified file
+  bool bgzf;              // true if offset is a BGZF virtual offset
+  int64_t offset;         // position to seek to
+  uint64_t skip;          // uncompressed bytes to skip after seeking (text_line_reader on bgzipped files)
+  uint64_t uoffset;       // uncompressed byte offset of the position, 0 if unknown
+  uint64_t nlines;        // number of lines read before the position
+  int64_t range_end;      // end of the range set by tsv_reader::set_range(), -1 if none
+  std::vector<std::string> headers; // header lines read by dsv_hdr_reader::read_hdr()
+  std::vector<std::string> columns; // column names of dsv_hdr_reader, in order
+  std::string state;      // caller state (e.g. partial results), saved and restored as is
+
+  tsv_checkpoint() : file_size(0), bgzf(false), offset(0), skip(0), uoffset(0), nlines(0), range_end(-1) {}
+
+  // write the checkpoint into a temporary file renamed to fn, so that an
+  // interruption never leaves a partial checkpoint behind
+  bool save(const char* fn) const;
+  bool load(const char* fn); // returns false if the file is missing or invalid
+  bool set_file(const char* _filename); // set filename and file_size; returns false if the file cannot be found
+  // returns true if the checkpoint was taken on this file, as it is now
+  bool matches(const char* _filename) const;
+
+  // a hook that calls fill_state (if any) to set the caller state, then saves the checkpoint into fn
+  static tsv_checkpoint_hook_t save_hook(const char* fn, const tsv_checkpoint_hook_t& fill_state = tsv_checkpoint_hook_t());
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef __TSV_INTERVAL_SWEEP_H
+#define __TSV_INTERVAL_SWEEP_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "tsv_reader.h"
+#include "tsv_writer.h"
+
+#define TSV_SWEEP_UNSEEN_CONTIG INT32_MAX // order of a B contig not seen in A yet, when the order is not known
+
+// an interval of the second stream kept in the active window, with a copy of its line
+struct sweep_interval {
+  int32_t tid;       // contig order
+  int64_t beg;       // 0-based start (inclusive)
+  int64_t end;       // 0-based end (exclusive)
+  std::string line;  // fields joined by tabs
+  std::vector<int32_t> offsets; // start of each field in line, followed by line.size()+1
+
+  inline int32_t nfields() const { return (int32_t)offsets.size() - 1; }
+  inline const char* field_view(int32_t idx, int32_t* len) const {
+    if ( ( idx < 0 ) || ( idx >= nfields() ) )
+      error("[E:%s:%d %s] Cannot access field at %d >= %d", __FILE__, __LINE__, __FUNCTION__, idx, nfields());
+    *len = offsets[idx+1] - offsets[idx] - 1;
+    return line.data() + offsets[idx];
+  }
+};
+
+// a class to intersect two position-sorted interval files in a single pass.
+//
+// Records of the first file (A) are read one by one with next(). The second
+// file (B) is read ahead just enough to cover the current A record: every B
+// interval starting before its end is kept in an active window, and the
+// intervals that end before the start of the current A record are dropped,
+// as no later A record can overlap them. Memory is therefore bounded by the
+// number of B intervals overlapping a position, not by the size of B.
+//
+// For each A record, overlaps() lists the overlapping B intervals in file
+// order, subtract() the parts of A covered by no B interval, and closest()
+// the nearest B interval on the same contig. The write_*() functions print
+// the usual intersect/subtract/closest outputs through a tsv_writer.
+//
+// Both files must be sorted by contig, then start. Contigs are ordered as
+// given by set_contig_order(), or else as listed by the tabix index of A (or
+// of B), or else in the order A lists them. In the last case, a B record on a
+// contig that A has not reached yet waits for A, so B may cover only some of
+// the contigs of A, but contigs of B absent from A must come after the others. Intervals are converted to 0-based half-open coordinates
+// internally: [beg, end) if zero_based (BED), and [beg-1, end) otherwise.
+// Without an end column, a record covers the single base at its position.
+class tsv_interval_sweep {
+public:
+  tsv_reader a;            // reader of the first file, holding the current A record
+  tsv_reader b;            // reader of the second file
+  int32_t a_chrom_col, a_beg_col, a_end_col; // 0-based columns of A (end -1 if none)
+  int32_t b_chrom_col, b_beg_col, b_end_col; // 0-based columns of B (end -1 if none)
+  bool zero_based;         // true if positions are 0-based with exclusive ends (BED)
+  char comment_char;       // lines starting with this character are skipped (0 to keep all lines)
+  std::map<std::string,int32_t> contig2id; // contig order
+  bool order_known;        // true if the contig order was set or read from a tabix index
+  uint64_t nlines_a;       // number of A records read
+  uint64_t nlines_b;       // number of B records read
+
+  // the current A record, in 0-based half-open coordinates
+  int32_t a_tid;
+  int64_t a_beg;
+  int64_t a_end;
+
+  tsv_interval_sweep(const char* a_filename, const char* b_filename, int32_t threads = 0);
+  ~tsv_interval_sweep();
+
+  // order the contigs as listed; contigs absent from the list are placed after them
+  void set_contig_order(const std::vector<std::string>& contigs);
+
+  bool next(); // read the next A record and update the window; returns false at the end of A
+
+  // the B intervals overlapping the current A record, in file order
+  inline const std::vector<const sweep_interval*>& overlaps() const { return hits; }
+  // the parts of the current A record not covered by any B interval, as 0-based half-open ranges
+  void subtract(std::vector<std::pair<int64_t,int64_t> >& parts) const;
+  // the B interval closest to the current A record on its contig (NULL if none), setting dist to
+  // the number of bases between them (0 if they overlap, negative if B is upstream). Overlapping
+  // intervals come first, then the nearest one; ties go to the upstream interval
+  const sweep_interval* closest(int64_t* dist = NULL);
+
+  // print the line of A, followed by the line of each overlapping B interval; returns the number of lines written
+  uint64_t write_intersect(tsv_writer& out);
+  // print the lines of A with the number of overlapping B intervals appended
+  uint64_t write_count(tsv_writer& out);
+  // print the parts of A not covered by B (or the whole A records overlapping nothing if whole is set)
+  uint64_t write_subtract(tsv_writer& out, bool whole = false);
+  // print the line of A, the line of its closest B interval ("." fields if none) and their distance
+  uint64_t write_closest(tsv_writer& out);
+
+protected:
+  std::vector<sweep_interval*> window;  // B intervals that may overlap the current or later A records, in file order
+  std::vector<sweep_interval*> pool;    // unused intervals, to recycle their buffers
+  std::vector<const sweep_interval*> hits; // B intervals overlapping the current A record
+  sweep_interval* upstream;  // dropped B interval with the largest end on the current contig, if any
+  bool b_pending;            // true if b holds a B record not yet in the window
+  int32_t b_tid;             // key of the pending B record
+  int64_t b_beg, b_end;
+  int32_t b_nfields_max;     // largest number of fields of a B record, for the "." fields of write_closest()
+  std::string last_a_contig, last_b_contig; // contig names of the last records, to skip lookups
+  int32_t last_a_tid, last_b_tid;
+  bool primed;               // true once the first B record has been read
+
+  // the order of a contig, numbering a new one if add is set; TSV_SWEEP_UNSEEN_CONTIG if it is new and not added
+  int32_t contig_to_id(const char* s, int32_t len, bool add);
+  bool load_index_order(); // take the contig order from the tabix index of A or B, if any
+  // read the next record of a file, skipping comments; returns false at the end.
+  // new_contig is set if the contig differs from the previous record's
+  bool read_record(tsv_reader& tr, int32_t chrom_col, int32_t beg_col, int32_t end_col, bool add_contig,
+                   std::string& last_contig, int32_t& last_tid, int32_t& tid, int64_t& beg, int64_t& end, bool& new_contig);
+  void advance_b();               // read the next B record into the pending slot
+  sweep_interval* take_pending(); // copy the pending B record into a new interval
+  void release(sweep_interval* iv);
+  void put_a_fields(tsv_writer& out, int64_t beg, int64_t end); // print the fields of A, replacing its coordinates
+};
+
+#endif
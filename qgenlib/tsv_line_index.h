@@ -0,0 +1,68 @@
+#ifndef __TSV_LINE_INDEX_H
+#define __TSV_LINE_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define TSV_LINE_INDEX_INTERVAL 65536 // default number of lines between checkpoints
+#define TSV_LINE_INDEX_SUFFIX ".lidx"
+
+// a range of lines [beg, end), counted from 0 at the beginning of the file
+struct tsv_line_range {
+  uint64_t beg;
+  uint64_t end;
+
+  tsv_line_range() : beg(0), end(0) {}
+  tsv_line_range(uint64_t _beg, uint64_t _end) : beg(_beg), end(_end) {}
+};
+
+// a sidecar index of line numbers for plain or bgzipped text files.
+//
+// The offset of every interval-th line is recorded, as a byte offset for plain
+// files and as a BGZF virtual offset for bgzipped files (the offsets of
+// tsv_reader::tell()), together with its uncompressed byte offset. Readers can
+// then seek to any line by seeking to the preceding checkpoint and skipping
+// fewer than interval lines, and the number of lines is known without reading
+// the file. Unlike tabix, the file does not need to be sorted by position.
+//
+// Every line counts, including header and empty lines, and a last line
+// without a newline. Non-BGZF gzip files cannot be indexed.
+class tsv_line_index {
+public:
+  std::string filename;           // indexed file
+  int32_t interval;               // number of lines between checkpoints
+  bool bgzf;                      // true if offsets are BGZF virtual offsets
+  uint64_t nlines;                // total number of lines
+  uint64_t file_size;             // size of the indexed file, to detect stale indices
+  std::vector<int64_t> offsets;   // offsets[k] is the offset of line k * interval
+  std::vector<int64_t> uoffsets;  // uoffsets[k] is the uncompressed byte offset of line k * interval
+
+  tsv_line_index() : interval(TSV_LINE_INDEX_INTERVAL), bgzf(false), nlines(0), file_size(0) {}
+
+  // scan a file and record a checkpoint every _interval lines. BGZF blocks
+  // are decompressed by a pool of threads if threads > 0
+  bool build(const char* _filename, int32_t _interval = TSV_LINE_INDEX_INTERVAL, int32_t threads = 0);
+  // write the index to index_fn, or to the file name followed by TSV_LINE_INDEX_SUFFIX
+  bool save(const char* index_fn = NULL) const;
+  // read the index of a file; returns false if it is missing or does not match the size of the file
+  bool load(const char* _filename, const char* index_fn = NULL);
+  // load the index of a file, or build and save it if it cannot be loaded
+  bool load_or_build(const char* _filename, int32_t _interval = TSV_LINE_INDEX_INTERVAL, int32_t threads = 0);
+
+  inline uint64_t count_lines() const { return nlines; }
+
+  // returns the checkpoint to start from to reach a line (0 <= line <= nlines),
+  // and sets skip to the number of lines to skip from there
+  inline int64_t locate(uint64_t line, uint64_t& skip) const {
+    uint64_t k = line / (uint64_t)interval;
+    if ( k >= offsets.size() ) k = offsets.size() - 1;
+    skip = line - k * (uint64_t)interval;
+    return (int64_t)k;
+  }
+
+  // split the lines into at most nparts ranges of equal size, in file order
+  void partition(int32_t nparts, std::vector<tsv_line_range>& parts) const;
+};
+
+#endif
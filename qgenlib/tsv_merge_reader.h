@@ -0,0 +1,91 @@
+#ifndef __TSV_MERGE_READER_H
+#define __TSV_MERGE_READER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "tsv_reader.h"
+
+// a class to read many position-sorted TSV files as a single sorted stream.
+//
+// Each file is read by its own tsv_reader, and the current lines of all
+// files are merged with a heap on (contig, position) keys. The key of a line
+// is parsed once, when the line is read. Lines with equal keys are returned
+// in the order of the files, and source() tells which file the current line
+// came from; the field accessors refer to that line.
+//
+// Contigs are ordered as given by set_contig_order(), and otherwise in the
+// order they are first seen, which is consistent as long as all files list
+// their contigs in the same order. Lines starting with comment_char (e.g.
+// headers) are skipped. Bgzipped files can share a pool of decompression
+// threads, and jump_to() restricts all files to a region through tabix.
+class tsv_merge_reader {
+public:
+  std::vector<std::string> filenames; // files to merge
+  std::vector<tsv_reader*> readers;   // one reader per file, owned by this object
+  int32_t chrom_col;     // 0-based column of the contig name
+  int32_t pos_col;       // 0-based column of the position
+  int32_t delimiter;     // delimiter passed to each tsv_reader
+  char comment_char;     // lines starting with this character are skipped (0 to keep all lines)
+  uint64_t nlines;       // number of lines returned so far
+  std::map<std::string,int32_t> contig2id; // contig order
+
+  tsv_merge_reader(const std::vector<std::string>& _filenames, int32_t _chrom_col = 0, int32_t _pos_col = 1, int32_t threads = 0);
+  ~tsv_merge_reader();
+
+  // order the contigs as listed; contigs absent from the list are placed after them
+  void set_contig_order(const std::vector<std::string>& contigs);
+
+  // read the next line in (contig, position) order, returns its number of fields (0 at the end)
+  int32_t read_line();
+
+  // restrict all files to a region (with tabix indices), returns false if no file has an index entry for it
+  bool jump_to(const char* reg);
+  bool jump_to(const char* chr, int32_t beg, int32_t end = INT_MAX);
+
+  inline int32_t source() const { return isource; }    // index of the file of the current line
+  inline tsv_reader* current() { return readers[isource]; } // reader holding the current line
+  inline int32_t contig_id() const { return cur_tid; } // contig order of the current line
+  inline int64_t position() const { return cur_pos; }  // position of the current line
+  inline int32_t nfields() const { return readers[isource]->nfields; }
+
+  inline const char* str_field_at(int32_t idx) { return current()->str_field_at(idx); }
+  inline const char* str_field_view(int32_t idx, int32_t* len) { return current()->str_field_view(idx, len); }
+  inline int32_t int_field_at(int32_t idx) { return current()->int_field_at(idx); }
+  inline int64_t int64_field_at(int32_t idx) { return current()->int64_field_at(idx); }
+  inline uint64_t uint64_field_at(int32_t idx) { return current()->uint64_field_at(idx); }
+  inline double double_field_at(int32_t idx) { return current()->double_field_at(idx); }
+
+  void close(); // close all files
+
+protected:
+  // the key of the current line of a source
+  struct merge_key {
+    int32_t tid;
+    int64_t pos;
+    int32_t src;
+    // heap order: the smallest key on top, ties broken by the source index
+    inline bool operator<(const merge_key& o) const {
+      if ( tid != o.tid ) return tid > o.tid;
+      if ( pos != o.pos ) return pos > o.pos;
+      return src > o.src;
+    }
+  };
+
+  std::vector<merge_key> heap;
+  std::vector<merge_key> last_keys;        // key of the last line of each source, to check the order
+  std::vector<std::string> last_contigs;   // contig name of the last line of each source
+  int32_t isource;  // source of the current line, -1 if none
+  int32_t cur_tid;
+  int64_t cur_pos;
+  bool primed;      // true once the first line of every source is in the heap
+  hts_tpool* tpool; // decompression threads shared by the readers
+
+  bool advance(int32_t src); // read the next line of a source and push its key; returns false at the end
+  void prime();              // read the first line of every source
+  int32_t contig_to_id(const char* s, int32_t len);
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef __TSV_PARALLEL_SCAN_H
+#define __TSV_PARALLEL_SCAN_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+extern "C" {
+#include "htslib/hfile.h"
+}
+#include "tsv_reader.h"
+
+// a contiguous part of a file processed by a single worker. A chunk owns the
+// lines starting in (beg, end], and the first chunk owns [0, end].
+struct tsv_scan_chunk {
+  int32_t index;    // index of the chunk in file order
+  int64_t beg;      // starting offset (BGZF virtual offset for bgzipped files)
+  int64_t end;      // last offset at which a line of this chunk may start (-1 for end of file)
+  uint64_t nlines;  // number of lines read from this chunk
+  std::string out;  // output produced by the worker, handed to the merge callback
+  void* data;       // arbitrary per-chunk data attached by the callbacks
+
+  tsv_scan_chunk() : index(0), beg(0), end(-1), nlines(0), data(NULL) {}
+};
+
+// hands out tasks [0, ntasks) to worker threads, and passes the completed
+// tasks to a merge function on the calling thread, either in task order
+// (ordered = true) or in the order they complete. Used by tsv_parallel_scan
+// and tsv_region_scan.
+class tsv_task_merger {
+public:
+  tsv_task_merger(int32_t _ntasks, bool _ordered) : ntasks(_ntasks), ordered(_ordered), next_task(0) {}
+
+  // the next task to run, or -1 if none is left (called by the workers)
+  inline int32_t next() {
+    int32_t i = next_task++;
+    return i < ntasks ? i : -1;
+  }
+
+  void complete(int32_t i); // report a finished task (called by the workers)
+  void merge(const std::function<void(int32_t)>& merge_fn); // returns when all tasks are merged
+
+protected:
+  int32_t ntasks;
+  bool ordered;
+  std::atomic<int32_t> next_task;
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::deque<int32_t> completed;
+};
+
+// a class to scan a single plain or bgzipped TSV file with multiple threads.
+//
+// The file is split into byte ranges; plain files are split at arbitrary
+// offsets and bgzipped files at BGZF block boundaries, and each worker
+// resynchronizes to the next line start with tsv_reader::set_range().
+// Non-BGZF gzip files cannot be split and are read as a single chunk.
+//
+// Results are written into tsv_scan_chunk::out (or data) by the workers, and
+// passed to the merge callback on the calling thread, either in file order
+// (ordered = true) or in the order the chunks complete.
+class tsv_parallel_scan {
+public:
+  typedef std::function<void(tsv_reader& tr, tsv_scan_chunk& chunk)> callback_t;
+  typedef std::function<void(tsv_scan_chunk& chunk)> merge_t;
+
+  std::string filename;  // file name to read
+  int32_t nthreads;      // number of worker threads
+  int32_t nchunks;       // number of chunks requested (default: 4 per thread)
+  int32_t delimiter;     // delimiter passed to each worker's tsv_reader
+  int32_t tokenizer;     // tokenizer engine passed to each worker's tsv_reader
+  std::vector<int32_t> projection; // column projection passed to each worker's tsv_reader (empty for all columns)
+  bool ordered;          // merge the chunks in file order
+  std::vector<tsv_scan_chunk> chunks; // chunks determined by plan()
+
+  tsv_parallel_scan(const char* _filename, int32_t _nthreads, int32_t _nchunks = 0) :
+    filename(_filename), nthreads(_nthreads > 0 ? _nthreads : 1), nchunks(_nchunks), delimiter(0), tokenizer(TSV_TOKENIZER_AUTO), ordered(true) {}
+
+  bool plan(); // split the file into chunks; called by scan_*() if not called yet
+
+  // call line_fn for every tokenized line, returns the total number of lines
+  uint64_t scan_lines(callback_t line_fn, merge_t merge_fn = nullptr);
+
+  // call batch_fn once per chunk with a reader restricted to the chunk, so
+  // that tr.read_line() returns 0 at the end of the chunk
+  uint64_t scan_batches(callback_t batch_fn, merge_t merge_fn = nullptr);
+
+  // locate the first BGZF block starting at or after a compressed offset, or -1 if none
+  static int64_t next_bgzf_block(hFILE* fp, int64_t from);
+
+protected:
+  uint64_t run(bool per_line, callback_t& fn, merge_t& merge_fn);
+};
+
+#endif
@@ -16,43 +16,142 @@ extern "C" {
 #include "htslib/kseq.h"
 #include "htslib/hts.h"
 #include "htslib/tbx.h"
+#include "htslib/thread_pool.h"
+#include "htslib/bgzf.h"
 }
 #include "qgen_error.h"
+#include "tsv_tokenizer.h"
+#include "mmap_reader.h"
+#include "uring_reader.h"
+#include "num_parser.h"
+#include "tsv_batch.h"
+#include "tsv_checkpoint.h"
+
+class GenomeInterval;
+class genomeLoci;
+class tsv_line_index;
+class text_line_reader;
+
+// a region queried by tsv_reader::jump_to_regions(), 0-based and half-open
+struct tsv_region {
+  int32_t tid;   // sequence id in the tabix index
+  hts_pos_t beg; // 0-based start (inclusive)
+  hts_pos_t end; // 0-based end (exclusive)
+
+  tsv_region(int32_t _tid = -1, hts_pos_t _beg = 0, hts_pos_t _end = 0) : tid(_tid), beg(_beg), end(_end) {}
+
+  bool operator< (const tsv_region& r) const {
+    return ( tid == r.tid ) ? ( beg < r.beg ) : ( tid < r.tid );
+  }
+};
 
 // a class to read tab-limited (tabixable) file using htsFile.h and kstring.h
 class tsv_reader {
 public:
   std::string filename;  // file name to read
   htsFile* hp;           // handles to htsFile 
-  tbx_t* tbx;            // tabix index, if exists
+  tbx_t* tbx;            // tabix index, if exists (not destroyed by close(), so it can be shared by readers of the same file)
   hts_itr_t* itr;        // iterator, if exists
   kstring_t str;         // kstring_t object to store the string
   int32_t lstr;          // length of the string
   int32_t nfields;       // number of tokenized fields (from kstring_t)
-  int32_t* fields;       // indices of the starting point to each field 
+  int32_t* fields;       // indices of the starting point to each field (owned by tok)
   uint64_t nlines;        // total number of lines read
   int32_t delimiter;     // delimiter to tokenize
+  tsv_tokenizer tok;     // tokenizer engine, keeps a reusable offset buffer
+  int32_t nthreads;      // number of BGZF decompression threads (0 if single-threaded)
+  htsThreadPool tpool;   // thread pool used for BGZF decompression, if any
+  bool own_tpool;        // true if tpool.pool was created (and will be destroyed) by this reader
+  int64_t range_end;     // read_line() stops at a line starting beyond this offset (-1 if unlimited)
+  mmap_reader mm;        // memory-mapped backend for plain files, used if opened by open_mmap()
+  const char* line_view; // current line inside the mapping or the io_uring block (not '\0'-terminated)
+  bool materialized;     // true if the current line was copied into str (mmap and io_uring modes only)
+  std::vector<int32_t> proj_cols; // projected column indices in the requested order (empty if all columns are read)
+  std::vector<int32_t> proj_slot; // position of each column in proj_cols, -1 if not projected
+  bool proj_compact;     // if true, fields holds only the offsets of the projected columns, in the order of proj_cols
+  bool in_regions;       // true if records are read from the regions set by jump_to_regions()
+  std::vector<tsv_region> regions; // coalesced regions set by jump_to_regions(), in file order
+  int32_t ireg;          // first region that the next record may overlap
+  int32_t ireg_end;      // one past the last region covered by the current iterator
+  int32_t max_region_gap; // regions closer than this share an iterator
+  text_line_reader* ulr; // line reader of a plain file opened by open_uring(), NULL otherwise
+  uint64_t checkpoint_every; // lines between calls of checkpoint_hook (0 if disabled)
+  uint64_t checkpoint_last;  // value of nlines at the last checkpoint_hook call
+  tsv_checkpoint_hook_t checkpoint_hook; // called with a checkpoint every checkpoint_every lines
   
-  bool open(const char* filename); // open a file, set up the file handle
+  bool open(const char* filename, int32_t threads = 0, int32_t queue_size = 0); // open a file, set up the file handle
+  bool open_mmap(const char* filename); // open an uncompressed local file through mmap; fields are views into the mapping
+  // open an uncompressed local file read ahead through io_uring, with queue_depth reads in flight;
+  // falls back to open() if io_uring is unavailable or the file is compressed (then ulr is NULL)
+  bool open_uring(const char* filename, int32_t queue_depth = URING_READER_QUEUE_DEPTH);
+  bool set_threads(int32_t threads, int32_t queue_size = 0); // decompress BGZF blocks with a private thread pool
+  bool set_thread_pool(hts_tpool* pool, int32_t queue_size = 0); // decompress BGZF blocks with a shared thread pool
   bool close();                    // close the file, returns false if fails
   int32_t read_line();             // read a line, returns the number of tokenzied fields (=nfields)
+  // read up to n lines into a batch, returns the number of lines read (0 at the end).
+  // With a compact projection, column j of the batch is column proj_cols[j] of the file
+  int32_t read_batch(tsv_batch& batch, int32_t n);
+  tsv_batch read_batch(int32_t n);
   const char* str_field_at(int32_t idx); // get a pointer to the string at index idx
+  const char* str_field_view(int32_t idx, int32_t* len); // get a pointer to the field at index idx and its length, without copying
   int32_t int_field_at(int32_t idx);     // get integer value at index idx
   uint64_t uint64_field_at(int32_t idx); // get unsigned long long (uint64_t) value at index idx
   int64_t int64_field_at(int32_t idx);   // get long long (int64_t) value at index idx  
   double double_field_at(int32_t idx);   // get double value at index idx
+  bool int_field_at(int32_t idx, int32_t& value);     // checked versions: return false if the field is not
+  bool int64_field_at(int32_t idx, int64_t& value);   // entirely a number representable in the type
+  bool uint64_field_at(int32_t idx, uint64_t& value);
+  bool double_field_at(int32_t idx, double& value);
   int32_t store_to_vector(std::vector<std::string>& v); // store the tokenized values into string vectors
   bool jump_to(const char* reg);   // jump to a specific region using tabix
   bool jump_to(const char* chr, int32_t beg, int32_t end = INT_MAX); // jump to a specific region using tabix
+  // read the records overlapping any of the regions, each record once and in file order.
+  // Overlapping and adjacent regions are merged, and regions less than max_gap bp
+  // apart are read with a single tabix iterator. Returns the number of merged regions.
+  int32_t jump_to_regions(const std::vector<std::string>& regs, int32_t max_gap = 0); // "chr", "chr:beg" or "chr:beg-end"
+  int32_t jump_to_regions(const std::vector<GenomeInterval>& intervals, int32_t max_gap = 0);
+  int32_t jump_to_regions(const genomeLoci& loci, int32_t max_gap = 0);
+  int32_t jump_to_regions(const std::vector<tsv_region>& regs, int32_t max_gap = 0);
+  // convert regions into sequence ids of a tabix index, dropping sequences absent from the index
+  static void resolve_regions(tbx_t* tbx, const std::vector<std::string>& regs, std::vector<tsv_region>& out);
+  static void resolve_regions(tbx_t* tbx, const std::vector<GenomeInterval>& intervals, std::vector<tsv_region>& out);
+  static void resolve_regions(tbx_t* tbx, const genomeLoci& loci, std::vector<tsv_region>& out);
+  static int32_t coalesce_regions(std::vector<tsv_region>& regs); // sort in file order and merge overlapping or adjacent regions
+  inline bool set_tokenizer(int32_t engine) { return tok.set_engine(engine); } // select one of TSV_TOKENIZER_*
+  // parse lines as RFC 4180 CSV (see tsv_tokenizer): empty fields are kept, quoted fields are
+  // unquoted, and a record with a newline inside quotes is read across lines (except through tabix)
+  inline void set_quote(int32_t quote = '"') { tok.set_quote(quote); }
+  int64_t tell();                  // current offset; BGZF virtual offset for bgzipped files, byte offset for plain files
+  bool seek(int64_t offset);       // seek to an offset returned by tell(), leaving the tabix iterator if any
+  bool set_range(int64_t beg, int64_t end); // read only lines starting in (beg, end], or [0, end] if beg == 0
+  bool seek_line(const tsv_line_index& lidx, uint64_t line); // seek to a line (0-based) using a line index, setting nlines to it
+  // read only the given columns: each line is tokenized up to the highest of
+  // them, and accessing any other column is an error. Accessors keep taking
+  // the original column indices. If compact is set, fields[k] is the offset
+  // of column cols[k] instead of column k.
+  void set_projection(const std::vector<int32_t>& cols, bool compact = false);
+  void clear_projection();         // read all columns again
+  // take a checkpoint after the last line read; returns false for tabix queries and non-BGZF gzip files
+  bool get_checkpoint(tsv_checkpoint& cp);
+  // move to the position of a checkpoint taken on the same file, restoring nlines and the range
+  bool resume(const tsv_checkpoint& cp);
+  bool resume(const char* checkpoint_filename); // load a checkpoint file and resume from it
+  // call hook with a checkpoint every `every` lines, before reading the next line, so
+  // that the caller state covers all lines read so far (every == 0 disables the hook)
+  void set_checkpoint_hook(uint64_t every, const tsv_checkpoint_hook_t& hook);
+  // save a checkpoint into checkpoint_filename every `every` lines, with the state set by fill_state, if any
+  void set_checkpoint_file(const char* checkpoint_filename, uint64_t every, const tsv_checkpoint_hook_t& fill_state = tsv_checkpoint_hook_t());
 
-  tsv_reader() : hp(NULL), tbx(NULL), itr(NULL), lstr(0), nfields(0), fields(NULL), nlines(0), delimiter(0) {
+  tsv_reader() : hp(NULL), tbx(NULL), itr(NULL), lstr(0), nfields(0), fields(NULL), nlines(0), delimiter(0), nthreads(0), own_tpool(false), range_end(-1), line_view(NULL), materialized(false), proj_compact(false), in_regions(false), ireg(0), ireg_end(0), max_region_gap(0), ulr(NULL), checkpoint_every(0), checkpoint_last(0) {
     str.l = str.m = 0; str.s = NULL;
+    tpool.pool = NULL; tpool.qsize = 0;
   }
 
-  tsv_reader(const char* filename) : hp(NULL), tbx(NULL), itr(NULL), lstr(0), nfields(0), fields(NULL), nlines(0), delimiter(0) {
+  tsv_reader(const char* filename, int32_t threads = 0) : hp(NULL), tbx(NULL), itr(NULL), lstr(0), nfields(0), fields(NULL), nlines(0), delimiter(0), nthreads(0), own_tpool(false), range_end(-1), line_view(NULL), materialized(false), proj_compact(false), in_regions(false), ireg(0), ireg_end(0), max_region_gap(0), ulr(NULL), checkpoint_every(0), checkpoint_last(0) {
     str.l = str.m = 0; str.s = NULL;    
-    if ( !open(filename) )
-      error("[E:%s:%s %s] Cannot open file %s for reading", __FILE__, __LINE__, __FUNCTION__, filename);    
+    tpool.pool = NULL; tpool.qsize = 0;
+    if ( !open(filename, threads) )
+      error("[E:%s:%d %s] Cannot open file %s for reading", __FILE__, __LINE__, __FUNCTION__, filename);    
   }  
 
   ~tsv_reader() {
@@ -60,38 +159,145 @@ public:
     // if ( fields ) free(fields);
     // if ( hp != NULL) close();
   }
+
+protected:
+  std::vector<int32_t> proj_offsets; // offsets of the projected columns (compact projection only)
+  std::vector<int32_t> proj_ends;    // ends of the projected columns (compact projection only)
+
+  int32_t fetch_line();
+  int32_t fetch_line_mmap();
+  int32_t fetch_line_uring();
+  int32_t getline(kstring_t* s); // read the next line of a plain or compressed file into s, without the newline
+  int32_t fetch_record();
+  int32_t next_region_record();
+  bool load_index();
+  void clear_regions();
+  void materialize();
+  void compact_fields();
+
+  // call checkpoint_hook if checkpoint_every lines were read since the last call
+  inline void check_checkpoint() {
+    if ( ( checkpoint_every > 0 ) && ( nlines / checkpoint_every > checkpoint_last / checkpoint_every ) ) {
+      checkpoint_last = nlines;
+      tsv_checkpoint cp;
+      if ( get_checkpoint(cp) ) checkpoint_hook(cp);
+    }
+  }
+
+  // true if the fields of the current line are located in line_view rather than str
+  inline bool is_view() const { return ( mm.is_open() || ( ulr != NULL ) ) && !materialized; }
+
+  // returns the position of field idx in fields, checking that it was tokenized
+  inline int32_t field_slot(int32_t idx) {
+    if ( !proj_slot.empty() && ( ( idx < 0 ) || ( idx >= (int32_t)proj_slot.size() ) || ( proj_slot[idx] < 0 ) ) )
+      error("[E:%s:%d %s] Cannot access field at %d, which is not in the column projection", __FILE__, __LINE__, __FUNCTION__, idx);
+    if ( idx >= nfields )
+      error("[E:%s:%d %s] Cannot access field at %d >= %d", __FILE__, __LINE__, __FUNCTION__, idx, nfields);
+    return proj_compact ? proj_slot[idx] : idx;
+  }
+
+  // returns the start of the field at index idx, and sets end to one past its last character
+  inline const char* field_range(int32_t idx, const char*& end) {
+    int32_t k = field_slot(idx);
+    const char* base = is_view() ? line_view : str.s;
+    end = base + ( proj_compact ? proj_ends[k] : tok.ends[k] );
+    return base + fields[k];
+  }
 };
 
 
+#define TEXT_LINE_READER_BLOCK_SIZE (4 << 20)    // default size of block reads
+#define TEXT_LINE_READER_MAX_BLOCK_SIZE (16 << 20) // largest initial block size
+
+// a class to read lines of a plain, gzipped or bgzipped text file.
+//
+// The file is read through BGZF, which detects the compression, in large blocks, and each line is located with memchr() and
+// returned as a view into the block; buffer stays valid until the next
+// readline() call. buffer[last_line_length-1] is always '\n' and
+// buffer[last_line_length] is '\0' (a newline is supplied for a last line
+// without one), so the line can be used as a C string or terminated in place.
+// Lines longer than a block grow the block, and are never read twice.
+// Offsets are counted in uncompressed bytes.
 class text_line_reader {
 public:
   std::string filename;
-  FILE* fp;
-  char* buffer;
-  int32_t max_line_length;
+  BGZF* fp;                // plain, gzip or BGZF input
+  char* buffer;            // current line
+  int32_t max_line_length; // size of the initial block; lines of any length are read
   int32_t last_line_length;
-  int32_t count_lines;
-  off_t cur_fp_offset;
+  uint64_t count_lines;    // number of lines read so far
+  off_t cur_fp_offset;     // file offset just past the current line
+  off_t line_offset;       // file offset of the current line
+  int32_t nthreads;        // number of BGZF decompression threads (0 if single-threaded)
+  hts_tpool* tpool;        // thread pool owned by this reader, if any
+  mmap_reader mm; // memory-mapped backend, used if opened by open_mmap()
+  uring_reader ur; // io_uring backend, used if opened by open_uring()
 
-  text_line_reader() : fp(NULL), buffer(NULL), max_line_length(1024), last_line_length(0), count_lines() {}
+  text_line_reader() : fp(NULL), buffer(NULL), max_line_length(TEXT_LINE_READER_BLOCK_SIZE), last_line_length(0), count_lines(0), cur_fp_offset(0), line_offset(0), nthreads(0), tpool(NULL),
+                       blk(NULL), blk_mem(NULL), blk_cap(0), blk_len(0), blk_pos(0), nul_pos(-1), nul_saved(0), at_eof(false) {
+    anchor_uoff[0] = anchor_uoff[1] = 0;
+    anchor_voff[0] = anchor_voff[1] = 0;
+  }
 
-  bool open(const char* _filename, int32_t _max_line_length = 0);
+  bool open(const char* _filename, int32_t _max_line_length = 0, int32_t threads = 0);
+  // decompress BGZF blocks ahead of the reader in a pool of threads (up to
+  // queue_size blocks). Must be called before the first readline().
+  // Plain and non-BGZF gzip files are read single-threaded.
+  bool set_threads(int32_t threads, int32_t queue_size = 0);
+  // open an uncompressed local file through mmap. buffer then points into the
+  // mapping and is NOT '\0'-terminated; use last_line_length to find its end.
+  bool open_mmap(const char* _filename);
+  // open an uncompressed local file with queue_depth reads kept in flight
+  // through io_uring. Falls back to open() if io_uring is unavailable, or if
+  // the file is compressed or not a regular file (check ur.is_open())
+  bool open_uring(const char* _filename, int32_t queue_depth = URING_READER_QUEUE_DEPTH, int32_t _max_line_length = 0);
   int32_t readline();
+  // seek to an offset: a byte offset for plain files, a virtual offset for
+  // bgzipped ones. cur_fp_offset follows for plain files only
+  bool seek(int64_t offset);
+  // seek to a line (0-based) using a line index; the offsets and count_lines follow
+  bool seek_line(const tsv_line_index& lidx, uint64_t line);
+  // take a checkpoint after the current line, or before it if before_line is set (to read it again
+  // after resuming); returns false for non-BGZF gzip files
+  bool get_checkpoint(tsv_checkpoint& cp, bool before_line = false);
+  bool resume(const tsv_checkpoint& cp); // move to the position of a checkpoint, restoring count_lines
   int32_t close();
   ~text_line_reader();
 
   static int32_t load_to_set(const char* filename, std::set<std::string>& sset);
+
+protected:
+  char* blk;         // current block: blk_mem, or a buffer of ur in io_uring mode, with 2 spare bytes past its end
+  char* blk_mem;     // allocated block buffer, with 2 spare bytes past blk_cap
+  int64_t blk_cap;   // capacity of the block buffer
+  int64_t blk_len;   // number of valid bytes in the block buffer
+  int64_t blk_pos;   // start of the next line in the block buffer
+  int64_t nul_pos;   // position of the '\0' written after the current line, -1 if none
+  char nul_saved;    // byte overwritten by that '\0'
+  bool at_eof;       // no more data to read from fp
+  // uncompressed and virtual offsets where BGZF reads started, to locate a line in a bgzipped
+  // file: [1] is the last read, and [0] the last one starting at or before the buffered data
+  off_t anchor_uoff[2];
+  int64_t anchor_voff[2];
+
+  void init_block(int32_t _max_line_length); // allocate the block buffer and reset the offsets
+  void set_anchor(int64_t voffset); // after a seek in a bgzipped file, voffset is at cur_fp_offset
+  bool fill_block(); // read more data after the partial line at blk_pos; returns false at the end of the file
 };
 
 class dsv_hdr_reader {
 protected:
   int32_t tokenize_fields();
   text_line_reader tlr;
-  std::map<std::string,int32_t> col2idx;
+  std::map<std::string,int32_t,std::less<> > col2idx; // transparent comparator: lookups by const char* do not allocate
   std::string delim;
   int32_t ret_hdr_line;
   std::vector<std::string> headers;
   std::vector<int32_t> fields;
+  tsv_tokenizer tok; // used instead of strsep() in CSV mode
+  uint64_t checkpoint_every; // lines between calls of checkpoint_hook (0 if disabled)
+  uint64_t checkpoint_last;  // value of tlr.count_lines at the last checkpoint_hook call
+  tsv_checkpoint_hook_t checkpoint_hook;
 
   static bool is_substring_of_any(const char* str, std::vector<std::string>& queries) {
     for(int32_t i=0; i < (int32_t)queries.size(); ++i) {
@@ -104,48 +310,96 @@ protected:
 public:
   int32_t nfields;
 
-  bool open(const char* filename, int32_t _max_line_length = 65536, const char* _delim = " \t");
+  // open a plain, gzipped or bgzipped file; BGZF blocks are decompressed by threads if threads > 0
+  bool open(const char* filename, int32_t _max_line_length = 65536, const char* _delim = " \t", int32_t threads = 0);
   bool read_hdr(const char* prefix_match, const char* prefix_skip = NULL, const char* ignore_chars = "#");
   bool read_hdr(std::vector<std::string>& prefixes_match, std::vector<std::string>& prefixes_skip, const char* ignore_chars = "#");
   bool close();
+  // parse lines as RFC 4180 CSV with the first character of the delimiter set (see tsv_tokenizer).
+  // Quoted fields may contain delimiters, but not newlines
+  inline void set_quote(int32_t quote = '"') { tok.set_quote(quote); }
+  // seek to a line (0-based, counting the header lines) using a line index; the header is kept
+  bool seek_line(const tsv_line_index& lidx, uint64_t line);
   inline bool has_header() { return col2idx.empty(); }
   int32_t read_line();
+  // take a checkpoint before the next data line, with the header; lines are counted including the header lines
+  bool get_checkpoint(tsv_checkpoint& cp);
+  // move to the position of a checkpoint taken on the same file, restoring the header (read_hdr() is not needed)
+  bool resume(const tsv_checkpoint& cp);
+  bool resume(const char* checkpoint_filename);
+  // call hook with a checkpoint every `every` lines, before reading the next line
+  void set_checkpoint_hook(uint64_t every, const tsv_checkpoint_hook_t& hook);
+  void set_checkpoint_file(const char* checkpoint_filename, uint64_t every, const tsv_checkpoint_hook_t& fill_state = tsv_checkpoint_hook_t());
 
   inline const char* str_field_at(int32_t idx) {
     return &tlr.buffer[fields[idx]];
   }
 
   inline int32_t int_field_at(int32_t idx) {
-    return atoi(&tlr.buffer[fields[idx]]);
+    return fast_atoi32(&tlr.buffer[fields[idx]]);
   }
 
   inline double double_field_at(int32_t idx) {
-    return atof(&tlr.buffer[fields[idx]]);
+    return fast_atof(&tlr.buffer[fields[idx]]);
+  }
+
+  // checked versions: return false if the field is not entirely a number representable in the type
+  inline bool int_field_at(int32_t idx, int32_t& value) {
+    return parse_int32(&tlr.buffer[fields[idx]], value);
+  }
+
+  inline bool double_field_at(int32_t idx, double& value) {
+    return parse_double(&tlr.buffer[fields[idx]], value);
   }
 
   inline const char* str_field_colnames(const char* colname, const char* default_value = NULL) {
-    std::map<std::string,int32_t>::iterator it = col2idx.find(colname);
+    std::map<std::string,int32_t,std::less<> >::iterator it = col2idx.find(colname);
     if ( it == col2idx.end() ) return default_value;
     else return &tlr.buffer[fields[it->second]];
   }
 
   inline int32_t int_field_colnames(const char* colname, int32_t default_value = 0) {
-    std::map<std::string,int32_t>::iterator it = col2idx.find(colname);
+    std::map<std::string,int32_t,std::less<> >::iterator it = col2idx.find(colname);
     if ( it == col2idx.end() ) return default_value;
-    else return atoi(&tlr.buffer[fields[it->second]]);
+    else return fast_atoi32(&tlr.buffer[fields[it->second]]);
   }
 
   inline double double_field_colnames(const char* colname, double default_value = 0.0) {
-    std::map<std::string,int32_t>::iterator it = col2idx.find(colname);
+    std::map<std::string,int32_t,std::less<> >::iterator it = col2idx.find(colname);
     if ( it == col2idx.end() ) return default_value;
-    else return atof(&tlr.buffer[fields[it->second]]);
+    else return fast_atof(&tlr.buffer[fields[it->second]]);
+  }
+
+  // Column handles: resolve column names once after read_hdr(), and access the
+  // fields of each line by handle without any lookup. A handle is the column
+  // index, or -1 for a column absent from the header; the *_field_handle()
+  // functions return default_value for -1 and for lines too short to have the column.
+  inline int32_t get_colidx(const char* colname) {
+    std::map<std::string,int32_t,std::less<> >::iterator it = col2idx.find(colname);
+    return ( it == col2idx.end() ) ? -1 : it->second;
+  }
+
+  // resolve many columns at once. Returns false if any column is missing, and
+  // appends the names of the missing columns to missing, if given
+  bool bind_columns(const std::vector<std::string>& colnames, std::vector<int32_t>& handles, std::vector<std::string>* missing = NULL);
+
+  inline const char* str_field_handle(int32_t h, const char* default_value = NULL) {
+    return ( (uint32_t)h < (uint32_t)nfields ) ? &tlr.buffer[fields[h]] : default_value;
+  }
+
+  inline int32_t int_field_handle(int32_t h, int32_t default_value = 0) {
+    return ( (uint32_t)h < (uint32_t)nfields ) ? fast_atoi32(&tlr.buffer[fields[h]]) : default_value;
+  }
+
+  inline double double_field_handle(int32_t h, double default_value = 0.0) {
+    return ( (uint32_t)h < (uint32_t)nfields ) ? fast_atof(&tlr.buffer[fields[h]]) : default_value;
   }
 
   int32_t store_to_vector(std::vector<std::string>& v);
 
-  dsv_hdr_reader(): nfields(0), delim(" \t"), ret_hdr_line(-1) {}
-  dsv_hdr_reader(const char* filename) : nfields(0), delim(" \t") {
-    if (!open(filename)) {
+  dsv_hdr_reader(): nfields(0), delim(" \t"), ret_hdr_line(-1), checkpoint_every(0), checkpoint_last(0) {}
+  dsv_hdr_reader(const char* filename, int32_t threads = 0) : nfields(0), delim(" \t"), checkpoint_every(0), checkpoint_last(0) {
+    if (!open(filename, 65536, " \t", threads)) {
       error("Cannot open file %s for reading", filename);
     }
   }
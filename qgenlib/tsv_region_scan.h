@@ -0,0 +1,66 @@
+#ifndef __TSV_REGION_SCAN_H
+#define __TSV_REGION_SCAN_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "tsv_reader.h"
+
+// a batch of consecutive regions processed by a single worker
+struct tsv_region_task {
+  int32_t index;    // index of the task in file order
+  int32_t ibeg;     // first region of the task in tsv_region_scan::regions
+  int32_t iend;     // one past the last region of the task
+  uint64_t nlines;  // number of records read for this task
+  std::string out;  // output produced by the worker, handed to the merge callback
+  void* data;       // arbitrary per-task data attached by the callbacks
+
+  tsv_region_task() : index(0), ibeg(0), iend(0), nlines(0), data(NULL) {}
+};
+
+// a class to query many regions of a tabix-indexed file with multiple threads.
+//
+// The tabix index is loaded once and shared by all workers, while each worker
+// reads through its own tsv_reader (and htsFile handle). Regions are sorted
+// and merged as in tsv_reader::jump_to_regions(), then split into tasks of
+// consecutive regions; a record overlapping the regions of two tasks is only
+// returned by the first one, so every record is processed once.
+//
+// As in tsv_parallel_scan, the results are passed to the merge callback on
+// the calling thread, either in file order (ordered = true) or in the order
+// the tasks complete.
+class tsv_region_scan {
+public:
+  typedef std::function<void(tsv_reader& tr, tsv_region_task& task)> callback_t;
+  typedef std::function<void(tsv_region_task& task)> merge_t;
+
+  std::string filename;  // file name to read
+  int32_t nthreads;      // number of worker threads
+  int32_t ntasks;        // number of tasks requested (default: 4 per thread)
+  int32_t max_gap;       // regions closer than this share a tabix iterator within a task
+  int32_t delimiter;     // delimiter passed to each worker's tsv_reader
+  int32_t tokenizer;     // tokenizer engine passed to each worker's tsv_reader
+  std::vector<int32_t> projection; // column projection passed to each worker's tsv_reader (empty for all columns)
+  bool ordered;          // merge the tasks in file order
+  tbx_t* tbx;            // tabix index shared by the workers
+  std::vector<tsv_region> regions;    // merged regions in file order
+  std::vector<tsv_region_task> tasks; // tasks determined by plan()
+
+  tsv_region_scan(const char* _filename, int32_t _nthreads, int32_t _ntasks = 0);
+  ~tsv_region_scan();
+
+  // set the regions to query, returns the number of regions after merging
+  int32_t set_regions(const std::vector<std::string>& regs);
+  int32_t set_regions(const std::vector<GenomeInterval>& intervals);
+  int32_t set_regions(const genomeLoci& loci);
+  int32_t set_regions(const std::vector<tsv_region>& regs);
+
+  bool plan(); // split the regions into tasks; called by scan_lines() if not called yet
+
+  // call line_fn for every record overlapping the regions, returns the total number of records
+  uint64_t scan_lines(callback_t line_fn, merge_t merge_fn = nullptr);
+};
+
+#endif
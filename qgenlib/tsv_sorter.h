@@ -0,0 +1,88 @@
+#ifndef __TSV_SORTER_H
+#define __TSV_SORTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+
+#define TSV_SORTER_DEFAULT_MEM (768LL << 20) // default memory budget for buffered lines
+#define TSV_SORTER_MAX_RUNS 256             // runs merged at once; more runs are merged in several passes
+
+// a class to sort TSV/BED-like files by (contig, start, end) under a memory budget,
+// and to write the result as a bgzipped file with a tabix index.
+//
+// Lines are buffered until the memory budget is reached; the buffer is then
+// split into one slice per thread, each slice is radix-sorted on its packed
+// keys, and spilled as a compressed run into a temporary file. The runs are
+// finally merged with a heap and written through tsv_writer, which compresses
+// the output with multiple threads and builds the index on the fly. Input
+// that fits in memory is merged directly, without temporary files.
+//
+// The sort is stable. Contigs are ordered as given by set_contig_order() or
+// load_contig_order(), and otherwise in the order they first appear in the
+// input; contigs absent from a given order are placed after the listed ones,
+// in the order they appear. Lines starting with meta_char are written first.
+class tsv_sorter {
+public:
+  int32_t chrom_col;     // 0-based column of the contig name
+  int32_t beg_col;       // 0-based column of the start position
+  int32_t end_col;       // 0-based column of the end position, -1 if none
+  bool zero_based;       // true if start positions are 0-based (as in BED)
+  char meta_char;        // lines starting with this character are headers (0 if none)
+  int64_t max_mem;       // memory budget for buffered lines, in bytes
+  int32_t nthreads;      // threads used to sort, spill and compress
+  int32_t level;         // compression level of the output (-1 for the default)
+  std::string tmp_dir;   // directory of the temporary files (TMPDIR or /tmp by default)
+  std::vector<std::string> contigs;        // contigs in sort order
+  std::map<std::string,int32_t> contig2id; // index of each contig in contigs
+  uint64_t nlines;       // number of data lines added
+
+  tsv_sorter(int32_t _chrom_col = 0, int32_t _beg_col = 1, int32_t _end_col = 2, bool _zero_based = true);
+  ~tsv_sorter();
+
+  // set the contig order, before adding any line
+  void set_contig_order(const std::vector<std::string>& names);
+  // read the contig order from a .fai file or a VCF/BCF header, depending on the file name
+  bool load_contig_order(const char* filename);
+
+  bool add_file(const char* filename);       // add all lines of a plain, gzipped or bgzipped file
+  void add_line(const char* s, int32_t len); // add a line, without the newline
+
+  // sort and write the lines; the output is bgzipped and indexed (.tbi, or
+  // .csi for positions beyond 2^29) if its name ends with .gz or .bgz
+  bool write(const char* out_filename, bool index = true);
+
+  // a buffered line and its packed sort key (contig and start, then end)
+  struct sort_key {
+    uint64_t hi;  // contig id << 40 | start
+    uint64_t lo;  // end
+    uint64_t rec; // index of the line in the buffer
+  };
+
+protected:
+  std::vector<char> arena;           // buffered lines, back to back
+  std::vector<uint64_t> rec_offsets; // offset of each buffered line in arena
+  std::vector<uint32_t> rec_lengths; // length of each buffered line
+  std::vector<sort_key> keys;        // key of each buffered line
+  std::string header;                // header lines, with their newlines
+  std::vector<std::string> run_files; // spilled runs, in input order
+  int64_t max_pos;                   // largest position seen, to choose the index format
+  std::string last_contig;           // contig of the last line, to skip the lookup on sorted input
+  int32_t last_tid;
+
+  int32_t contig_to_id(const char* s, int32_t len);
+  // sort the buffered lines in one slice per thread; slice i is keys[bounds[i], bounds[i+1])
+  void sort_slices(std::vector<size_t>& bounds);
+  void spill();            // sort the buffered lines and write them into temporary runs
+  std::string new_run();   // create an empty temporary file, returns its name
+  // merge run_files[run_beg, run_end) and the buffered slices (if any), in
+  // this order for equal keys, passing each line to sink
+  void merge(size_t run_beg, size_t run_end, const std::vector<size_t>* bounds,
+             const std::function<void(uint64_t, uint64_t, const char*, uint32_t)>& sink);
+  void reduce_runs(size_t max_runs); // merge runs in several passes until at most max_runs remain
+  void remove_runs();      // delete the temporary files
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef __TSV_TOKENIZER_H
+#define __TSV_TOKENIZER_H
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include "qgen_error.h"
+
+// engines available to tokenize a line into fields
+#define TSV_TOKENIZER_KSPLIT 0 // htslib ksplit_core(), byte-by-byte
+#define TSV_TOKENIZER_SCALAR 1 // portable byte-by-byte loop
+#define TSV_TOKENIZER_SSE42  2 // 16 bytes at a time (x86-64 with SSE4.2)
+#define TSV_TOKENIZER_AVX2   3 // 32 bytes at a time (x86-64 with AVX2)
+#define TSV_TOKENIZER_AUTO   4 // best engine supported by the running CPU
+
+// a class to split a line into fields, keeping the offsets in a buffer
+// that grows as needed but is never freed between lines.
+//
+// Semantics follow htslib's ksplit(): a field is a maximal run of
+// non-delimiter characters (empty fields are skipped), delimiter == 0 means
+// any whitespace, and the character ending each field is overwritten by '\0'.
+// Tokenization also stops at the first '\n', so raw buffers can be passed.
+// tokenize_view() does the same without writing into the input.
+// If max_tokens > 0, tokenization stops as soon as the first max_tokens
+// fields are complete, and the rest of the line is left unscanned.
+//
+// If quote is set (see set_quote()), lines are parsed as RFC 4180 CSV
+// instead: every delimiter separates two fields, so empty fields are kept,
+// delimiter == 0 means ',', and delimiters and newlines between quotes are
+// part of the field. Quoted fields are returned without the enclosing quotes;
+// tokenize() also turns each escaped quote ("") into a single quote, while
+// tokenize_view() leaves them doubled. As in other vectorized CSV parsers,
+// every quote character toggles the quoted state, so a stray quote in an
+// unquoted field starts a quoted section.
+class tsv_tokenizer {
+public:
+  int32_t* offsets;    // starting offset of each field
+  int32_t* ends;       // offset one past the end of each field
+  int32_t nfields;     // number of fields found by the last tokenize() call
+  int32_t max_fields;  // allocated size of offsets
+  int32_t max_ends;    // allocated size of ends
+  int32_t line_length; // number of bytes consumed by the last tokenize() call
+  int32_t max_tokens;  // stop after this many fields (0 if unlimited)
+  int32_t engine;      // engine in use, one of TSV_TOKENIZER_* except AUTO
+  int32_t quote;       // quote character of the CSV mode, 0 if disabled
+
+  tsv_tokenizer(int32_t _engine = TSV_TOKENIZER_AUTO) : offsets(NULL), ends(NULL), nfields(0), max_fields(0), max_ends(0), line_length(0), max_tokens(0), engine(TSV_TOKENIZER_SCALAR), quote(0) {
+    set_engine(_engine);
+  }
+
+  tsv_tokenizer(const tsv_tokenizer& o) : offsets(NULL), ends(NULL), nfields(0), max_fields(0), max_ends(0), line_length(0), max_tokens(o.max_tokens), engine(o.engine), quote(o.quote) {
+    copy_from(o);
+  }
+
+  tsv_tokenizer& operator=(const tsv_tokenizer& o) {
+    if ( this != &o ) {
+      engine = o.engine;
+      max_tokens = o.max_tokens;
+      quote = o.quote;
+      copy_from(o);
+    }
+    return *this;
+  }
+
+  ~tsv_tokenizer() {
+    if ( offsets != NULL ) free(offsets);
+    if ( ends != NULL ) free(ends);
+  }
+
+  // select an engine; falls back to the best supported one (and returns false)
+  // if the requested engine is not available on this CPU
+  bool set_engine(int32_t _engine);
+
+  // parse lines as quoted CSV with the given quote character, or as
+  // ksplit()-style fields again if _quote is 0
+  inline void set_quote(int32_t _quote = '"') { quote = _quote; }
+
+  // true if s[0..len) has an unterminated quoted field in CSV mode, so that
+  // the record continues on the next line
+  bool has_open_quote(const char* s, int32_t len) const;
+
+  // tokenize s[0..len) in place, returns the number of fields
+  int32_t tokenize(char* s, int32_t len, int32_t delimiter);
+
+  // tokenize s[0..len) without modifying it
+  int32_t tokenize_view(const char* s, int32_t len, int32_t delimiter);
+
+  // make sure that offsets can hold at least n fields
+  inline void reserve(int32_t n) {
+    if ( n > max_fields ) {
+      int32_t new_max = max_fields > 0 ? max_fields : 16;
+      while( new_max < n ) new_max *= 2;
+      offsets = (int32_t*)realloc(offsets, sizeof(int32_t) * new_max);
+      if ( offsets == NULL )
+        error("[E:%s:%d %s] Cannot allocate memory for %d field offsets", __FILE__, __LINE__, __FUNCTION__, new_max);
+      max_fields = new_max;
+    }
+  }
+
+  // make sure that both offsets and ends can hold at least n fields
+  inline void reserve_ends(int32_t n) {
+    reserve(n);
+    if ( max_ends < max_fields ) {
+      ends = (int32_t*)realloc(ends, sizeof(int32_t) * max_fields);
+      if ( ends == NULL )
+        error("[E:%s:%d %s] Cannot allocate memory for %d field offsets", __FILE__, __LINE__, __FUNCTION__, max_fields);
+      max_ends = max_fields;
+    }
+  }
+
+  static bool is_supported(int32_t _engine); // check whether the running CPU supports the engine
+  static int32_t best_engine();              // the fastest engine supported by the running CPU
+  static const char* engine_name(int32_t _engine);
+
+protected:
+  void copy_from(const tsv_tokenizer& o) {
+    nfields = o.nfields;
+    line_length = o.line_length;
+    if ( o.max_fields > 0 ) {
+      reserve(o.max_fields);
+      memcpy(offsets, o.offsets, sizeof(int32_t) * o.nfields);
+    }
+    if ( o.max_ends > 0 ) {
+      reserve_ends(o.max_ends);
+      memcpy(ends, o.ends, sizeof(int32_t) * ( o.nfields < o.max_ends ? o.nfields : o.max_ends ));
+    }
+  }
+};
+
+#endif
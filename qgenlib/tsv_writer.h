@@ -0,0 +1,125 @@
+#ifndef __TSV_WRITER_H
+#define __TSV_WRITER_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+
+extern "C" {
+#include "htslib/hts.h"
+#include "htslib/hfile.h"
+#include "htslib/tbx.h"
+}
+#include "qgen_error.h"
+
+// a class to write tab-delimited files through a large reusable buffer.
+//
+// Fields are appended with the typed put_*() functions, which insert the
+// delimiter between fields, and each line is completed by end_line().
+// Files named *.gz or *.bgz are compressed into BGZF blocks by the writer
+// itself, using several threads while the caller keeps producing lines, and
+// a .tbi or .csi index can be built on the fly for sorted records, which
+// avoids indexing the output in a separate pass.
+class tsv_writer {
+public:
+  std::string filename; // file name to write
+  hFILE* fp;            // output handle
+  bool bgzf;            // compress the output into BGZF blocks
+  int32_t level;        // compression level (-1 for the zlib default)
+  int32_t nthreads;     // number of compression threads
+  int32_t delimiter;    // delimiter inserted between fields
+  uint64_t nlines;      // number of lines written
+
+  tsv_writer() : fp(NULL), bgzf(false), level(-1), nthreads(1), delimiter('\t'), nlines(0),
+                 buf(NULL), len(0), cap(0), line_beg(0), nfields_line(0), ubeg(0),
+                 spare(NULL), spare_cap(0), busy(false), batch_first_block(0), nblocks_done(0), caddr_done(0),
+                 idx(NULL), idx_fmt(-1), min_shift(0), first_data(-1), last_tid(-1) {}
+  tsv_writer(const char* _filename, int32_t threads = 1, int32_t _level = -1) : tsv_writer() {
+    if ( !open(_filename, threads, _level) )
+      error("[E:%s:%d %s] Cannot open file %s for writing", __FILE__, __LINE__, __FUNCTION__, _filename);
+  }
+  ~tsv_writer();
+
+  // open a file ("-" for stdout); BGZF compression is used for names ending with .gz or .bgz
+  bool open(const char* _filename, int32_t threads = 1, int32_t _level = -1);
+  bool set_bgzf(bool _bgzf); // force or disable BGZF compression, before writing anything
+  // build a tabix (min_shift == 0) or CSI index while writing, to be saved at close().
+  // Records must be sorted, and the output must be BGZF-compressed
+  bool set_index(const tbx_conf_t& _conf, int32_t _min_shift = 0);
+  bool close(); // flush everything, and save the index if any; returns false if fails
+
+  // append a field to the current line
+  inline void put_str(const char* s, int32_t l) {
+    char* p = reserve_field(l);
+    memcpy(p, s, l);
+    len += l;
+  }
+  inline void put_str(const char* s) { put_str(s, (int32_t)strlen(s)); }
+  inline void put_str(const std::string& s) { put_str(s.data(), (int32_t)s.size()); }
+  void put_int(int64_t v);
+  void put_uint(uint64_t v);
+  void put_double(double v, int32_t digits = 6); // like printf("%.*g")
+  void put_fixed(double v, int32_t decimals);    // like printf("%.*f")
+  void end_line();                                // complete the current line
+
+  // write a complete line (without the trailing newline)
+  inline void write_line(const char* s, int32_t l) {
+    put_str(s, l);
+    end_line();
+  }
+  inline void write_line(const char* s) { write_line(s, (int32_t)strlen(s)); }
+
+protected:
+  char* buf;            // current buffer, holding the bytes not yet handed to the compressor
+  int64_t len;          // number of bytes used in buf
+  int64_t cap;          // allocated size of buf
+  int64_t line_beg;     // offset of the current line in buf
+  int32_t nfields_line; // number of fields in the current line
+  uint64_t ubeg;        // uncompressed offset of buf[0] in the output
+
+  char* spare;          // second buffer, compressed in the background while buf is filled
+  int64_t spare_cap;
+  std::thread worker;   // background compression of the spare buffer
+  bool busy;            // true if worker is running
+  std::vector<uint8_t> cbuf; // compressed blocks of the spare buffer
+  std::vector<int64_t> block_addrs; // compressed offsets of the blocks of the last batch
+  uint64_t batch_first_block; // index of the first block of the last batch
+  uint64_t nblocks_done; // number of blocks written
+  int64_t caddr_done;   // compressed offset after the blocks written
+
+  // on-the-fly index
+  struct idx_entry {
+    int32_t tid;
+    hts_pos_t beg, end;
+    uint64_t uend;      // uncompressed offset of the end of the record
+  };
+  hts_idx_t* idx;       // index being built (NULL until the first record is resolved)
+  int32_t idx_fmt;      // HTS_FMT_TBI or HTS_FMT_CSI, -1 if no index is built
+  tbx_conf_t conf;      // tabix configuration to locate the intervals
+  int32_t min_shift;
+  int64_t first_data;   // uncompressed offset of the first indexed record, -1 if none yet
+  std::deque<idx_entry> pending; // records whose block is not written yet
+  std::vector<std::string> seqnames; // sequence names in the order of their first appearance
+  std::map<std::string,int32_t> seq2tid;
+  int32_t last_tid;     // sequence id of the last record
+
+  // make room for a field of l bytes, inserting the delimiter if needed
+  inline char* reserve_field(int32_t l) {
+    if ( len + l + 2 > cap ) grow(len + l + 2);
+    if ( nfields_line++ > 0 ) buf[len++] = (char)delimiter;
+    return buf + len;
+  }
+  void grow(int64_t need);
+  void flush(bool final);
+  void wait();
+  void compress_blocks(int64_t n);
+  void index_line(const char* s, int32_t l);
+  void resolve_pending(bool final);
+  uint64_t voffset(uint64_t u, bool& known);
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __URING_READER_H
+#define __URING_READER_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define URING_READER_QUEUE_DEPTH 8          // default number of reads kept in flight
+#define URING_READER_BLOCK_SIZE (4 << 20)   // default size of each read
+
+// a class to read an uncompressed local file sequentially through Linux io_uring.
+//
+// The file is split into blocks that are read into a ring of queue_depth
+// buffers, with a read in flight for every buffer that the consumer is not
+// using, so that the device keeps serving requests while the caller parses
+// the previous block. next_block() hands out the completed blocks in file
+// order without copying them, and resubmits the previous buffer. Each buffer
+// has room in front of its block for the unfinished end of the previous
+// block (e.g. a partial line), so that the two are contiguous.
+//
+// io_uring is used through its system calls, without liburing. open() returns
+// false if the library was built without io_uring (on non-Linux systems, or
+// with QGEN_NO_IO_URING defined), if the kernel does not allow it (e.g. in
+// restricted containers), or if the file is not a regular file; callers are
+// expected to fall back to their usual reading path.
+class uring_reader {
+public:
+  std::string filename; // file name to read
+  int fd;               // file descriptor, -1 if not open
+  uint64_t size;        // size of the file when opened
+  uint64_t pos;         // file offset past the last block handed out
+  int32_t queue_depth;  // number of buffers, and of reads in flight at most
+  int64_t block_size;   // size of each read
+
+  uring_reader() : fd(-1), size(0), pos(0), queue_depth(URING_READER_QUEUE_DEPTH), block_size(URING_READER_BLOCK_SIZE),
+                   ring(NULL), next_off(0), cur(-1), head(0) {}
+  ~uring_reader() { close(); }
+
+  static bool available(); // true if io_uring can be set up on this system (checked once)
+
+  bool open(const char* _filename, int32_t _queue_depth = URING_READER_QUEUE_DEPTH, int64_t _block_size = URING_READER_BLOCK_SIZE);
+  bool close();
+  inline bool is_open() const { return fd >= 0; }
+
+  // move to the next block, waiting for it to be read if needed. The tail_len
+  // bytes at tail, which may lie in the previous block, are copied just
+  // before it; data is then set to the copy, followed by the block and by 2
+  // writable spare bytes. Returns tail_len plus the block size, or 0 at the
+  // end of the file, when the previous block is left untouched
+  int64_t next_block(const char* tail, int64_t tail_len, char*& data);
+  bool seek(uint64_t offset); // discard the reads in flight and start reading at offset
+
+protected:
+  struct uring;       // io_uring rings (defined in uring_reader.cpp)
+  struct slot {
+    char* mem;        // allocated buffer: room, block_size bytes, and 2 spare bytes
+    int64_t room;     // bytes in front of the block, for the tail of the previous one
+    char* buf;        // page-aligned start of the block, mem + room
+    uint64_t off;     // file offset of the block
+    int64_t want;     // size of the block, 0 if the buffer is idle
+    int64_t got;      // bytes read so far
+    bool done;        // true if the read is complete
+  };
+  uring* ring;
+  std::vector<slot> slots;
+  uint64_t next_off;  // file offset of the next block to submit
+  int32_t cur;        // slot handed out by the last next_block() call, -1 if none
+  int32_t head;       // slot of the next block
+
+  void issue(int32_t i);  // assign the next block to slot i and submit its read
+  bool submit(int32_t i); // submit a read for the rest of slot i
+  void reap(bool wait);   // process completions, waiting for at least one if wait is set
+  void drain();           // wait for all reads in flight
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include "qgenlib/dataframe.h"
+
+#include <cstdio>
+#include <string>
+
+// a string column whose 65,537th distinct value arrives while it is still
+// dictionary-encoded switches to arena offsets in the middle of load()
+static bool test_many_distinct_strings(const char* tsvfile) {
+  const int32_t nrep = 10, nuniq = 70000;
+  FILE* fp = fopen(tsvfile, "w");
+  if ( fp == NULL ) {
+    fprintf(stderr, "Cannot write %s\n", tsvfile);
+    return false;
+  }
+  fprintf(fp, "id\n");
+  for(int32_t i=0; i < nrep; ++i)
+    fprintf(fp, "x\n");
+  for(int32_t i=0; i < nuniq; ++i)
+    fprintf(fp, "id%d\n", i);
+  fclose(fp);
+
+  dataframe_load_opts_t opts;
+  opts.infer_types = false;
+  dataframe_t df;
+  df.load(tsvfile, opts);
+  remove(tsvfile);
+
+  if ( df.nrows != nrep + nuniq ) {
+    fprintf(stderr, "Expected %d rows, observed %d\n", nrep + nuniq, df.nrows);
+    return false;
+  }
+  for(int32_t i=0; i < df.nrows; ++i) {
+    std::string expected = ( i < nrep ) ? std::string("x") : "id" + std::to_string(i - nrep);
+    if ( df.get_str_elem(i, 0) != expected ) {
+      fprintf(stderr, "Row %d is %s, not %s\n", i, df.get_str_elem(i, 0).c_str(), expected.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+// a value rejected by set() leaves the column unchanged, even if it was parsed
+static bool test_set_rejected(const char* tsvfile) {
+  FILE* fp = fopen(tsvfile, "w");
+  if ( fp == NULL ) {
+    fprintf(stderr, "Cannot write %s\n", tsvfile);
+    return false;
+  }
+  fprintf(fp, "i\td\n7\t2.5\n");
+  fclose(fp);
+  dataframe_t df(tsvfile);
+  remove(tsvfile);
+
+  df.columns[0].set(0, "-0", "-0" + 2, df.arena);
+  df.columns[1].set(0, "1.50", "1.50" + 4, df.arena);
+  if ( ( df.get_str_elem(0, 0) != "7" ) || ( df.get_str_elem(0, 1) != "2.5" ) ) {
+    fprintf(stderr, "Rejected values changed the row to %s %s\n", df.get_str_elem(0, 0).c_str(), df.get_str_elem(0, 1).c_str());
+    return false;
+  }
+  return true;
+}
+
+int32_t main() {
+  int32_t nfailed = 0;
+  if ( !test_many_distinct_strings("test_dataframe.many_distinct.tsv") ) {
+    fprintf(stderr, "FAILED: test_many_distinct_strings\n");
+    ++nfailed;
+  }
+  if ( !test_set_rejected("test_dataframe.set_rejected.tsv") ) {
+    fprintf(stderr, "FAILED: test_set_rejected\n");
+    ++nfailed;
+  }
+  return nfailed > 0 ? 1 : 0;
+}
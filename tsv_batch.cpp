@@ -0,0 +1,66 @@
+/* The MIT License
+
+   Copyright (c) 2016-2022 Hyun Min Kang <hmkang@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "qgenlib/tsv_batch.h"
+
+#include <climits>
+
+char* tsv_batch::append_line(const char* s, int32_t len) {
+  size_t beg = buf.size();
+  if ( beg + len + 1 > (size_t)INT_MAX )
+    error("[E:%s:%d %s] A batch cannot hold more than %d bytes", __FILE__, __LINE__, __FUNCTION__, INT_MAX);
+  buf.insert(buf.end(), s, s + len);
+  buf.push_back('\0');
+  line_offsets.push_back((int32_t)beg);
+  return buf.data() + beg;
+}
+
+void tsv_batch::add_row(int32_t nf, const int32_t* field_offsets, const int32_t* field_ends, const std::vector<int32_t>* cols) {
+  int32_t base = line_offsets.back();
+  int32_t width = ( cols != NULL ) ? (int32_t)cols->size() : nf;
+  if ( ( nlines == 0 ) && ( cols != NULL ) )
+    ncols = width;
+  if ( width > ncols ) { // widen the matrices, padding the previous lines with absent fields
+    std::vector<int32_t> o((size_t)nlines * width, -1), e((size_t)nlines * width, -1);
+    for(int32_t i=0; i < nlines; ++i) {
+      memcpy(&o[(size_t)i * width], &offsets[(size_t)i * ncols], sizeof(int32_t) * ncols);
+      memcpy(&e[(size_t)i * width], &ends[(size_t)i * ncols], sizeof(int32_t) * ncols);
+    }
+    offsets.swap(o);
+    ends.swap(e);
+    ncols = width;
+  }
+  offsets.resize((size_t)( nlines + 1 ) * ncols, -1);
+  ends.resize((size_t)( nlines + 1 ) * ncols, -1);
+  int32_t* o = &offsets[(size_t)nlines * ncols];
+  int32_t* e = &ends[(size_t)nlines * ncols];
+  for(int32_t i=0; i < width; ++i) {
+    int32_t c = ( cols != NULL ) ? (*cols)[i] : i;
+    if ( c < nf ) {
+      o[i] = base + field_offsets[c];
+      e[i] = base + field_ends[c];
+    }
+  }
+  nfields.push_back(nf);
+  ++nlines;
+}
@@ -0,0 +1,158 @@
+/* The MIT License
+
+   Copyright (c) 2016-2022 Hyun Min Kang <hmkang@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+
+#include "qgenlib/tsv_checkpoint.h"
+#include "qgenlib/qgen_error.h"
+#include "qgenlib/qgen_utils.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TSV_CHECKPOINT_MAGIC "TCKP\1"
+#define TSV_CHECKPOINT_MAGIC_LEN 5
+
+static bool write_str(FILE* fp, const std::string& s) {
+  uint64_t n = s.size();
+  return ( fwrite(&n, sizeof(uint64_t), 1, fp) == 1 ) && ( fwrite(s.data(), 1, n, fp) == n );
+}
+
+// bytes between the position of fp and the end of the file, to check the lengths read from it
+static uint64_t bytes_left(FILE* fp) {
+  struct stat st;
+  off_t pos = ftello(fp);
+  if ( ( pos < 0 ) || ( fstat(fileno(fp), &st) != 0 ) || ( st.st_size < pos ) )
+    return 0;
+  return (uint64_t)( st.st_size - pos );
+}
+
+static bool read_str(FILE* fp, std::string& s) {
+  uint64_t n;
+  if ( ( fread(&n, sizeof(uint64_t), 1, fp) != 1 ) || ( n > bytes_left(fp) ) ) // truncated or corrupt
+    return false;
+  s.resize(n);
+  return ( n == 0 ) || ( fread(&s[0], 1, n, fp) == n );
+}
+
+static bool write_strs(FILE* fp, const std::vector<std::string>& v) {
+  uint64_t n = v.size();
+  if ( fwrite(&n, sizeof(uint64_t), 1, fp) != 1 )
+    return false;
+  for(uint64_t i=0; i < n; ++i)
+    if ( !write_str(fp, v[i]) ) return false;
+  return true;
+}
+
+static bool read_strs(FILE* fp, std::vector<std::string>& v) {
+  uint64_t n;
+  if ( ( fread(&n, sizeof(uint64_t), 1, fp) != 1 ) || ( n > bytes_left(fp) / sizeof(uint64_t) ) ) // each string has a length
+    return false;
+  v.resize(n);
+  for(uint64_t i=0; i < n; ++i)
+    if ( !read_str(fp, v[i]) ) return false;
+  return true;
+}
+
+bool tsv_checkpoint::save(const char* fn) const {
+  std::string tmp = std::string(fn) + ".tmp";
+  FILE* fp = fopen(tmp.c_str(), "wb");
+  if ( fp == NULL ) {
+    warning("[%s:%d %s] Cannot open %s for writing", __FILE__, __LINE__, __FUNCTION__, tmp.c_str());
+    return false;
+  }
+  int32_t flags = bgzf ? 1 : 0;
+  bool ok = ( fwrite(TSV_CHECKPOINT_MAGIC, 1, TSV_CHECKPOINT_MAGIC_LEN, fp) == TSV_CHECKPOINT_MAGIC_LEN ) &&
+    write_str(fp, filename) &&
+    ( fwrite(&file_size, sizeof(uint64_t), 1, fp) == 1 ) &&
+    ( fwrite(&flags, sizeof(int32_t), 1, fp) == 1 ) &&
+    ( fwrite(&offset, sizeof(int64_t), 1, fp) == 1 ) &&
+    ( fwrite(&skip, sizeof(uint64_t), 1, fp) == 1 ) &&
+    ( fwrite(&uoffset, sizeof(uint64_t), 1, fp) == 1 ) &&
+    ( fwrite(&nlines, sizeof(uint64_t), 1, fp) == 1 ) &&
+    ( fwrite(&range_end, sizeof(int64_t), 1, fp) == 1 ) &&
+    write_strs(fp, headers) &&
+    write_strs(fp, columns) &&
+    write_str(fp, state);
+  // the data must reach the disk before the rename does, or a crash could leave a renamed but empty file
+  ok = ok && ( fflush(fp) == 0 ) && ( fsync(fileno(fp)) == 0 );
+  if ( ( fclose(fp) != 0 ) || !ok ) {
+    warning("[%s:%d %s] Error while writing %s", __FILE__, __LINE__, __FUNCTION__, tmp.c_str());
+    remove(tmp.c_str());
+    return false;
+  }
+  if ( rename(tmp.c_str(), fn) != 0 ) {
+    warning("[%s:%d %s] Cannot rename %s to %s", __FILE__, __LINE__, __FUNCTION__, tmp.c_str(), fn);
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool tsv_checkpoint::load(const char* fn) {
+  FILE* fp = fopen(fn, "rb");
+  if ( fp == NULL )
+    return false;
+  char magic[TSV_CHECKPOINT_MAGIC_LEN];
+  int32_t flags = 0;
+  bool ok = ( fread(magic, 1, TSV_CHECKPOINT_MAGIC_LEN, fp) == TSV_CHECKPOINT_MAGIC_LEN ) &&
+    ( memcmp(magic, TSV_CHECKPOINT_MAGIC, TSV_CHECKPOINT_MAGIC_LEN) == 0 ) &&
+    read_str(fp, filename) &&
+    ( fread(&file_size, sizeof(uint64_t), 1, fp) == 1 ) &&
+    ( fread(&flags, sizeof(int32_t), 1, fp) == 1 ) &&
+    ( fread(&offset, sizeof(int64_t), 1, fp) == 1 ) &&
+    ( fread(&skip, sizeof(uint64_t), 1, fp) == 1 ) &&
+    ( fread(&uoffset, sizeof(uint64_t), 1, fp) == 1 ) &&
+    ( fread(&nlines, sizeof(uint64_t), 1, fp) == 1 ) &&
+    ( fread(&range_end, sizeof(int64_t), 1, fp) == 1 ) &&
+    read_strs(fp, headers) &&
+    read_strs(fp, columns) &&
+    read_str(fp, state);
+  fclose(fp);
+  if ( !ok ) {
+    warning("[%s:%d %s] %s is not a valid checkpoint", __FILE__, __LINE__, __FUNCTION__, fn);
+    return false;
+  }
+  bgzf = ( flags & 1 ) != 0;
+  return true;
+}
+
+bool tsv_checkpoint::set_file(const char* _filename) {
+  filename = _filename;
+  return get_file_size(_filename, file_size);
+}
+
+bool tsv_checkpoint::matches(const char* _filename) const {
+  uint64_t size;
+  return get_file_size(_filename, size) && ( size == file_size );
+}
+
+tsv_checkpoint_hook_t tsv_checkpoint::save_hook(const char* fn, const tsv_checkpoint_hook_t& fill_state) {
+  std::string path(fn);
+  return [path, fill_state](tsv_checkpoint& cp) {
+    if ( fill_state ) fill_state(cp);
+    if ( !cp.save(path.c_str()) )
+      warning("[%s:%d %s] Failed to save a checkpoint at line %llu of %s", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)cp.nlines, cp.filename.c_str());
+  };
+}
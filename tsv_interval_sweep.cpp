@@ -0,0 +1,343 @@
+/* The MIT License
+
+   Copyright (c) 2016-2022 Hyun Min Kang <hmkang@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+
+#include "qgenlib/tsv_interval_sweep.h"
+
+tsv_interval_sweep::tsv_interval_sweep(const char* a_filename, const char* b_filename, int32_t threads) :
+  a_chrom_col(0), a_beg_col(1), a_end_col(2), b_chrom_col(0), b_beg_col(1), b_end_col(2),
+  zero_based(true), comment_char('#'), order_known(false), nlines_a(0), nlines_b(0), a_tid(-1), a_beg(0), a_end(0),
+  upstream(NULL), b_pending(false), b_tid(-1), b_beg(0), b_end(0), b_nfields_max(0),
+  last_a_tid(-1), last_b_tid(-1), primed(false) {
+  if ( !a.open(a_filename, threads) )
+    error("[E:%s:%d %s] Cannot open file %s for reading", __FILE__, __LINE__, __FUNCTION__, a_filename);
+  if ( !b.open(b_filename, threads) )
+    error("[E:%s:%d %s] Cannot open file %s for reading", __FILE__, __LINE__, __FUNCTION__, b_filename);
+  a.delimiter = b.delimiter = '\t';
+}
+
+tsv_interval_sweep::~tsv_interval_sweep() {
+  a.close();
+  b.close();
+  for(size_t i=0; i < window.size(); ++i) delete window[i];
+  for(size_t i=0; i < pool.size(); ++i) delete pool[i];
+  if ( upstream != NULL ) delete upstream;
+}
+
+void tsv_interval_sweep::set_contig_order(const std::vector<std::string>& contigs) {
+  if ( primed )
+    error("[E:%s:%d %s] The contig order must be set before reading", __FILE__, __LINE__, __FUNCTION__);
+  contig2id.clear();
+  for(int32_t i=0; i < (int32_t)contigs.size(); ++i) {
+    if ( !contig2id.insert(std::make_pair(contigs[i], (int32_t)contig2id.size())).second )
+      error("[E:%s:%d %s] Contig %s appears twice in the contig order", __FILE__, __LINE__, __FUNCTION__, contigs[i].c_str());
+  }
+  order_known = true;
+}
+
+// The sequence names of a tabix index are listed in file order.
+bool tsv_interval_sweep::load_index_order() {
+  tsv_reader* readers[2] = { &a, &b };
+  for(int32_t i=0; i < 2; ++i) {
+    tbx_t* idx = readers[i]->tbx;
+    bool own = ( idx == NULL );
+    if ( own )
+      idx = tbx_index_load3(readers[i]->filename.c_str(), NULL, HTS_IDX_SILENT_FAIL);
+    if ( idx == NULL ) continue;
+    int32_t n = 0;
+    const char** names = tbx_seqnames(idx, &n);
+    std::vector<std::string> contigs;
+    for(int32_t j=0; j < n; ++j)
+      contigs.push_back(names[j]);
+    free(names);
+    if ( own ) tbx_destroy(idx);
+    if ( !contigs.empty() ) {
+      set_contig_order(contigs);
+      return true;
+    }
+  }
+  return false;
+}
+
+int32_t tsv_interval_sweep::contig_to_id(const char* s, int32_t len, bool add) {
+  std::string name(s, len);
+  std::map<std::string,int32_t>::iterator it = contig2id.find(name);
+  if ( it != contig2id.end() )
+    return it->second;
+  if ( !add )
+    return TSV_SWEEP_UNSEEN_CONTIG;
+  int32_t id = (int32_t)contig2id.size();
+  contig2id[name] = id;
+  return id;
+}
+
+bool tsv_interval_sweep::read_record(tsv_reader& tr, int32_t chrom_col, int32_t beg_col, int32_t end_col, bool add_contig,
+                                     std::string& last_contig, int32_t& last_tid, int32_t& tid, int64_t& beg, int64_t& end, bool& new_contig) {
+  int32_t nf;
+  while( ( nf = tr.read_line() ) > 0 ) {
+    if ( ( comment_char == 0 ) || ( tr.str_field_at(0)[0] != comment_char ) )
+      break;
+  }
+  if ( nf <= 0 )
+    return false;
+  if ( ( chrom_col >= nf ) || ( beg_col >= nf ) || ( end_col >= nf ) )
+    error("[E:%s:%d %s] Line %llu of %s has only %d fields", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)tr.nlines, tr.filename.c_str(), nf);
+
+  int32_t len;
+  const char* chr = tr.str_field_view(chrom_col, &len);
+  new_contig = ( last_tid < 0 ) || ( (int32_t)last_contig.size() != len ) || ( memcmp(last_contig.data(), chr, len) != 0 );
+  if ( new_contig ) {
+    last_contig.assign(chr, len);
+    last_tid = contig_to_id(chr, len, add_contig);
+  }
+  tid = last_tid;
+  if ( !tr.int64_field_at(beg_col, beg) || ( ( end_col >= 0 ) && !tr.int64_field_at(end_col, end) ) )
+    error("[E:%s:%d %s] Invalid position at line %llu of %s", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)tr.nlines, tr.filename.c_str());
+  if ( end_col < 0 ) // a single base
+    end = zero_based ? beg + 1 : beg;
+  if ( !zero_based ) // 1-based and closed
+    --beg;
+  return true;
+}
+
+void tsv_interval_sweep::advance_b() {
+  int32_t prev_tid = b_tid;
+  int64_t prev_beg = b_beg;
+  bool new_contig;
+  // without a known order, B contigs are numbered by A only
+  b_pending = read_record(b, b_chrom_col, b_beg_col, b_end_col, order_known, last_b_contig, last_b_tid, b_tid, b_beg, b_end, new_contig);
+  if ( !b_pending )
+    return;
+  bool unsorted = new_contig ? ( ( b_tid <= prev_tid ) && ( b_tid != TSV_SWEEP_UNSEEN_CONTIG ) ) : ( b_beg < prev_beg );
+  if ( ( nlines_b > 0 ) && unsorted )
+    error("[E:%s:%d %s] %s is not sorted at line %llu (%s); if it is, set the contig order explicitly", __FILE__, __LINE__, __FUNCTION__, b.filename.c_str(), (unsigned long long)b.nlines, last_b_contig.c_str());
+  if ( b.nfields > b_nfields_max )
+    b_nfields_max = b.nfields;
+  ++nlines_b;
+}
+
+sweep_interval* tsv_interval_sweep::take_pending() {
+  sweep_interval* iv;
+  if ( pool.empty() )
+    iv = new sweep_interval;
+  else {
+    iv = pool.back();
+    pool.pop_back();
+  }
+  iv->tid = b_tid;
+  iv->beg = b_beg;
+  iv->end = b_end;
+  iv->line.clear();
+  iv->offsets.clear();
+  for(int32_t i=0; i < b.nfields; ++i) {
+    int32_t len;
+    const char* p = b.str_field_view(i, &len);
+    if ( i > 0 ) iv->line.push_back('\t');
+    iv->offsets.push_back((int32_t)iv->line.size());
+    iv->line.append(p, len);
+  }
+  iv->offsets.push_back((int32_t)iv->line.size() + 1);
+  advance_b();
+  return iv;
+}
+
+void tsv_interval_sweep::release(sweep_interval* iv) {
+  pool.push_back(iv);
+}
+
+// The window holds the B intervals that started before the end of some A
+// record and may still overlap later ones, in file order. A records start in
+// increasing order, so an interval ending before the current start is dropped
+// for good; the one reaching furthest is kept aside for closest().
+bool tsv_interval_sweep::next() {
+  if ( !primed ) {
+    if ( !order_known )
+      load_index_order();
+    advance_b();
+    primed = true;
+  }
+  int32_t tid;
+  int64_t beg, end;
+  bool new_contig;
+  hits.clear();
+  if ( !read_record(a, a_chrom_col, a_beg_col, a_end_col, true, last_a_contig, last_a_tid, tid, beg, end, new_contig) )
+    return false;
+  if ( new_contig && b_pending && ( b_tid == TSV_SWEEP_UNSEEN_CONTIG ) ) // A may have reached the contig of B
+    b_tid = last_b_tid = contig_to_id(last_b_contig.data(), (int32_t)last_b_contig.size(), false);
+  if ( ( nlines_a > 0 ) && ( ( tid < a_tid ) || ( ( tid == a_tid ) && ( beg < a_beg ) ) ) )
+    error("[E:%s:%d %s] %s is not sorted at line %llu (%s); if it is, set the contig order explicitly", __FILE__, __LINE__, __FUNCTION__, a.filename.c_str(), (unsigned long long)a.nlines, last_a_contig.c_str());
+  if ( ( tid != a_tid ) && ( upstream != NULL ) ) {
+    release(upstream);
+    upstream = NULL;
+  }
+  a_tid = tid;
+  a_beg = beg;
+  a_end = end;
+  ++nlines_a;
+
+  // read the B intervals starting before the end of A; those on earlier contigs overlap nothing
+  while( b_pending && ( ( b_tid < a_tid ) || ( ( b_tid == a_tid ) && ( b_beg < a_end ) ) ) ) {
+    if ( b_tid < a_tid )
+      advance_b();
+    else
+      window.push_back(take_pending());
+  }
+
+  size_t j = 0;
+  for(size_t i=0; i < window.size(); ++i) {
+    sweep_interval* iv = window[i];
+    if ( ( iv->tid < a_tid ) || ( iv->end <= a_beg ) ) {
+      if ( ( iv->tid == a_tid ) && ( ( upstream == NULL ) || ( iv->end > upstream->end ) ) ) {
+        if ( upstream != NULL ) release(upstream);
+        upstream = iv;
+      }
+      else
+        release(iv);
+      continue;
+    }
+    window[j++] = iv;
+    if ( iv->beg < a_end )
+      hits.push_back(iv);
+  }
+  window.resize(j);
+  return true;
+}
+
+void tsv_interval_sweep::subtract(std::vector<std::pair<int64_t,int64_t> >& parts) const {
+  parts.clear();
+  int64_t cur = a_beg;
+  for(size_t i=0; i < hits.size(); ++i) {
+    if ( hits[i]->beg > cur )
+      parts.push_back(std::make_pair(cur, hits[i]->beg < a_end ? hits[i]->beg : a_end));
+    if ( hits[i]->end > cur )
+      cur = hits[i]->end;
+  }
+  if ( cur < a_end )
+    parts.push_back(std::make_pair(cur, a_end));
+}
+
+const sweep_interval* tsv_interval_sweep::closest(int64_t* dist) {
+  if ( !hits.empty() ) {
+    if ( dist != NULL ) *dist = 0;
+    return hits[0];
+  }
+  // the nearest downstream interval is the first of the window starting after A,
+  // or else the pending record, which then joins the window
+  const sweep_interval* down = NULL;
+  for(size_t i=0; i < window.size(); ++i) {
+    if ( window[i]->beg >= a_end ) {
+      down = window[i];
+      break;
+    }
+  }
+  if ( ( down == NULL ) && b_pending && ( b_tid == a_tid ) ) {
+    window.push_back(take_pending());
+    down = window.back();
+  }
+  if ( ( upstream != NULL ) && ( ( down == NULL ) || ( a_beg - upstream->end <= down->beg - a_end ) ) ) {
+    if ( dist != NULL ) *dist = upstream->end - a_beg;
+    return upstream;
+  }
+  if ( dist != NULL ) *dist = ( down != NULL ) ? down->beg - a_end : 0;
+  return down;
+}
+
+void tsv_interval_sweep::put_a_fields(tsv_writer& out, int64_t beg, int64_t end) {
+  for(int32_t i=0; i < a.nfields; ++i) {
+    if ( ( beg >= 0 ) && ( i == a_beg_col ) )
+      out.put_int(zero_based ? beg : beg + 1);
+    else if ( ( beg >= 0 ) && ( i == a_end_col ) )
+      out.put_int(end);
+    else {
+      int32_t len;
+      const char* p = a.str_field_view(i, &len);
+      out.put_str(p, len);
+    }
+  }
+}
+
+uint64_t tsv_interval_sweep::write_intersect(tsv_writer& out) {
+  uint64_t n = 0;
+  while( next() ) {
+    for(size_t i=0; i < hits.size(); ++i) {
+      put_a_fields(out, -1, -1);
+      out.put_str(hits[i]->line);
+      out.end_line();
+      ++n;
+    }
+  }
+  return n;
+}
+
+uint64_t tsv_interval_sweep::write_count(tsv_writer& out) {
+  uint64_t n = 0;
+  while( next() ) {
+    put_a_fields(out, -1, -1);
+    out.put_uint(hits.size());
+    out.end_line();
+    ++n;
+  }
+  return n;
+}
+
+uint64_t tsv_interval_sweep::write_subtract(tsv_writer& out, bool whole) {
+  uint64_t n = 0;
+  std::vector<std::pair<int64_t,int64_t> > parts;
+  while( next() ) {
+    if ( hits.empty() ) {
+      put_a_fields(out, -1, -1);
+      out.end_line();
+      ++n;
+    }
+    else if ( !whole ) {
+      subtract(parts);
+      for(size_t i=0; i < parts.size(); ++i) {
+        put_a_fields(out, parts[i].first, parts[i].second);
+        out.end_line();
+        ++n;
+      }
+    }
+  }
+  return n;
+}
+
+uint64_t tsv_interval_sweep::write_closest(tsv_writer& out) {
+  uint64_t n = 0;
+  while( next() ) {
+    int64_t dist;
+    const sweep_interval* iv = closest(&dist);
+    put_a_fields(out, -1, -1);
+    if ( iv != NULL ) {
+      out.put_str(iv->line);
+      out.put_int(dist);
+    }
+    else {
+      for(int32_t i=0; i < ( b_nfields_max > 0 ? b_nfields_max : 1 ); ++i)
+        out.put_str(".", 1);
+      out.put_str(".", 1);
+    }
+    out.end_line();
+    ++n;
+  }
+  return n;
+}
@@ -0,0 +1,198 @@
+/* The MIT License
+
+   Copyright (c) 2016-2022 Hyun Min Kang <hmkang@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+
+#include "qgenlib/tsv_line_index.h"
+#include "qgenlib/qgen_error.h"
+#include "qgenlib/qgen_utils.h"
+
+extern "C" {
+#include "htslib/bgzf.h"
+#include "htslib/thread_pool.h"
+}
+
+#include <cstring>
+
+#define TSV_LINE_INDEX_MAGIC "LIDX\1"
+#define TSV_LINE_INDEX_MAGIC_LEN 5
+
+// Lines are found with memchr() in each decompressed block, so that the
+// virtual offset of a line is simply the block address and the position of
+// the line within the block.
+bool tsv_line_index::build(const char* _filename, int32_t _interval, int32_t threads) {
+  if ( _interval <= 0 )
+    error("[E:%s:%d %s] Invalid interval %d", __FILE__, __LINE__, __FUNCTION__, _interval);
+  filename = _filename;
+  interval = _interval;
+  nlines = 0;
+  offsets.assign(1, 0); // line 0 starts at offset 0
+  uoffsets.assign(1, 0);
+  if ( !get_file_size(_filename, file_size) ) {
+    warning("[%s:%d %s] Cannot access %s", __FILE__, __LINE__, __FUNCTION__, _filename);
+    return false;
+  }
+
+  BGZF* fp = bgzf_open(_filename, "r");
+  if ( fp == NULL ) {
+    warning("[%s:%d %s] Cannot open %s for reading", __FILE__, __LINE__, __FUNCTION__, _filename);
+    return false;
+  }
+  if ( fp->is_gzip ) {
+    warning("[%s:%d %s] Cannot index %s, which is gzipped but not bgzipped", __FILE__, __LINE__, __FUNCTION__, _filename);
+    bgzf_close(fp);
+    return false;
+  }
+  bgzf = fp->is_compressed;
+  hts_tpool* pool = NULL;
+  if ( bgzf && ( threads > 0 ) && ( ( pool = hts_tpool_init(threads) ) != NULL ) ) {
+    if ( bgzf_thread_pool(fp, pool, threads * 2) != 0 )
+      warning("[%s:%d %s] Failed to attach threads, reading %s single-threaded", __FILE__, __LINE__, __FUNCTION__, _filename);
+  }
+
+  bool ok = true;
+  bool at_line_start = true; // the next byte starts a line
+  int64_t ubeg = 0;          // uncompressed offset of the current block
+  int64_t cend = 0;          // compressed offset after the last block read
+  while( true ) {
+    if ( bgzf_read_block(fp) != 0 ) {
+      warning("[%s:%d %s] Error while reading %s", __FILE__, __LINE__, __FUNCTION__, _filename);
+      ok = false;
+      break;
+    }
+    const char* data = (const char*)fp->uncompressed_block;
+    int64_t len = fp->block_length;
+    int64_t addr = fp->block_address;
+    if ( len == 0 ) { // an empty block (such as an EOF marker within concatenated files), or the end of the file
+      bool progress = bgzf && ( addr + fp->block_clength > cend );
+      if ( progress ) cend = addr + fp->block_clength;
+      if ( !progress || ( cend >= (int64_t)file_size ) ) break;
+      continue;
+    }
+    if ( bgzf ) cend = addr + fp->block_clength;
+    int64_t p = 0;
+    while( p < len ) {
+      if ( at_line_start ) {
+        if ( ( nlines > 0 ) && ( nlines % (uint64_t)interval == 0 ) ) {
+          offsets.push_back(bgzf ? ( ( addr << 16 ) | p ) : addr + p);
+          uoffsets.push_back(ubeg + p);
+        }
+        at_line_start = false;
+      }
+      const char* nl = (const char*)memchr(data + p, '\n', len - p);
+      if ( nl == NULL ) break;
+      p = ( nl - data ) + 1;
+      ++nlines;
+      at_line_start = true;
+    }
+    ubeg += len;
+  }
+  if ( !at_line_start ) ++nlines; // last line without a newline
+
+  bgzf_close(fp);
+  if ( pool != NULL ) hts_tpool_destroy(pool);
+  return ok;
+}
+
+bool tsv_line_index::save(const char* index_fn) const {
+  std::string fn = ( index_fn != NULL ) ? std::string(index_fn) : filename + TSV_LINE_INDEX_SUFFIX;
+  FILE* fp = fopen(fn.c_str(), "wb");
+  if ( fp == NULL ) {
+    warning("[%s:%d %s] Cannot open %s for writing", __FILE__, __LINE__, __FUNCTION__, fn.c_str());
+    return false;
+  }
+  uint64_t n = offsets.size();
+  int32_t flags = bgzf ? 1 : 0;
+  bool ok = ( fwrite(TSV_LINE_INDEX_MAGIC, 1, TSV_LINE_INDEX_MAGIC_LEN, fp) == TSV_LINE_INDEX_MAGIC_LEN ) &&
+    ( fwrite(&interval, sizeof(int32_t), 1, fp) == 1 ) &&
+    ( fwrite(&flags, sizeof(int32_t), 1, fp) == 1 ) &&
+    ( fwrite(&nlines, sizeof(uint64_t), 1, fp) == 1 ) &&
+    ( fwrite(&file_size, sizeof(uint64_t), 1, fp) == 1 ) &&
+    ( fwrite(&n, sizeof(uint64_t), 1, fp) == 1 ) &&
+    ( fwrite(offsets.data(), sizeof(int64_t), n, fp) == n ) &&
+    ( fwrite(uoffsets.data(), sizeof(int64_t), n, fp) == n );
+  if ( ( fclose(fp) != 0 ) || !ok ) {
+    warning("[%s:%d %s] Error while writing %s", __FILE__, __LINE__, __FUNCTION__, fn.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool tsv_line_index::load(const char* _filename, const char* index_fn) {
+  filename = _filename;
+  std::string fn = ( index_fn != NULL ) ? std::string(index_fn) : filename + TSV_LINE_INDEX_SUFFIX;
+  FILE* fp = fopen(fn.c_str(), "rb");
+  if ( fp == NULL )
+    return false;
+  char magic[TSV_LINE_INDEX_MAGIC_LEN];
+  int32_t flags = 0;
+  uint64_t n = 0;
+  bool ok = ( fread(magic, 1, TSV_LINE_INDEX_MAGIC_LEN, fp) == TSV_LINE_INDEX_MAGIC_LEN ) &&
+    ( memcmp(magic, TSV_LINE_INDEX_MAGIC, TSV_LINE_INDEX_MAGIC_LEN) == 0 ) &&
+    ( fread(&interval, sizeof(int32_t), 1, fp) == 1 ) && ( interval > 0 ) &&
+    ( fread(&flags, sizeof(int32_t), 1, fp) == 1 ) &&
+    ( fread(&nlines, sizeof(uint64_t), 1, fp) == 1 ) &&
+    ( fread(&file_size, sizeof(uint64_t), 1, fp) == 1 ) &&
+    ( fread(&n, sizeof(uint64_t), 1, fp) == 1 ) && ( n > 0 ) &&
+    ( n == ( nlines + interval - 1 ) / (uint64_t)interval + ( nlines == 0 ? 1 : 0 ) );
+  if ( ok ) {
+    offsets.resize(n);
+    uoffsets.resize(n);
+    ok = ( fread(offsets.data(), sizeof(int64_t), n, fp) == n ) &&
+      ( fread(uoffsets.data(), sizeof(int64_t), n, fp) == n );
+  }
+  fclose(fp);
+  if ( !ok ) {
+    warning("[%s:%d %s] %s is not a valid line index", __FILE__, __LINE__, __FUNCTION__, fn.c_str());
+    return false;
+  }
+  bgzf = ( flags & 1 ) != 0;
+
+  uint64_t size;
+  if ( !get_file_size(_filename, size) || ( size != file_size ) ) {
+    warning("[%s:%d %s] Line index %s does not match %s, which may have been modified", __FILE__, __LINE__, __FUNCTION__, fn.c_str(), _filename);
+    return false;
+  }
+  return true;
+}
+
+bool tsv_line_index::load_or_build(const char* _filename, int32_t _interval, int32_t threads) {
+  if ( load(_filename) )
+    return true;
+  if ( !build(_filename, _interval, threads) )
+    return false;
+  if ( !save() )
+    warning("[%s:%d %s] Could not save the line index of %s", __FILE__, __LINE__, __FUNCTION__, _filename);
+  return true;
+}
+
+void tsv_line_index::partition(int32_t nparts, std::vector<tsv_line_range>& parts) const {
+  parts.clear();
+  if ( nparts <= 0 ) nparts = 1;
+  if ( (uint64_t)nparts > nlines ) nparts = ( nlines > 0 ) ? (int32_t)nlines : 1;
+  uint64_t beg = 0;
+  for(int32_t i=1; i <= nparts; ++i) {
+    uint64_t end = nlines / nparts * i + nlines % nparts * i / nparts;
+    parts.push_back(tsv_line_range(beg, end));
+    beg = end;
+  }
+}
@@ -0,0 +1,177 @@
+/* The MIT License
+
+   Copyright (c) 2016-2022 Hyun Min Kang <hmkang@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+
+#include "qgenlib/tsv_merge_reader.h"
+
+#include <algorithm>
+
+tsv_merge_reader::tsv_merge_reader(const std::vector<std::string>& _filenames, int32_t _chrom_col, int32_t _pos_col, int32_t threads) :
+  filenames(_filenames), chrom_col(_chrom_col), pos_col(_pos_col), delimiter(0), comment_char('#'), nlines(0),
+  isource(-1), cur_tid(-1), cur_pos(0), primed(false), tpool(NULL) {
+  if ( filenames.empty() )
+    error("[E:%s:%d %s] No files to merge", __FILE__, __LINE__, __FUNCTION__);
+  if ( threads > 0 ) {
+    tpool = hts_tpool_init(threads);
+    if ( tpool == NULL )
+      warning("[%s:%d %s] Failed to create a pool of %d threads, reading single-threaded", __FILE__, __LINE__, __FUNCTION__, threads);
+  }
+  readers.resize(filenames.size(), NULL);
+  for(int32_t i=0; i < (int32_t)filenames.size(); ++i) {
+    readers[i] = new tsv_reader(filenames[i].c_str());
+    if ( tpool != NULL )
+      readers[i]->set_thread_pool(tpool); // ignored for files that are not bgzipped
+  }
+  last_keys.resize(filenames.size());
+  last_contigs.resize(filenames.size());
+  heap.reserve(filenames.size());
+}
+
+tsv_merge_reader::~tsv_merge_reader() {
+  close();
+}
+
+void tsv_merge_reader::close() {
+  for(int32_t i=0; i < (int32_t)readers.size(); ++i) {
+    if ( readers[i] != NULL ) {
+      readers[i]->close();
+      if ( readers[i]->tbx != NULL ) tbx_destroy(readers[i]->tbx);
+      delete readers[i];
+      readers[i] = NULL;
+    }
+  }
+  readers.clear();
+  heap.clear();
+  isource = -1;
+  if ( tpool != NULL ) { // the pool must be destroyed after the files are closed
+    hts_tpool_destroy(tpool);
+    tpool = NULL;
+  }
+}
+
+void tsv_merge_reader::set_contig_order(const std::vector<std::string>& contigs) {
+  if ( primed )
+    error("[E:%s:%d %s] The contig order must be set before reading", __FILE__, __LINE__, __FUNCTION__);
+  contig2id.clear();
+  for(int32_t i=0; i < (int32_t)contigs.size(); ++i) {
+    if ( !contig2id.insert(std::make_pair(contigs[i], (int32_t)contig2id.size())).second )
+      error("[E:%s:%d %s] Contig %s appears twice in the contig order", __FILE__, __LINE__, __FUNCTION__, contigs[i].c_str());
+  }
+}
+
+int32_t tsv_merge_reader::contig_to_id(const char* s, int32_t len) {
+  std::string name(s, len);
+  std::map<std::string,int32_t>::iterator it = contig2id.find(name);
+  if ( it != contig2id.end() )
+    return it->second;
+  int32_t id = (int32_t)contig2id.size();
+  contig2id[name] = id;
+  return id;
+}
+
+// The contig name is only looked up when it differs from the previous line
+// of the same source, so that sorted files cost one comparison per line.
+bool tsv_merge_reader::advance(int32_t src) {
+  tsv_reader* tr = readers[src];
+  int32_t nf;
+  while( ( nf = tr->read_line() ) > 0 ) {
+    if ( ( comment_char == 0 ) || ( tr->str_field_at(0)[0] != comment_char ) )
+      break;
+  }
+  if ( nf <= 0 )
+    return false;
+  if ( ( chrom_col >= nf ) || ( pos_col >= nf ) )
+    error("[E:%s:%d %s] Line %llu of %s has %d fields, fewer than needed for the contig (%d) and position (%d) columns", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)tr->nlines, filenames[src].c_str(), nf, chrom_col+1, pos_col+1);
+
+  int32_t len;
+  const char* chr = tr->str_field_view(chrom_col, &len);
+  merge_key& key = last_keys[src];
+  merge_key prev = key;
+  std::string& last = last_contigs[src];
+  if ( ( key.tid < 0 ) || ( (int32_t)last.size() != len ) || ( memcmp(last.data(), chr, len) != 0 ) ) {
+    last.assign(chr, len);
+    key.tid = contig_to_id(chr, len);
+  }
+  key.pos = tr->int64_field_at(pos_col);
+  key.src = src;
+  if ( ( prev.tid >= 0 ) && ( ( key.tid < prev.tid ) || ( ( key.tid == prev.tid ) && ( key.pos < prev.pos ) ) ) )
+    error("[E:%s:%d %s] %s is not sorted at line %llu (%s:%lld); if the files are sorted, set the contig order explicitly", __FILE__, __LINE__, __FUNCTION__, filenames[src].c_str(), (unsigned long long)tr->nlines, last.c_str(), (long long)key.pos);
+
+  heap.push_back(key);
+  std::push_heap(heap.begin(), heap.end());
+  return true;
+}
+
+void tsv_merge_reader::prime() {
+  heap.clear();
+  for(int32_t i=0; i < (int32_t)readers.size(); ++i) {
+    readers[i]->delimiter = delimiter;
+    last_keys[i].tid = -1;
+    advance(i);
+  }
+  isource = -1;
+  primed = true;
+}
+
+int32_t tsv_merge_reader::read_line() {
+  if ( !primed )
+    prime();
+  else if ( isource >= 0 ) // the line of isource has been consumed
+    advance(isource);
+
+  if ( heap.empty() ) {
+    isource = -1;
+    return 0;
+  }
+  std::pop_heap(heap.begin(), heap.end());
+  const merge_key& top = heap.back();
+  isource = top.src;
+  cur_tid = top.tid;
+  cur_pos = top.pos;
+  heap.pop_back();
+  ++nlines;
+  return readers[isource]->nfields;
+}
+
+// Each file is restricted through jump_to_regions(), which returns no lines
+// for a file whose index lacks the contig, instead of failing.
+bool tsv_merge_reader::jump_to(const char* reg) {
+  std::vector<std::string> regs(1, std::string(reg));
+  bool any = false;
+  heap.clear();
+  for(int32_t i=0; i < (int32_t)readers.size(); ++i) {
+    readers[i]->delimiter = delimiter;
+    if ( readers[i]->jump_to_regions(regs) > 0 ) any = true;
+    last_keys[i].tid = -1;
+    advance(i);
+  }
+  isource = -1;
+  primed = true;
+  return any;
+}
+
+bool tsv_merge_reader::jump_to(const char* chr, int32_t beg, int32_t end) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), ":%d-%d", beg > 0 ? beg : 1, end);
+  return jump_to((std::string(chr) + buf).c_str());
+}
@@ -0,0 +1,199 @@
+/* The MIT License
+
+   Copyright (c) 2016-2022 Hyun Min Kang <hmkang@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "qgenlib/tsv_parallel_scan.h"
+
+#include <thread>
+
+#define BGZF_HEADER_SIZE 18
+#define BGZF_MAX_BLOCK 65536
+
+// returns the size of the BGZF block whose header starts at p, or -1 if p is not a BGZF header
+static inline int32_t bgzf_block_size_at(const uint8_t* p) {
+  if ( ( p[0] == 31 ) && ( p[1] == 139 ) && ( p[2] == 8 ) && ( p[3] & 4 ) &&
+       ( p[10] == 6 ) && ( p[11] == 0 ) && ( p[12] == 'B' ) && ( p[13] == 'C' ) &&
+       ( p[14] == 2 ) && ( p[15] == 0 ) )
+    return ( p[16] | ( p[17] << 8 ) ) + 1;
+  else
+    return -1;
+}
+
+// A block starts within BGZF_MAX_BLOCK bytes of any offset, so two maximal
+// blocks are read to confirm each candidate header by the header that follows it.
+int64_t tsv_parallel_scan::next_bgzf_block(hFILE* fp, int64_t from) {
+  std::vector<uint8_t> buf(2 * BGZF_MAX_BLOCK + BGZF_HEADER_SIZE);
+  if ( hseek(fp, (off_t)from, SEEK_SET) < 0 )
+    return -1;
+  ssize_t n = 0, r;
+  while( ( n < (ssize_t)buf.size() ) && ( ( r = hread(fp, buf.data() + n, buf.size() - n) ) > 0 ) )
+    n += r;
+  bool at_eof = ( n < (ssize_t)buf.size() );
+  for(ssize_t i=0; ( i < BGZF_MAX_BLOCK ) && ( i + BGZF_HEADER_SIZE <= n ); ++i) {
+    int32_t bsize = bgzf_block_size_at(&buf[i]);
+    if ( bsize < BGZF_HEADER_SIZE ) continue;
+    if ( i + bsize + BGZF_HEADER_SIZE <= n ) {
+      if ( bgzf_block_size_at(&buf[i + bsize]) > 0 )
+        return from + i;
+    }
+    else if ( at_eof && ( i + bsize == n ) ) // last block of the file
+      return from + i;
+  }
+  return -1;
+}
+
+bool tsv_parallel_scan::plan() {
+  chunks.clear();
+  int32_t n = ( nchunks > 0 ) ? nchunks : nthreads * 4;
+
+  tsv_reader tr;
+  if ( !tr.open(filename.c_str()) )
+    error("[E:%s:%d %s] Cannot open file %s for reading", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+  enum htsCompression comp = tr.hp->format.compression;
+  tr.close();
+
+  std::vector<int64_t> begs(1, 0);
+  if ( ( n > 1 ) && ( ( comp == no_compression ) || ( comp == bgzf ) ) ) {
+    hFILE* fp = hopen(filename.c_str(), "r");
+    if ( fp == NULL )
+      error("[E:%s:%d %s] Cannot open file %s for reading", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    off_t size = hseek(fp, 0, SEEK_END);
+    int64_t last = 0;
+    for(int32_t i=1; ( size > 0 ) && ( i < n ); ++i) {
+      int64_t off = (int64_t)size * i / n;
+      if ( off <= last ) continue;
+      if ( comp == bgzf ) {
+        off = next_bgzf_block(fp, off);
+        if ( off < 0 ) break;
+        if ( off <= last ) continue;
+        begs.push_back(off << 16);
+      }
+      else {
+        begs.push_back(off);
+      }
+      last = off;
+    }
+    hclose(fp);
+  }
+
+  chunks.resize(begs.size());
+  for(int32_t i=0; i < (int32_t)begs.size(); ++i) {
+    chunks[i].index = i;
+    chunks[i].beg = begs[i];
+    chunks[i].end = ( i + 1 < (int32_t)begs.size() ) ? begs[i+1] : -1;
+  }
+  return true;
+}
+
+uint64_t tsv_parallel_scan::scan_lines(callback_t line_fn, merge_t merge_fn) {
+  return run(true, line_fn, merge_fn);
+}
+
+uint64_t tsv_parallel_scan::scan_batches(callback_t batch_fn, merge_t merge_fn) {
+  return run(false, batch_fn, merge_fn);
+}
+
+void tsv_task_merger::complete(int32_t i) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    completed.push_back(i);
+  }
+  cv.notify_one();
+}
+
+void tsv_task_merger::merge(const std::function<void(int32_t)>& merge_fn) {
+  std::vector<bool> done(ntasks, false);
+  int32_t nmerged = 0, next_ordered = 0;
+  std::unique_lock<std::mutex> lock(mtx);
+  while( nmerged < ntasks ) {
+    cv.wait(lock, [&]() { return !completed.empty(); });
+    std::vector<int32_t> ready;
+    while( !completed.empty() ) {
+      int32_t i = completed.front();
+      completed.pop_front();
+      done[i] = true;
+      if ( !ordered ) ready.push_back(i);
+    }
+    if ( ordered ) {
+      while( ( next_ordered < ntasks ) && done[next_ordered] )
+        ready.push_back(next_ordered++);
+    }
+    lock.unlock();
+    for(int32_t j=0; j < (int32_t)ready.size(); ++j) {
+      merge_fn(ready[j]);
+      ++nmerged;
+    }
+    lock.lock();
+  }
+}
+
+uint64_t tsv_parallel_scan::run(bool per_line, callback_t& fn, merge_t& merge_fn) {
+  if ( chunks.empty() )
+    plan();
+
+  int32_t nc = (int32_t)chunks.size();
+  tsv_task_merger merger(nc, ordered);
+
+  auto worker = [&]() {
+    tsv_reader tr;
+    if ( !tr.open(filename.c_str()) )
+      error("[E:%s:%d %s] Cannot open file %s for reading", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    tr.delimiter = delimiter;
+    tr.set_tokenizer(tokenizer);
+    if ( !projection.empty() )
+      tr.set_projection(projection);
+    int32_t i;
+    while( ( i = merger.next() ) >= 0 ) {
+      tsv_scan_chunk& c = chunks[i];
+      if ( !tr.set_range(c.beg, c.end) )
+        error("[E:%s:%d %s] Cannot seek to offset %lld of %s", __FILE__, __LINE__, __FUNCTION__, (long long)c.beg, filename.c_str());
+      uint64_t nlines0 = tr.nlines;
+      if ( per_line ) {
+        while( tr.read_line() )
+          fn(tr, c);
+      }
+      else {
+        fn(tr, c);
+      }
+      c.nlines = tr.nlines - nlines0;
+      merger.complete(i);
+    }
+    tr.close();
+  };
+
+  std::vector<std::thread> threads;
+  for(int32_t i=0; i < nthreads && i < nc; ++i)
+    threads.emplace_back(worker);
+
+  // merge the completed chunks on the calling thread
+  uint64_t total = 0;
+  merger.merge([&](int32_t i) {
+    tsv_scan_chunk& c = chunks[i];
+    total += c.nlines;
+    if ( merge_fn ) merge_fn(c);
+    std::string().swap(c.out); // release the output once merged
+  });
+
+  for(int32_t i=0; i < (int32_t)threads.size(); ++i)
+    threads[i].join();
+  return total;
+}
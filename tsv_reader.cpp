@@ -22,9 +22,19 @@
 */
 
 #include "qgenlib/tsv_reader.h"
+#include "qgenlib/genome_interval.h"
+#include "qgenlib/genome_loci.h"
+#include "qgenlib/tsv_line_index.h"
+
+extern "C" {
+#include "htslib/bgzf.h"
+#include "htslib/hfile.h"
+}
+
+#include <algorithm>
 #define DSV_NOT_YET_PEEKED -9
 
-bool tsv_reader::open(const char* filename) {
+bool tsv_reader::open(const char* filename, int32_t threads, int32_t queue_size) {
   this->filename = filename;
   
   htsFormat fmt;
@@ -38,37 +48,135 @@ bool tsv_reader::open(const char* filename) {
   if ( hp == NULL ) {
     return false;
   }
+  if ( threads > 0 )
+    set_threads(threads, queue_size);
+  return true;
+}
+
+// Plain files on local storage can be read without copying each line into str.
+// Fields are located by tsv_tokenizer::tokenize_view() within the mapping, and
+// str is filled only if a '\0'-terminated field is requested by str_field_at().
+bool tsv_reader::open_mmap(const char* filename) {
+  this->filename = filename;
+  return mm.open(filename);
+}
+
+// Lines are split by a text_line_reader fed by io_uring, and tokenized in
+// place within its blocks as in mmap mode; str is filled only if a
+// '\0'-terminated field is requested, or to join the lines of a CSV record.
+bool tsv_reader::open_uring(const char* filename, int32_t queue_depth) {
+  this->filename = filename;
+  ulr = new text_line_reader;
+  if ( ulr->open_uring(filename, queue_depth) && ulr->ur.is_open() )
+    return true;
+  ulr->close();
+  delete ulr;
+  ulr = NULL;
+  return open(filename);
+}
+
+int32_t tsv_reader::getline(kstring_t* s) {
+  if ( ulr == NULL )
+    return hts_getline(hp, KS_SEP_LINE, s);
+  if ( ulr->readline() == 0 )
+    return -1;
+  int32_t len = ulr->last_line_length - 1; // strip the newline and any '\r' like hts_getline()
+  if ( ( len > 0 ) && ( ulr->buffer[len-1] == '\r' ) ) --len;
+  s->l = 0;
+  kputsn(ulr->buffer, len, s);
+  return len;
+}
+
+// Attach a private pool of decompression threads. BGZF blocks are inflated by
+// the pool and queued ahead of the parser (up to queue_size blocks, or twice
+// the number of threads by default), so that read_line() only has to tokenize.
+// Seeking through tabix iterators is supported by htslib's multi-threaded BGZF.
+// Plain or non-BGZF gzip files are silently read single-threaded.
+bool tsv_reader::set_threads(int32_t threads, int32_t queue_size) {
+  if ( mm.is_open() || ( ulr != NULL ) )
+    return false;
+  if ( hp == NULL )
+    error("[E:%s:%d %s] Cannot set threads before opening a file", __FILE__, __LINE__, __FUNCTION__);
+  if ( ( threads <= 0 ) || ( hp->format.compression != bgzf ) )
+    return false;
+  if ( tpool.pool != NULL )
+    error("[E:%s:%d %s] Thread pool is already attached to %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+
+  hts_tpool* pool = hts_tpool_init(threads);
+  if ( pool == NULL ) {
+    warning("[%s:%d %s] Failed to create a pool of %d threads, reading %s single-threaded", __FILE__, __LINE__, __FUNCTION__, threads, filename.c_str());
+    return false;
+  }
+  if ( !set_thread_pool(pool, queue_size) ) {
+    hts_tpool_destroy(pool);
+    return false;
+  }
+  own_tpool = true;
+  nthreads = threads;
+  return true;
+}
+
+// Attach a thread pool shared with other readers. The pool must outlive this reader.
+bool tsv_reader::set_thread_pool(hts_tpool* pool, int32_t queue_size) {
+  if ( mm.is_open() || ( ulr != NULL ) )
+    return false;
+  if ( hp == NULL )
+    error("[E:%s:%d %s] Cannot set a thread pool before opening a file", __FILE__, __LINE__, __FUNCTION__);
+  if ( ( pool == NULL ) || ( hp->format.compression != bgzf ) )
+    return false;
+  tpool.pool = pool;
+  tpool.qsize = queue_size;
+  if ( hts_set_thread_pool(hp, &tpool) != 0 ) {
+    tpool.pool = NULL;
+    return false;
+  }
+  own_tpool = false;
+  nthreads = hts_tpool_size(pool);
   return true;
 }
 
 bool tsv_reader::close() {
 //  notice("foo %s", filename.c_str());
+  if ( mm.is_open() ) {
+    line_view = NULL;
+    return mm.close();
+  }
+  if ( ulr != NULL ) {
+    bool ret = ( ulr->close() == 0 );
+    delete ulr;
+    ulr = NULL;
+    return ret;
+  }
   if ( hp == NULL ) return false;
 //  notice("bar");
   int32_t ret = hts_close(hp);
 //  notice("baz %d", ret);
   hp = NULL;
+  if ( tpool.pool != NULL ) { // the pool must be destroyed after the file is closed
+    if ( own_tpool ) hts_tpool_destroy(tpool.pool);
+    tpool.pool = NULL;
+    own_tpool = false;
+    nthreads = 0;
+  }
   return ret == 0;
 }
 
 int32_t tsv_reader::read_line() {
-  if ( itr == NULL ) {
-    //if ( ( str.s != NULL ) && ( lstr > 0 ) ) free(str.s);
-    lstr = hts_getline(hp, KS_SEP_LINE, &str);
-  }
-  else {
-    lstr = tbx_itr_next(hp, tbx, itr, &str);
-  }
-
+  check_checkpoint();
+  lstr = fetch_record();
   if ( lstr <= 0 ) {
     nfields = 0;
     fields = NULL;
     return 0; // lstr;
   }
 
-  // need to free the previously allocated fields!!
-  if ( fields != NULL ) { free(fields); fields = NULL; }  
-  fields = ksplit(&str, delimiter, &nfields);
+  // offsets are written into the buffer owned by tok, which is reused across lines
+  if ( is_view() )
+    nfields = tok.tokenize_view(line_view, lstr, delimiter);
+  else
+    nfields = tok.tokenize(str.s, lstr, delimiter);
+  fields = tok.offsets;
+  if ( proj_compact ) compact_fields();
 
   //notice("lstr = %d, str = %s, delim = %d", lstr, str.s, delimiter);
     
@@ -76,18 +184,359 @@ int32_t tsv_reader::read_line() {
   return nfields;
 }
 
-bool tsv_reader::jump_to(const char* chr, int32_t beg, int32_t end) {
-  char buf[65536];
-  snprintf(buf, 65536, "%s:%d-%d", chr, beg, end);
-  return jump_to(buf);
+// read the next line into str (or line_view in mmap mode) without tokenizing
+// it, and returns its length, or a value <= 0 if there is no more line to read
+int32_t tsv_reader::fetch_line() {
+  if ( mm.is_open() ) 
+    return fetch_line_mmap();
+  if ( ulr != NULL )
+    return fetch_line_uring();
+  
+  if ( ( itr == NULL ) && !in_regions ) {
+    //if ( ( str.s != NULL ) && ( lstr > 0 ) ) free(str.s);
+    if ( ( range_end >= 0 ) && ( tell() > range_end ) ) // the next line belongs to the next range
+      return 0;
+    return getline(&str);
+  }
+  else if ( !in_regions ) {
+    return tbx_itr_next(hp, tbx, itr, &str);
+  }
+  else {
+    return next_region_record();
+  }
 }
 
-bool tsv_reader::jump_to(const char* reg) {
+// in CSV mode, a record continues on the next lines while a quoted field is
+// open; the lines are joined with '\n' (in the mapping, they already are)
+int32_t tsv_reader::fetch_record() {
+  int32_t len = fetch_line();
+  if ( ( tok.quote == 0 ) || ( len <= 0 ) )
+    return len;
+  if ( ulr != NULL ) { // the blocks of io_uring are reused, so the lines of a record are joined in str
+    str.l = 0;
+    kputsn(line_view, len, &str);
+    materialized = true;
+  }
+  const char* s = mm.is_open() ? line_view : str.s;
+  if ( mm.is_open() )
+    mm.pin(mm.line_beg); // the windows of the record must stay mapped while its other lines are read
+  while( tok.has_open_quote(s, len) ) {
+    if ( mm.is_open() ) {
+      int64_t l;
+      const char* next = mm.next_line(l);
+      if ( next == NULL ) break;
+      if ( ( l > 0 ) && ( next[l-1] == '\n' ) ) {
+        --l;
+        if ( ( l > 0 ) && ( next[l-1] == '\r' ) ) --l;
+      }
+      if ( next + l - line_view > INT_MAX )
+        error("[E:%s:%d %s] Record %llu of %s is longer than %d bytes", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)nlines+1, filename.c_str(), INT_MAX);
+      len = (int32_t)( next + l - line_view );
+    }
+    else {
+      if ( ( itr != NULL ) || in_regions ) break;
+      kstring_t rec = str; // read the next line into a fresh buffer, and append it
+      str.l = str.m = 0;
+      str.s = NULL;
+      int32_t ret = getline(&str);
+      if ( ret >= 0 ) {
+        kputc('\n', &rec);
+        kputsn(str.s, str.l, &rec);
+      }
+      free(str.s);
+      str = rec;
+      if ( ret < 0 ) break;
+      len = (int32_t)str.l;
+      s = str.s;
+    }
+  }
+  if ( mm.is_open() )
+    mm.unpin(); // nothing is unmapped before the next record is read
+  return len;
+}
+
+int32_t tsv_reader::fetch_line_mmap() {
+  materialized = false;
+  if ( ( range_end >= 0 ) && ( (int64_t)mm.pos > range_end ) )
+    return 0;
+  int64_t len;
+  line_view = mm.next_line(len);
+  if ( ( len > 0 ) && ( line_view[len-1] == '\n' ) ) { // strip the newline like hts_getline()
+    --len;
+    if ( ( len > 0 ) && ( line_view[len-1] == '\r' ) ) --len;
+  }
+  if ( len > INT_MAX )
+    error("[E:%s:%d %s] Line %llu of %s is longer than %d bytes", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)nlines+1, filename.c_str(), INT_MAX);
+  return (int32_t)len;
+}
+
+int32_t tsv_reader::fetch_line_uring() {
+  materialized = false;
+  if ( ( range_end >= 0 ) && ( tell() > range_end ) ) // the next line belongs to the next range
+    return 0;
+  if ( ulr->readline() == 0 )
+    return -1;
+  line_view = ulr->buffer;
+  int32_t len = ulr->last_line_length - 1; // strip the newline and any '\r' like hts_getline()
+  if ( ( len > 0 ) && ( line_view[len-1] == '\r' ) ) --len;
+  return len;
+}
+
+int32_t tsv_reader::read_batch(tsv_batch& batch, int32_t n) {
+  check_checkpoint(); // the previous batch is processed by now
+  batch.clear();
+  while( batch.nlines < n ) {
+    lstr = fetch_record();
+    if ( lstr <= 0 ) break;
+    // the line is copied once into the batch and tokenized there
+    char* p = batch.append_line(is_view() ? line_view : str.s, lstr);
+    int32_t nf = tok.tokenize(p, lstr, delimiter);
+    batch.add_row(nf, tok.offsets, tok.ends, proj_compact ? &proj_cols : NULL);
+    ++nlines;
+  }
+  // the per-line state is not used by batches
+  nfields = 0;
+  fields = NULL;
+  return batch.nlines;
+}
+
+tsv_batch tsv_reader::read_batch(int32_t n) {
+  tsv_batch batch;
+  read_batch(batch, n);
+  return batch;
+}
+
+// copy the current line into str, terminating each field, so that fields
+// can be returned as C strings. Done at most once per line.
+void tsv_reader::materialize() {
+  if ( str.m < (size_t)lstr + 1 ) {
+    str.m = lstr + 1;
+    str.s = (char*)realloc(str.s, str.m);
+    if ( str.s == NULL )
+      error("[E:%s:%d %s] Cannot allocate %d bytes", __FILE__, __LINE__, __FUNCTION__, lstr + 1);
+  }
+  memcpy(str.s, line_view, lstr);
+  str.l = lstr;
+  str.s[lstr] = '\0';
+  materialized = true;
+  if ( tok.quote != 0 ) { // unescape the quoted fields in the copy
+    nfields = tok.tokenize(str.s, lstr, delimiter);
+    fields = tok.offsets;
+    if ( proj_compact ) compact_fields();
+    return;
+  }
+  for(int32_t i=0; i < nfields; ++i)
+    str.s[tok.ends[i]] = '\0';
+}
+
+void tsv_reader::set_projection(const std::vector<int32_t>& cols, bool compact) {
+  if ( cols.empty() )
+    error("[E:%s:%d %s] Empty column projection for %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+  int32_t maxcol = 0;
+  for(int32_t i=0; i < (int32_t)cols.size(); ++i) {
+    if ( cols[i] < 0 )
+      error("[E:%s:%d %s] Invalid column index %d in the projection", __FILE__, __LINE__, __FUNCTION__, cols[i]);
+    if ( cols[i] > maxcol ) maxcol = cols[i];
+  }
+  proj_slot.assign(maxcol + 1, -1);
+  for(int32_t i=0; i < (int32_t)cols.size(); ++i) {
+    if ( proj_slot[cols[i]] >= 0 )
+      error("[E:%s:%d %s] Column %d appears more than once in the projection", __FILE__, __LINE__, __FUNCTION__, cols[i]);
+    proj_slot[cols[i]] = i;
+  }
+  proj_cols = cols;
+  proj_compact = compact;
+  proj_offsets.resize(cols.size());
+  proj_ends.resize(cols.size());
+  tok.max_tokens = maxcol + 1; // fields past the highest projected column are never scanned
+}
+
+void tsv_reader::clear_projection() {
+  proj_cols.clear();
+  proj_slot.clear();
+  proj_compact = false;
+  tok.max_tokens = 0;
+}
+
+// gather the offsets of the projected columns; columns missing from a short
+// line keep an offset of -1, and accessing them is an error as usual
+void tsv_reader::compact_fields() {
+  for(int32_t i=0; i < (int32_t)proj_cols.size(); ++i) {
+    int32_t c = proj_cols[i];
+    if ( c < nfields ) {
+      proj_offsets[i] = tok.offsets[c];
+      proj_ends[i] = tok.ends[c];
+    }
+    else
+      proj_offsets[i] = proj_ends[i] = -1;
+  }
+  fields = proj_offsets.data();
+}
+
+int64_t tsv_reader::tell() {
+  if ( mm.is_open() )
+    return (int64_t)mm.pos;
+  if ( ulr != NULL )
+    return (int64_t)ulr->cur_fp_offset;
+  if ( hp->format.compression == no_compression )
+    return (int64_t)htell(hp->fp.hfile);
+  else
+    return (int64_t)bgzf_tell(hp->fp.bgzf);
+}
+
+bool tsv_reader::seek(int64_t offset) {
+  if ( mm.is_open() )
+    return mm.seek((uint64_t)offset);
+  if ( ulr != NULL )
+    return ulr->seek(offset);
+  if ( itr != NULL ) {
+    tbx_itr_destroy(itr);
+    itr = NULL;
+  }
+  clear_regions();
+  if ( hp->format.compression == no_compression )
+    return hseek(hp->fp.hfile, (off_t)offset, SEEK_SET) >= 0;
+  else
+    return bgzf_seek(hp->fp.bgzf, offset, SEEK_SET) >= 0;
+}
+
+// A line belongs to the range in which it starts. Since beg may point to the
+// middle of a line, everything up to the first newline at or after beg is
+// skipped, and lines starting at or before end are read, so adjacent ranges
+// (a, b] and (b, c] never share or miss a line.
+bool tsv_reader::set_range(int64_t beg, int64_t end) {
+  if ( !seek(beg) )
+    return false;
+  if ( beg > 0 ) {
+    if ( mm.is_open() ) {
+      int64_t len;
+      mm.next_line(len);
+    }
+    else 
+      getline(&str);
+  }
+  range_end = end;
+  return true;
+}
+
+bool tsv_reader::seek_line(const tsv_line_index& lidx, uint64_t line) {
+  if ( line > lidx.nlines )
+    return false;
+  bool compressed = ( hp != NULL ) && ( hp->format.compression != no_compression );
+  if ( lidx.bgzf != compressed )
+    error("[E:%s:%d %s] Line index of %s does not match the compression of %s", __FILE__, __LINE__, __FUNCTION__, lidx.filename.c_str(), filename.c_str());
+  uint64_t skip;
+  int64_t k = lidx.locate(line, skip);
+  if ( !seek(lidx.offsets[k]) )
+    return false;
+  for(uint64_t i=0; i < skip; ++i) {
+    if ( mm.is_open() ) {
+      int64_t len;
+      if ( mm.next_line(len) == NULL ) return false;
+    }
+    else if ( getline(&str) < 0 )
+      return false;
+  }
+  nlines = line;
+  return true;
+}
+
+// The position is exact for all backends: tell() points to the start of the
+// next line after a line is read, so a checkpoint needs no line skipping.
+bool tsv_reader::get_checkpoint(tsv_checkpoint& cp) {
+  if ( ( itr != NULL ) || in_regions ) {
+    warning("[%s:%d %s] Cannot take a checkpoint of %s while reading tabix regions", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    return false;
+  }
+  if ( !mm.is_open() && ( ulr == NULL ) && ( ( hp == NULL ) || ( hp->format.compression == gzip ) ) ) {
+    warning("[%s:%d %s] Cannot take a checkpoint of %s, which is not open or not seekable", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    return false;
+  }
+  if ( !cp.set_file(filename.c_str()) ) {
+    warning("[%s:%d %s] Cannot find the size of %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    return false;
+  }
+  cp.bgzf = ( hp != NULL ) && ( hp->format.compression == bgzf );
+  cp.offset = tell();
+  cp.skip = 0;
+  cp.uoffset = cp.bgzf ? 0 : (uint64_t)cp.offset;
+  cp.nlines = nlines;
+  cp.range_end = range_end;
+  return true;
+}
+
+bool tsv_reader::resume(const tsv_checkpoint& cp) {
+  if ( !cp.matches(filename.c_str()) ) {
+    warning("[%s:%d %s] Checkpoint of %s does not match %s, which may have changed", __FILE__, __LINE__, __FUNCTION__, cp.filename.c_str(), filename.c_str());
+    return false;
+  }
+  bool compressed = ( hp != NULL ) && ( hp->format.compression != no_compression );
+  if ( ( cp.bgzf != compressed ) || ( ( hp != NULL ) && ( hp->format.compression == gzip ) ) ) {
+    warning("[%s:%d %s] Checkpoint of %s does not match the compression of %s", __FILE__, __LINE__, __FUNCTION__, cp.filename.c_str(), filename.c_str());
+    return false;
+  }
+  if ( !seek(cp.offset) )
+    return false;
+  if ( cp.skip > 0 ) { // checkpoint of a text_line_reader, at an offset within a BGZF block
+    char buf[65536];
+    for(uint64_t left = cp.skip; left > 0; ) {
+      ssize_t n = bgzf_read(hp->fp.bgzf, buf, left < sizeof(buf) ? left : sizeof(buf));
+      if ( n <= 0 ) return false;
+      left -= n;
+    }
+  }
+  nlines = checkpoint_last = cp.nlines;
+  range_end = cp.range_end;
+  return true;
+}
+
+bool tsv_reader::resume(const char* checkpoint_filename) {
+  tsv_checkpoint cp;
+  return cp.load(checkpoint_filename) && resume(cp);
+}
+
+void tsv_reader::set_checkpoint_hook(uint64_t every, const tsv_checkpoint_hook_t& hook) {
+  checkpoint_every = hook ? every : 0;
+  checkpoint_hook = hook;
+  checkpoint_last = nlines;
+}
+
+void tsv_reader::set_checkpoint_file(const char* checkpoint_filename, uint64_t every, const tsv_checkpoint_hook_t& fill_state) {
+  set_checkpoint_hook(every, tsv_checkpoint::save_hook(checkpoint_filename, fill_state));
+}
+
+bool tsv_reader::load_index() {
+  if ( mm.is_open() )
+    error("[E:%s] Cannot use tabix index on %s opened by open_mmap()", __PRETTY_FUNCTION__, filename.c_str());
+  if ( ulr != NULL )
+    error("[E:%s] Cannot use tabix index on %s opened by open_uring()", __PRETTY_FUNCTION__, filename.c_str());
   if ( tbx == NULL ) {
     tbx = tbx_index_load(filename.c_str());
     if ( !tbx ) error("[E:%s] Could not load .tbi/.csi index of %s\n", __PRETTY_FUNCTION__, filename.c_str());
   }
+  return true;
+}
+
+bool tsv_reader::jump_to(const char* chr, int32_t beg, int32_t end) {
+  load_index();
+  clear_regions();
+  if ( itr != NULL )
+    tbx_itr_destroy(itr);
+
+  // query by sequence id, instead of formatting the region for tbx_itr_querys() to parse
+  int32_t tid = tbx_name2id(tbx, chr);
+  itr = ( tid < 0 ) ? NULL : tbx_itr_queryi(tbx, tid, beg > 0 ? beg - 1 : 0, end);
+  
+  if ( itr == NULL ) {
+    notice("Failed jumping to %s:%d-%d, tbx = %x, itr = %x", chr, beg, end, tbx, itr);
+    return false;
+  }
+  else return true;
+}
 
+bool tsv_reader::jump_to(const char* reg) {
+  load_index();
+  clear_regions();
   if ( itr != NULL )
     tbx_itr_destroy(itr);
 
@@ -100,44 +549,213 @@ bool tsv_reader::jump_to(const char* reg) {
   else return true;
 }
 
-const char* tsv_reader::str_field_at(int32_t idx) {
-  if ( idx >= nfields ) {
-    error("[E:%s:%d %s] Cannot access field at %d >= %d", __FILE__, __LINE__, __FUNCTION__, idx, nfields);
-    //return NULL;
+void tsv_reader::clear_regions() {
+  in_regions = false;
+  regions.clear();
+  ireg = ireg_end = 0;
+}
+
+void tsv_reader::resolve_regions(tbx_t* tbx, const std::vector<std::string>& regs, std::vector<tsv_region>& out) {
+  std::string chr;
+  for(int32_t i=0; i < (int32_t)regs.size(); ++i) {
+    hts_pos_t beg, end;
+    const char* q = hts_parse_reg64(regs[i].c_str(), &beg, &end);
+    if ( q == NULL )
+      error("[E:%s:%d %s] Cannot parse region %s", __FILE__, __LINE__, __FUNCTION__, regs[i].c_str());
+    chr.assign(regs[i].c_str(), q - regs[i].c_str());
+    int32_t tid = tbx_name2id(tbx, chr.c_str());
+    if ( tid >= 0 ) // sequences absent from the index have no records
+      out.push_back(tsv_region(tid, beg, end));
   }
-  return ( &str.s[fields[idx]] );
+}
+
+void tsv_reader::resolve_regions(tbx_t* tbx, const std::vector<GenomeInterval>& intervals, std::vector<tsv_region>& out) {
+  int32_t tid = -1;
+  for(int32_t i=0; i < (int32_t)intervals.size(); ++i) {
+    const GenomeInterval& g = intervals[i];
+    if ( ( i == 0 ) || ( g.seq != intervals[i-1].seq ) )
+      tid = tbx_name2id(tbx, g.seq.c_str());
+    if ( tid >= 0 )
+      out.push_back(tsv_region(tid, g.start1 > 0 ? g.start1 - 1 : 0, g.end1));
+  }
+}
+
+void tsv_reader::resolve_regions(tbx_t* tbx, const genomeLoci& loci, std::vector<tsv_region>& out) {
+  const char* prev = NULL;
+  int32_t tid = -1;
+  for(std::set<genomeLocus>::const_iterator it = loci.loci.begin(); it != loci.loci.end(); ++it) {
+    if ( ( prev == NULL ) || ( it->chrom != prev ) )
+      tid = tbx_name2id(tbx, it->chrom.c_str());
+    prev = it->chrom.c_str();
+    if ( tid >= 0 )
+      out.push_back(tsv_region(tid, it->beg1 > 0 ? it->beg1 - 1 : 0, it->end0));
+  }
+}
+
+int32_t tsv_reader::coalesce_regions(std::vector<tsv_region>& regs) {
+  std::sort(regs.begin(), regs.end());
+  int32_t n = 0;
+  for(int32_t i=0; i < (int32_t)regs.size(); ++i) {
+    if ( ( regs[i].tid < 0 ) || ( regs[i].end <= regs[i].beg ) ) continue;
+    if ( ( n > 0 ) && ( regs[n-1].tid == regs[i].tid ) && ( regs[i].beg <= regs[n-1].end ) ) {
+      if ( regs[i].end > regs[n-1].end ) regs[n-1].end = regs[i].end;
+    }
+    else
+      regs[n++] = regs[i];
+  }
+  regs.resize(n);
+  return n;
+}
+
+int32_t tsv_reader::jump_to_regions(const std::vector<std::string>& regs, int32_t max_gap) {
+  load_index();
+  std::vector<tsv_region> v;
+  resolve_regions(tbx, regs, v);
+  return jump_to_regions(v, max_gap);
+}
+
+int32_t tsv_reader::jump_to_regions(const std::vector<GenomeInterval>& intervals, int32_t max_gap) {
+  load_index();
+  std::vector<tsv_region> v;
+  resolve_regions(tbx, intervals, v);
+  return jump_to_regions(v, max_gap);
+}
+
+int32_t tsv_reader::jump_to_regions(const genomeLoci& loci, int32_t max_gap) {
+  load_index();
+  std::vector<tsv_region> v;
+  resolve_regions(tbx, loci, v);
+  return jump_to_regions(v, max_gap);
+}
+
+int32_t tsv_reader::jump_to_regions(const std::vector<tsv_region>& regs, int32_t max_gap) {
+  load_index();
+  if ( itr != NULL ) {
+    tbx_itr_destroy(itr);
+    itr = NULL;
+  }
+  clear_regions();
+  max_region_gap = max_gap;
+  regions = regs;
+  coalesce_regions(regions);
+  in_regions = true;
+  return (int32_t)regions.size();
+}
+
+// Regions closer than max_region_gap are read through one iterator, skipping
+// the records falling in between. A record spanning the seam between two
+// iterators is returned by both, so the second one drops records starting
+// before the end of the previous iterator's last region.
+int32_t tsv_reader::next_region_record() {
+  while( true ) {
+    if ( itr == NULL ) {
+      if ( ireg >= (int32_t)regions.size() )
+        return -1;
+      int32_t j = ireg + 1;
+      while( ( j < (int32_t)regions.size() ) && ( regions[j].tid == regions[ireg].tid ) &&
+             ( regions[j].beg - regions[j-1].end < max_region_gap ) )
+        ++j;
+      itr = tbx_itr_queryi(tbx, regions[ireg].tid, regions[ireg].beg, regions[j-1].end);
+      if ( itr == NULL )
+        error("[E:%s:%d %s] Cannot create tabix iterator for %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+      ireg_end = j;
+    }
+    int32_t ret = tbx_itr_next(hp, tbx, itr, &str);
+    if ( ret < -1 )
+      error("[E:%s:%d %s] Error reading records from %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    
+    hts_pos_t beg = itr->curr_beg, end = itr->curr_end;
+    if ( ret >= 0 ) {
+      if ( ( ireg > 0 ) && ( itr->curr_tid == regions[ireg-1].tid ) && ( beg < regions[ireg-1].end ) )
+        continue; // already returned by the previous iterator
+      // records come sorted by start, so regions ending before this one are done
+      while( ( ireg < ireg_end ) && ( regions[ireg].end <= beg ) )
+        ++ireg;
+      if ( ireg < ireg_end ) {
+        if ( regions[ireg].beg < end )
+          return ret;
+        continue; // in a gap between regions
+      }
+    }
+    // the iterator is exhausted, or no further record can overlap its regions
+    tbx_itr_destroy(itr);
+    itr = NULL;
+    ireg = ireg_end;
+  }
+}
+
+const char* tsv_reader::str_field_at(int32_t idx) {
+  int32_t k = field_slot(idx);
+  if ( is_view() )
+    materialize();
+  return ( &str.s[fields[k]] );
+}
+
+const char* tsv_reader::str_field_view(int32_t idx, int32_t* len) {
+  const char* end;
+  const char* p = field_range(idx, end);
+  *len = (int32_t)( end - p );
+  return p;
 }
 
 int32_t tsv_reader::int_field_at(int32_t idx) {
-  if ( idx >= nfields )
-    error("[E:%s:%d %s] Cannot access field at %d >= %d", __FILE__, __LINE__, __FUNCTION__, idx, nfields);    
-  return ( atoi(&str.s[fields[idx]]) );
+  const char* end;
+  const char* p = field_range(idx, end);
+  return ( fast_atoi32(p, end) );
 }
 
 int64_t tsv_reader::int64_field_at(int32_t idx) {
-  if ( idx >= nfields )
-    error("[E:%s:%d %s] Cannot access field at %d >= %d", __FILE__, __LINE__, __FUNCTION__, idx, nfields);
-  return ( strtoll(&str.s[fields[idx]], NULL, 10) );
+  const char* end;
+  const char* p = field_range(idx, end);
+  return ( fast_atoi64(p, end) );
 }
 
 uint64_t tsv_reader::uint64_field_at(int32_t idx) {
-  if ( idx >= nfields )
-    error("[E:%s:%d %s] Cannot access field at %d >= %d", __FILE__, __LINE__, __FUNCTION__, idx, nfields);
-  return ( strtoull(&str.s[fields[idx]], NULL, 10) );
+  const char* end;
+  const char* p = field_range(idx, end);
+  return ( fast_atou64(p, end) );
 }
 
 double tsv_reader::double_field_at(int32_t idx) {
-  if ( idx >= nfields )
-    error("[E:%s:%d %s] Cannot access field at %d >= %d", __FILE__, __LINE__, __FUNCTION__, idx, nfields);    
-  return ( atof(&str.s[fields[idx]]) );
+  const char* end;
+  const char* p = field_range(idx, end);
+  return ( fast_atof(p, end) );
+}
+
+bool tsv_reader::int_field_at(int32_t idx, int32_t& value) {
+  const char* end;
+  const char* p = field_range(idx, end);
+  return parse_int32(p, end, value);
+}
+
+bool tsv_reader::int64_field_at(int32_t idx, int64_t& value) {
+  const char* end;
+  const char* p = field_range(idx, end);
+  return parse_int64(p, end, value);
+}
+
+bool tsv_reader::uint64_field_at(int32_t idx, uint64_t& value) {
+  const char* end;
+  const char* p = field_range(idx, end);
+  return parse_uint64(p, end, value);
 }
 
+bool tsv_reader::double_field_at(int32_t idx, double& value) {
+  const char* end;
+  const char* p = field_range(idx, end);
+  return parse_double(p, end, value);
+}
+
+// with a column projection, only the projected columns are stored, in the order of proj_cols
 int32_t tsv_reader::store_to_vector(std::vector<std::string>& v) {
-  v.resize(nfields);
-  for(int32_t i=0; i < nfields; ++i) {
-    v[i].assign(&str.s[fields[i]]);
+  int32_t n = proj_cols.empty() ? nfields : (int32_t)proj_cols.size();
+  v.resize(n);
+  for(int32_t i=0; i < n; ++i) {
+    int32_t len;
+    const char* p = str_field_view(proj_cols.empty() ? i : proj_cols[i], &len);
+    v[i].assign(p, len);
   }
-  return nfields;
+  return n;
 }
 
 // implementations for text_line_reader class
@@ -149,48 +767,331 @@ int32_t text_line_reader::load_to_set(const char* filename, std::set<std::string
       tlr.buffer[tlr.last_line_length-1] = '\0';
       sset.insert(tlr.buffer);
     }
-    return tlr.count_lines;
+    return (int32_t)tlr.count_lines;
   }
   else {
     return 0;
   }
 }
 
-bool text_line_reader::open(const char* _filename, int32_t _max_line_length) {
-  filename.assign(_filename);
+void text_line_reader::init_block(int32_t _max_line_length) {
   if ( _max_line_length > 0 )
     max_line_length = _max_line_length;
-  buffer = (char*)malloc(max_line_length);
-  fp = fopen(filename.c_str(), "r");
+  // blocks start at 1-16MB; longer lines grow the buffer as needed
+  int64_t cap = max_line_length < TEXT_LINE_READER_BLOCK_SIZE ? TEXT_LINE_READER_BLOCK_SIZE : max_line_length;
+  if ( cap > TEXT_LINE_READER_MAX_BLOCK_SIZE ) cap = TEXT_LINE_READER_MAX_BLOCK_SIZE;
+  if ( blk_cap < cap ) {
+    blk_mem = (char*)realloc(blk_mem, cap + 2);
+    if ( blk_mem == NULL )
+      error("[E:%s:%d %s] Cannot allocate %lld bytes to read %s", __FILE__, __LINE__, __FUNCTION__, (long long)cap, filename.c_str());
+    blk_cap = cap;
+  }
+  blk = blk_mem;
+  blk_len = blk_pos = 0;
+  nul_pos = -1;
+  at_eof = false;
+  count_lines = last_line_length = 0;
+  cur_fp_offset = line_offset = 0;
+  set_anchor(0);
+  buffer = blk;
+  buffer[0] = '\0';
+}
+
+bool text_line_reader::open(const char* _filename, int32_t _max_line_length, int32_t threads) {
+  filename.assign(_filename);
+  init_block(_max_line_length);
+  fp = bgzf_open(filename.c_str(), "r"); // reads plain files as is
   if ( fp == NULL ) {
     fprintf(stderr,"ERROR: Cannot open file %s for reading", filename.c_str());
     return false;
   }
-  cur_fp_offset = ftello(fp);
+  if ( threads > 0 )
+    set_threads(threads);
+  return true;
+}
+
+// The gzip magic number is checked first, since io_uring reads the bytes as
+// they are; compressed files are left to BGZF, which also uses its threads.
+bool text_line_reader::open_uring(const char* _filename, int32_t queue_depth, int32_t _max_line_length) {
+  bool compressed = false;
+  FILE* f = fopen(_filename, "rb");
+  if ( f != NULL ) {
+    unsigned char magic[2] = { 0, 0 };
+    compressed = ( fread(magic, 1, 2, f) == 2 ) && ( magic[0] == 0x1f ) && ( magic[1] == 0x8b );
+    fclose(f);
+  }
+  if ( compressed || !uring_reader::available() )
+    return open(_filename, _max_line_length);
+
+  filename.assign(_filename);
+  init_block(_max_line_length);
+  if ( !ur.open(_filename, queue_depth) )
+    return open(_filename, _max_line_length);
+  return true;
+}
+
+bool text_line_reader::set_threads(int32_t threads, int32_t queue_size) {
+  if ( ur.is_open() )
+    return false;
+  if ( fp == NULL )
+    error("[E:%s:%d %s] Cannot set threads before opening a file", __FILE__, __LINE__, __FUNCTION__);
+  if ( ( threads <= 0 ) || !fp->is_compressed || fp->is_gzip )
+    return false;
+  if ( tpool != NULL )
+    error("[E:%s:%d %s] Thread pool is already attached to %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+
+  tpool = hts_tpool_init(threads);
+  if ( tpool == NULL ) {
+    warning("[%s:%d %s] Failed to create a pool of %d threads, reading %s single-threaded", __FILE__, __LINE__, __FUNCTION__, threads, filename.c_str());
+    return false;
+  }
+  if ( bgzf_thread_pool(fp, tpool, queue_size > 0 ? queue_size : threads * 2) != 0 ) {
+    hts_tpool_destroy(tpool);
+    tpool = NULL;
+    return false;
+  }
+  nthreads = threads;
+  return true;
+}
+
+bool text_line_reader::open_mmap(const char* _filename) {
+  filename.assign(_filename);
+  if ( !mm.open(_filename) ) {
+    fprintf(stderr,"ERROR: Cannot open file %s for reading through mmap", filename.c_str());
+    return false;
+  }
+  count_lines = 0;
+  cur_fp_offset = line_offset = 0;
+  return true;
+}
+
+bool text_line_reader::fill_block() {
+  if ( at_eof ) return false;
+  if ( ur.is_open() ) { // the next block is used in place, with the partial line copied in front of it
+    char* data;
+    int64_t n = ur.next_block(blk + blk_pos, blk_len - blk_pos, data);
+    if ( n == 0 ) {
+      at_eof = true;
+      return false;
+    }
+    blk = data;
+    blk_len = n;
+    blk_pos = 0;
+    return true;
+  }
+  if ( blk_pos > 0 ) { // keep only the partial line
+    memmove(blk, blk + blk_pos, blk_len - blk_pos);
+    blk_len -= blk_pos;
+    blk_pos = 0;
+  }
+  else if ( blk_len == blk_cap ) { // the partial line fills the whole block
+    blk_mem = (char*)realloc(blk_mem, blk_cap * 2 + 2);
+    if ( blk_mem == NULL )
+      error("[E:%s:%d %s] Cannot allocate %lld bytes to read %s", __FILE__, __LINE__, __FUNCTION__, (long long)blk_cap * 2, filename.c_str());
+    blk = blk_mem;
+    blk_cap *= 2;
+  }
+  if ( fp->is_compressed ) { // remember where this read starts, to take checkpoints
+    if ( anchor_uoff[1] <= cur_fp_offset ) {
+      anchor_uoff[0] = anchor_uoff[1];
+      anchor_voff[0] = anchor_voff[1];
+    }
+    anchor_uoff[1] = cur_fp_offset + (off_t)( blk_len - blk_pos );
+    anchor_voff[1] = bgzf_tell(fp);
+  }
+  ssize_t n = bgzf_read(fp, blk + blk_len, blk_cap - blk_len);
+  if ( n <= 0 ) {
+    if ( n < 0 )
+      error("[E:%s:%d %s] Error while reading %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    at_eof = true;
+    return false;
+  }
+  blk_len += n;
   return true;
 }
 
 int32_t text_line_reader::readline() {
-  const char* s = fgets(buffer, max_line_length, fp);
-  off_t new_fp_offset = ftello(fp);
-  while( new_fp_offset - cur_fp_offset == max_line_length -1 ) { // need to expand the current line length
-    int32_t new_line_length = max_line_length * 2;
-    buffer = (char*)realloc(buffer,new_line_length);
-    s = fgets(&buffer[max_line_length-1], max_line_length+1, fp);
-    max_line_length = new_line_length;
-    new_fp_offset = ftello(fp);
-  }
-  last_line_length = new_fp_offset - cur_fp_offset;
+  line_offset = cur_fp_offset;
+  if ( mm.is_open() ) { // lines are views into the mapping, with no copy or length limit
+    int64_t len;
+    buffer = (char*)mm.next_line(len);
+    if ( len > INT_MAX )
+      error("[E:%s:%d %s] Line %llu of %s is longer than %d bytes", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)count_lines+1, filename.c_str(), INT_MAX);
+    last_line_length = (int32_t)len;
+    if ( buffer != NULL ) ++count_lines;
+    cur_fp_offset = (off_t)mm.pos;
+    return buffer != NULL;
+  }
+
+  if ( nul_pos >= 0 ) { // restore the first byte of the next line
+    blk[nul_pos] = nul_saved;
+    nul_pos = -1;
+  }
+
+  int64_t from = blk_pos; // bytes before from are known not to contain '\n'
+  const char* nl = NULL;
+  while( ( nl = (const char*)memchr(blk + from, '\n', blk_len - from) ) == NULL ) {
+    from = blk_len - blk_pos;
+    if ( !fill_block() ) break;
+  }
+
+  int64_t end = ( nl == NULL ) ? blk_len : (int64_t)( nl - blk + 1 );
+  int64_t len = end - blk_pos;
+  if ( len == 0 ) { // end of file
+    last_line_length = 0;
+    return 0;
+  }
+  if ( len >= INT_MAX )
+    error("[E:%s:%d %s] Line %llu of %s is longer than %d bytes", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)count_lines+1, filename.c_str(), INT_MAX - 1);
+
+  buffer = blk + blk_pos;
+  cur_fp_offset += len;
+  blk_pos = end;
+  if ( nl == NULL ) { // last line without a newline; the spare bytes hold the terminators
+    blk[end] = '\n';
+    blk[end+1] = '\0';
+    ++len;
+  }
+  else {
+    nul_pos = end;
+    nul_saved = blk[end];
+    blk[end] = '\0';
+  }
+  last_line_length = (int32_t)len;
   ++count_lines;
-  cur_fp_offset = new_fp_offset;
-  return s != NULL;
+  return 1;
+}
+
+bool text_line_reader::seek(int64_t offset) {
+  if ( mm.is_open() ) {
+    if ( !mm.seek((uint64_t)offset) )
+      return false;
+  }
+  else {
+    if ( ur.is_open() ) {
+      if ( !ur.seek((uint64_t)offset) )
+        return false;
+    }
+    // plain files are read through BGZF in chunks, addressed as virtual offsets with the byte offset in the upper bits
+    else if ( ( fp == NULL ) || ( bgzf_seek(fp, fp->is_compressed ? offset : ( offset << 16 ), SEEK_SET) < 0 ) )
+      return false;
+    blk = blk_mem; // discard the buffered block, including the '\0' written after the current line
+    blk_len = blk_pos = 0;
+    nul_pos = -1;
+    at_eof = false;
+  }
+  if ( ( fp == NULL ) || !fp->is_compressed )
+    cur_fp_offset = line_offset = (off_t)offset;
+  else
+    set_anchor(offset);
+  return true;
+}
+
+bool text_line_reader::seek_line(const tsv_line_index& lidx, uint64_t line) {
+  if ( line > lidx.nlines )
+    return false;
+  if ( lidx.bgzf != ( ( fp != NULL ) && fp->is_compressed ) )
+    error("[E:%s:%d %s] Line index of %s does not match the compression of %s", __FILE__, __LINE__, __FUNCTION__, lidx.filename.c_str(), filename.c_str());
+  uint64_t skip;
+  int64_t k = lidx.locate(line, skip);
+  if ( !seek(lidx.offsets[k]) )
+    return false;
+  cur_fp_offset = (off_t)lidx.uoffsets[k];
+  if ( lidx.bgzf )
+    set_anchor(lidx.offsets[k]);
+  count_lines = (uint64_t)k * (uint64_t)lidx.interval;
+  for(uint64_t i=0; i < skip; ++i) {
+    if ( readline() == 0 )
+      return false;
+  }
+  return true;
+}
+
+void text_line_reader::set_anchor(int64_t voffset) {
+  anchor_uoff[0] = anchor_uoff[1] = cur_fp_offset;
+  anchor_voff[0] = anchor_voff[1] = voffset;
+}
+
+// In a bgzipped file, the position is the virtual offset where the last BGZF
+// read at or before the line started, and the uncompressed bytes up to the line.
+bool text_line_reader::get_checkpoint(tsv_checkpoint& cp, bool before_line) {
+  bool compressed = ( fp != NULL ) && fp->is_compressed && !mm.is_open() && !ur.is_open();
+  if ( ( fp == NULL ) && !mm.is_open() && !ur.is_open() ) {
+    warning("[%s:%d %s] Cannot take a checkpoint of %s, which is not open", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    return false;
+  }
+  if ( compressed && fp->is_gzip ) {
+    warning("[%s:%d %s] Cannot take a checkpoint of %s, which is gzipped but not bgzipped", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    return false;
+  }
+  if ( !cp.set_file(filename.c_str()) ) {
+    warning("[%s:%d %s] Cannot find the size of %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    return false;
+  }
+  off_t pos = before_line ? line_offset : cur_fp_offset;
+  cp.bgzf = compressed;
+  cp.uoffset = (uint64_t)pos;
+  if ( compressed ) {
+    int32_t a = ( anchor_uoff[1] <= pos ) ? 1 : 0;
+    cp.offset = anchor_voff[a];
+    cp.skip = (uint64_t)( pos - anchor_uoff[a] );
+  }
+  else {
+    cp.offset = (int64_t)pos;
+    cp.skip = 0;
+  }
+  cp.nlines = ( before_line && ( last_line_length > 0 ) ) ? count_lines - 1 : count_lines;
+  cp.range_end = -1;
+  return true;
+}
+
+bool text_line_reader::resume(const tsv_checkpoint& cp) {
+  if ( !cp.matches(filename.c_str()) ) {
+    warning("[%s:%d %s] Checkpoint of %s does not match %s, which may have changed", __FILE__, __LINE__, __FUNCTION__, cp.filename.c_str(), filename.c_str());
+    return false;
+  }
+  bool compressed = ( fp != NULL ) && fp->is_compressed && !mm.is_open() && !ur.is_open();
+  if ( ( cp.bgzf != compressed ) || ( compressed && fp->is_gzip ) ) {
+    warning("[%s:%d %s] Checkpoint of %s does not match the compression of %s", __FILE__, __LINE__, __FUNCTION__, cp.filename.c_str(), filename.c_str());
+    return false;
+  }
+  if ( !seek(cp.offset) )
+    return false;
+  if ( compressed ) { // read up to the line, and start from it within the block
+    cur_fp_offset = (off_t)( cp.uoffset - cp.skip );
+    set_anchor(cp.offset);
+    while( blk_len < (int64_t)cp.skip ) {
+      if ( !fill_block() )
+        return false;
+    }
+    blk_pos = (int64_t)cp.skip;
+    cur_fp_offset = line_offset = (off_t)cp.uoffset;
+  }
+  count_lines = cp.nlines;
+  last_line_length = 0;
+  return true;
 }
 
 int32_t text_line_reader::close() {
+  if ( mm.is_open() ) {
+    buffer = NULL; // points into the mapping, not allocated
+    return mm.close() ? 0 : -1;
+  }
+  if ( ur.is_open() ) {
+    blk = buffer = blk_mem; // the blocks of ur are freed
+    blk_len = blk_pos = 0;
+    nul_pos = -1;
+    return ur.close() ? 0 : -1;
+  }
   if ( fp != NULL ) {
-    int32_t ret = fclose(fp);
+    int32_t ret = bgzf_close(fp);
     if ( ret == 0 )
       fp = NULL;
+    if ( tpool != NULL ) { // the pool must be destroyed after the file is closed
+      hts_tpool_destroy(tpool);
+      tpool = NULL;
+      nthreads = 0;
+    }
     return 0;
   }
   else
@@ -198,24 +1099,32 @@ int32_t text_line_reader::close() {
 }
 
 text_line_reader::~text_line_reader() {
-  if ( fp != NULL )
+  if ( ( fp != NULL ) || mm.is_open() || ur.is_open() )
     close();
-  if ( buffer ) {
-    free(buffer);
-    buffer = NULL;
+  if ( blk_mem ) {
+    free(blk_mem);
+    blk_mem = blk = NULL;
   }
+  buffer = NULL;
 }
 
 
 // implementations for dsv_hdr_reader class
 
-bool dsv_hdr_reader::open(const char* filename, int32_t _max_line_length, const char* _delim) {
+bool dsv_hdr_reader::open(const char* filename, int32_t _max_line_length, const char* _delim, int32_t threads) {
   delim = _delim;
-  if ( tlr.open(filename, _max_line_length) ) {
+  if ( tlr.open(filename, _max_line_length, threads) ) {
     ret_hdr_line = tlr.readline();
     return true;
   }
-  else return true;
+  else return false;
+}
+
+bool dsv_hdr_reader::seek_line(const tsv_line_index& lidx, uint64_t line) {
+  if ( !tlr.seek_line(lidx, line) )
+    return false;
+  ret_hdr_line = DSV_NOT_YET_PEEKED;
+  return true;
 }
 
 bool dsv_hdr_reader::close() {
@@ -226,7 +1135,8 @@ bool dsv_hdr_reader::read_hdr(const char* prefix_match, const char* prefix_skip,
   std::vector<std::string> pmatch;
   pmatch.push_back(prefix_match);
   std::vector<std::string> pskip;
-  pskip.push_back(prefix_skip);
+  if ( prefix_skip != NULL )
+    pskip.push_back(prefix_skip);
   return read_hdr(pmatch, pskip, ignore_chars);
 }
 
@@ -258,6 +1168,11 @@ bool dsv_hdr_reader::read_hdr(std::vector<std::string>& prefixes_match, std::vec
 }
 
 int32_t dsv_hdr_reader::read_line() {
+  if ( ( checkpoint_every > 0 ) && ( tlr.count_lines / checkpoint_every > checkpoint_last / checkpoint_every ) ) {
+    checkpoint_last = tlr.count_lines;
+    tsv_checkpoint cp;
+    if ( get_checkpoint(cp) ) checkpoint_hook(cp);
+  }
   if ( ret_hdr_line == DSV_NOT_YET_PEEKED ) { // 2nd line or forward. Have to read the line
     if ( tlr.readline() == 0 )
       return 0;
@@ -273,7 +1188,55 @@ int32_t dsv_hdr_reader::read_line() {
   return tokenize_fields();
 }
 
+// A line peeked by open() or read_hdr() but not returned yet is read again after resuming.
+bool dsv_hdr_reader::get_checkpoint(tsv_checkpoint& cp) {
+  if ( !tlr.get_checkpoint(cp, ret_hdr_line > 0) )
+    return false;
+  cp.headers = headers;
+  cp.columns.resize(col2idx.size());
+  for(std::map<std::string,int32_t,std::less<> >::const_iterator it = col2idx.begin(); it != col2idx.end(); ++it) {
+    if ( it->second >= (int32_t)cp.columns.size() ) cp.columns.resize(it->second + 1);
+    cp.columns[it->second] = it->first;
+  }
+  return true;
+}
+
+bool dsv_hdr_reader::resume(const tsv_checkpoint& cp) {
+  if ( !tlr.resume(cp) )
+    return false;
+  headers = cp.headers;
+  col2idx.clear();
+  for(int32_t i=0; i < (int32_t)cp.columns.size(); ++i) {
+    if ( !cp.columns[i].empty() )
+      col2idx[cp.columns[i]] = i;
+  }
+  nfields = 0;
+  ret_hdr_line = DSV_NOT_YET_PEEKED;
+  checkpoint_last = cp.nlines;
+  return true;
+}
+
+bool dsv_hdr_reader::resume(const char* checkpoint_filename) {
+  tsv_checkpoint cp;
+  return cp.load(checkpoint_filename) && resume(cp);
+}
+
+void dsv_hdr_reader::set_checkpoint_hook(uint64_t every, const tsv_checkpoint_hook_t& hook) {
+  checkpoint_every = hook ? every : 0;
+  checkpoint_hook = hook;
+  checkpoint_last = tlr.count_lines;
+}
+
+void dsv_hdr_reader::set_checkpoint_file(const char* checkpoint_filename, uint64_t every, const tsv_checkpoint_hook_t& fill_state) {
+  set_checkpoint_hook(every, tsv_checkpoint::save_hook(checkpoint_filename, fill_state));
+}
+
 int32_t dsv_hdr_reader::tokenize_fields() {
+  if ( tok.quote != 0 ) { // stops at the newline, which is always at the end of the buffer
+    nfields = tok.tokenize(tlr.buffer, tlr.last_line_length, delim.empty() ? ',' : delim[0]);
+    fields.assign(tok.offsets, tok.offsets + nfields);
+    return nfields;
+  }
   tlr.buffer[tlr.last_line_length-1] = '\0';
 
   char* cursor = tlr.buffer;
@@ -289,6 +1252,20 @@ int32_t dsv_hdr_reader::tokenize_fields() {
   return nfields;
 }
 
+bool dsv_hdr_reader::bind_columns(const std::vector<std::string>& colnames, std::vector<int32_t>& handles, std::vector<std::string>* missing) {
+  bool all_found = true;
+  handles.resize(colnames.size());
+  for(int32_t i=0; i < (int32_t)colnames.size(); ++i) {
+    handles[i] = get_colidx(colnames[i].c_str());
+    if ( handles[i] < 0 ) {
+      all_found = false;
+      if ( missing != NULL )
+        missing->push_back(colnames[i]);
+    }
+  }
+  return all_found;
+}
+
 int32_t dsv_hdr_reader::store_to_vector(std::vector<std::string>& v) {
   v.resize(nfields);
   for(int32_t i=0; i < nfields; ++i) {
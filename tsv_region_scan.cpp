@@ -0,0 +1,133 @@
+/* The MIT License
+
+   Copyright (c) 2016-2022 Hyun Min Kang <hmkang@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "qgenlib/tsv_region_scan.h"
+#include "qgenlib/tsv_parallel_scan.h"
+
+#include <thread>
+
+tsv_region_scan::tsv_region_scan(const char* _filename, int32_t _nthreads, int32_t _ntasks) :
+  filename(_filename), nthreads(_nthreads > 0 ? _nthreads : 1), ntasks(_ntasks), max_gap(0), delimiter(0), tokenizer(TSV_TOKENIZER_AUTO), ordered(true) {
+  tbx = tbx_index_load(filename.c_str());
+  if ( tbx == NULL )
+    error("[E:%s:%d %s] Could not load .tbi/.csi index of %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+}
+
+tsv_region_scan::~tsv_region_scan() {
+  if ( tbx != NULL )
+    tbx_destroy(tbx);
+}
+
+int32_t tsv_region_scan::set_regions(const std::vector<std::string>& regs) {
+  std::vector<tsv_region> v;
+  tsv_reader::resolve_regions(tbx, regs, v);
+  return set_regions(v);
+}
+
+int32_t tsv_region_scan::set_regions(const std::vector<GenomeInterval>& intervals) {
+  std::vector<tsv_region> v;
+  tsv_reader::resolve_regions(tbx, intervals, v);
+  return set_regions(v);
+}
+
+int32_t tsv_region_scan::set_regions(const genomeLoci& loci) {
+  std::vector<tsv_region> v;
+  tsv_reader::resolve_regions(tbx, loci, v);
+  return set_regions(v);
+}
+
+int32_t tsv_region_scan::set_regions(const std::vector<tsv_region>& regs) {
+  regions = regs;
+  tasks.clear();
+  return tsv_reader::coalesce_regions(regions);
+}
+
+bool tsv_region_scan::plan() {
+  tasks.clear();
+  int32_t nr = (int32_t)regions.size();
+  int32_t n = ( ntasks > 0 ) ? ntasks : nthreads * 4;
+  if ( n > nr ) n = nr;
+  for(int32_t i=0; i < n; ++i) {
+    tsv_region_task t;
+    t.index = i;
+    t.ibeg = (int32_t)( (int64_t)nr * i / n );
+    t.iend = (int32_t)( (int64_t)nr * (i + 1) / n );
+    tasks.push_back(t);
+  }
+  return true;
+}
+
+uint64_t tsv_region_scan::scan_lines(callback_t line_fn, merge_t merge_fn) {
+  if ( tasks.empty() )
+    plan();
+
+  int32_t nt = (int32_t)tasks.size();
+  tsv_task_merger merger(nt, ordered);
+
+  auto worker = [&]() {
+    tsv_reader tr;
+    if ( !tr.open(filename.c_str()) )
+      error("[E:%s:%d %s] Cannot open file %s for reading", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    tr.delimiter = delimiter;
+    tr.set_tokenizer(tokenizer);
+    if ( !projection.empty() )
+      tr.set_projection(projection);
+    tr.tbx = tbx; // shared, read-only
+    std::vector<tsv_region> sub;
+    int32_t i;
+    while( ( i = merger.next() ) >= 0 ) {
+      tsv_region_task& t = tasks[i];
+      t.nlines = 0; // counted again on each scan, as the tasks are planned once
+      sub.assign(regions.begin() + t.ibeg, regions.begin() + t.iend);
+      tr.jump_to_regions(sub, max_gap);
+      // records overlapping the last region of the previous task were returned there
+      const tsv_region* prev = ( t.ibeg > 0 ) ? &regions[t.ibeg - 1] : NULL;
+      while( tr.read_line() ) {
+        if ( ( prev != NULL ) && ( tr.itr->curr_tid == prev->tid ) && ( tr.itr->curr_beg < prev->end ) )
+          continue;
+        ++t.nlines;
+        line_fn(tr, t);
+      }
+      merger.complete(i);
+    }
+    tr.tbx = NULL; // owned by this object
+    tr.close();
+  };
+
+  std::vector<std::thread> threads;
+  for(int32_t i=0; i < nthreads && i < nt; ++i)
+    threads.emplace_back(worker);
+
+  // merge the completed tasks on the calling thread
+  uint64_t total = 0;
+  merger.merge([&](int32_t i) {
+    tsv_region_task& t = tasks[i];
+    total += t.nlines;
+    if ( merge_fn ) merge_fn(t);
+    std::string().swap(t.out); // release the output once merged
+  });
+
+  for(int32_t i=0; i < (int32_t)threads.size(); ++i)
+    threads[i].join();
+  return total;
+}
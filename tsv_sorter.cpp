@@ -0,0 +1,507 @@
+/* The MIT License
+
+   Copyright (c) 2016-2022 Hyun Min Kang <hmkang@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+
+#include "qgenlib/tsv_sorter.h"
+#include "qgenlib/tsv_reader.h"
+#include "qgenlib/tsv_writer.h"
+#include "qgenlib/num_parser.h"
+#include "qgenlib/qgen_error.h"
+
+#include <algorithm>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <zlib.h>
+
+extern "C" {
+#include "htslib/vcf.h"
+}
+
+#define TSV_SORTER_POS_BITS 40           // bits of the start position in the packed key
+#define TSV_SORTER_MIN_SLICE (1 << 16)   // fewest lines sorted by a separate thread
+#define TSV_SORTER_REC_OVERHEAD ( sizeof(tsv_sorter::sort_key) * 2 + sizeof(uint64_t) + sizeof(uint32_t) )
+
+tsv_sorter::tsv_sorter(int32_t _chrom_col, int32_t _beg_col, int32_t _end_col, bool _zero_based) :
+  chrom_col(_chrom_col), beg_col(_beg_col), end_col(_end_col), zero_based(_zero_based), meta_char('#'),
+  max_mem(TSV_SORTER_DEFAULT_MEM), nthreads(1), level(-1), nlines(0), max_pos(0), last_tid(-1) {
+  const char* tmp = getenv("TMPDIR");
+  tmp_dir = ( ( tmp != NULL ) && ( tmp[0] != '\0' ) ) ? tmp : "/tmp";
+  if ( ( chrom_col < 0 ) || ( beg_col < 0 ) || ( chrom_col == beg_col ) )
+    error("[E:%s:%d %s] Invalid contig (%d) and start (%d) columns", __FILE__, __LINE__, __FUNCTION__, chrom_col, beg_col);
+}
+
+tsv_sorter::~tsv_sorter() {
+  remove_runs();
+}
+
+void tsv_sorter::remove_runs() {
+  for(size_t i=0; i < run_files.size(); ++i)
+    unlink(run_files[i].c_str());
+  run_files.clear();
+}
+
+void tsv_sorter::set_contig_order(const std::vector<std::string>& names) {
+  if ( nlines > 0 )
+    error("[E:%s:%d %s] The contig order must be set before adding lines", __FILE__, __LINE__, __FUNCTION__);
+  contigs.clear();
+  contig2id.clear();
+  last_tid = -1;
+  for(size_t i=0; i < names.size(); ++i) {
+    if ( !contig2id.insert(std::make_pair(names[i], (int32_t)contigs.size())).second )
+      error("[E:%s:%d %s] Contig %s appears twice in the contig order", __FILE__, __LINE__, __FUNCTION__, names[i].c_str());
+    contigs.push_back(names[i]);
+  }
+}
+
+// VCF and BCF files give the order of their header, any other file (.fai,
+// .genome or a plain list) the order of the names in its first column.
+bool tsv_sorter::load_contig_order(const char* filename) {
+  std::vector<std::string> names;
+  const char* exts[] = { ".vcf", ".vcf.gz", ".vcf.bgz", ".bcf" };
+  size_t flen = strlen(filename);
+  bool is_vcf = false;
+  for(size_t i=0; i < sizeof(exts)/sizeof(exts[0]); ++i) {
+    size_t elen = strlen(exts[i]);
+    if ( ( flen >= elen ) && ( strcmp(filename + flen - elen, exts[i]) == 0 ) )
+      is_vcf = true;
+  }
+
+  if ( is_vcf ) {
+    htsFile* fp = hts_open(filename, "r");
+    if ( fp == NULL ) {
+      warning("[%s:%d %s] Cannot open %s", __FILE__, __LINE__, __FUNCTION__, filename);
+      return false;
+    }
+    bcf_hdr_t* hdr = bcf_hdr_read(fp);
+    if ( hdr == NULL ) {
+      hts_close(fp);
+      warning("[%s:%d %s] Cannot read the header of %s", __FILE__, __LINE__, __FUNCTION__, filename);
+      return false;
+    }
+    int32_t nseqs = 0;
+    const char** seqnames = bcf_hdr_seqnames(hdr, &nseqs);
+    for(int32_t i=0; i < nseqs; ++i)
+      names.push_back(seqnames[i]);
+    free(seqnames);
+    bcf_hdr_destroy(hdr);
+    hts_close(fp);
+  }
+  else {
+    text_line_reader tlr;
+    if ( !tlr.open(filename) ) {
+      warning("[%s:%d %s] Cannot open %s", __FILE__, __LINE__, __FUNCTION__, filename);
+      return false;
+    }
+    while( tlr.readline() ) {
+      int32_t l = (int32_t)strcspn(tlr.buffer, "\t \r\n");
+      if ( ( l > 0 ) && ( tlr.buffer[0] != '#' ) )
+        names.push_back(std::string(tlr.buffer, l));
+    }
+    tlr.close();
+  }
+  if ( names.empty() ) {
+    warning("[%s:%d %s] No contig names found in %s", __FILE__, __LINE__, __FUNCTION__, filename);
+    return false;
+  }
+  set_contig_order(names);
+  return true;
+}
+
+int32_t tsv_sorter::contig_to_id(const char* s, int32_t len) {
+  if ( ( last_tid >= 0 ) && ( (int32_t)last_contig.size() == len ) && ( memcmp(last_contig.data(), s, len) == 0 ) )
+    return last_tid;
+  last_contig.assign(s, len);
+  std::map<std::string,int32_t>::iterator it = contig2id.find(last_contig);
+  if ( it != contig2id.end() )
+    return ( last_tid = it->second );
+  if ( contigs.size() >= ( 1ULL << ( 64 - TSV_SORTER_POS_BITS ) ) )
+    error("[E:%s:%d %s] Too many contigs", __FILE__, __LINE__, __FUNCTION__);
+  last_tid = (int32_t)contigs.size();
+  contig2id[last_contig] = last_tid;
+  contigs.push_back(last_contig);
+  return last_tid;
+}
+
+bool tsv_sorter::add_file(const char* filename) {
+  text_line_reader tlr;
+  if ( !tlr.open(filename, 0, nthreads > 1 ? nthreads : 0) ) {
+    warning("[%s:%d %s] Cannot open %s", __FILE__, __LINE__, __FUNCTION__, filename);
+    return false;
+  }
+  while( tlr.readline() ) {
+    int32_t l = tlr.last_line_length;
+    if ( ( l > 0 ) && ( tlr.buffer[l-1] == '\n' ) ) --l;
+    add_line(tlr.buffer, l);
+  }
+  tlr.close();
+  return true;
+}
+
+void tsv_sorter::add_line(const char* s, int32_t len) {
+  if ( len == 0 )
+    return;
+  if ( ( meta_char != 0 ) && ( s[0] == meta_char ) ) {
+    header.append(s, len);
+    header.push_back('\n');
+    return;
+  }
+
+  // locate the key columns
+  int32_t ncols = std::max(chrom_col, std::max(beg_col, end_col)) + 1;
+  const char* col_beg[3] = { NULL, NULL, NULL };
+  const char* col_end[3] = { NULL, NULL, NULL };
+  const char* p = s;
+  const char* e = s + len;
+  for(int32_t c=0; ( c < ncols ) && ( p <= e ); ++c) {
+    const char* q = (const char*)memchr(p, '\t', e - p);
+    if ( q == NULL ) q = e;
+    int32_t k = ( c == chrom_col ) ? 0 : ( ( c == beg_col ) ? 1 : ( ( c == end_col ) ? 2 : -1 ) );
+    if ( k >= 0 ) {
+      col_beg[k] = p;
+      col_end[k] = q;
+    }
+    p = q + 1;
+  }
+  if ( ( col_beg[0] == NULL ) || ( col_beg[1] == NULL ) || ( ( end_col >= 0 ) && ( col_beg[2] == NULL ) ) )
+    error("[E:%s:%d %s] Line %llu has fewer than %d columns: %.*s", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)nlines+1, ncols, len, s);
+
+  sort_key key;
+  int64_t beg, end = 0;
+  if ( !parse_int64(col_beg[1], col_end[1], beg) || ( beg < 0 ) || ( beg >= ( 1LL << TSV_SORTER_POS_BITS ) ) )
+    error("[E:%s:%d %s] Invalid start position at line %llu: %.*s", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)nlines+1, len, s);
+  if ( ( end_col >= 0 ) && ( !parse_int64(col_beg[2], col_end[2], end) || ( end < 0 ) ) )
+    error("[E:%s:%d %s] Invalid end position at line %llu: %.*s", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)nlines+1, len, s);
+  key.hi = ( (uint64_t)contig_to_id(col_beg[0], (int32_t)( col_end[0] - col_beg[0] )) << TSV_SORTER_POS_BITS ) | (uint64_t)beg;
+  key.lo = (uint64_t)end;
+  key.rec = keys.size();
+  if ( beg > max_pos ) max_pos = beg;
+  if ( end > max_pos ) max_pos = end;
+
+  rec_offsets.push_back(arena.size());
+  rec_lengths.push_back((uint32_t)len);
+  arena.insert(arena.end(), s, s + len);
+  keys.push_back(key);
+  ++nlines;
+
+  if ( (int64_t)( arena.size() + keys.size() * TSV_SORTER_REC_OVERHEAD ) >= max_mem )
+    spill();
+}
+
+// A stable LSD radix sort on the 16 bytes of (hi, lo), one byte per pass.
+// All histograms are computed in a single pass over the keys, and the passes
+// on bytes that are equal in every key (e.g. the high bytes of positions
+// within a contig) are skipped.
+static void radix_sort(tsv_sorter::sort_key* a, tsv_sorter::sort_key* tmp, size_t n) {
+  if ( n < 2 ) return;
+  std::vector<uint64_t> counts(16 * 256, 0);
+  for(size_t i=0; i < n; ++i) {
+    uint64_t lo = a[i].lo;
+    uint64_t hi = a[i].hi;
+    for(int32_t b=0; b < 8; ++b) {
+      ++counts[b * 256 + ( ( lo >> ( b * 8 ) ) & 0xff )];
+      ++counts[( b + 8 ) * 256 + ( ( hi >> ( b * 8 ) ) & 0xff )];
+    }
+  }
+  tsv_sorter::sort_key* src = a;
+  tsv_sorter::sort_key* dst = tmp;
+  for(int32_t b=0; b < 16; ++b) {
+    uint64_t* cnt = &counts[b * 256];
+    bool trivial = false;
+    for(int32_t d=0; d < 256; ++d) {
+      if ( cnt[d] == n ) trivial = true;
+      if ( cnt[d] != 0 ) break;
+    }
+    if ( trivial ) continue;
+    uint64_t sum = 0;
+    for(int32_t d=0; d < 256; ++d) {
+      uint64_t c = cnt[d];
+      cnt[d] = sum;
+      sum += c;
+    }
+    int32_t shift = ( b & 7 ) * 8;
+    if ( b < 8 ) {
+      for(size_t i=0; i < n; ++i)
+        dst[cnt[( src[i].lo >> shift ) & 0xff]++] = src[i];
+    }
+    else {
+      for(size_t i=0; i < n; ++i)
+        dst[cnt[( src[i].hi >> shift ) & 0xff]++] = src[i];
+    }
+    std::swap(src, dst);
+  }
+  if ( src != a )
+    memcpy(a, src, n * sizeof(tsv_sorter::sort_key));
+}
+
+void tsv_sorter::sort_slices(std::vector<size_t>& bounds) {
+  size_t n = keys.size();
+  size_t nslices = ( nthreads > 1 ) ? (size_t)nthreads : 1;
+  if ( nslices > n / TSV_SORTER_MIN_SLICE ) nslices = n / TSV_SORTER_MIN_SLICE;
+  if ( nslices < 1 ) nslices = 1;
+  bounds.resize(nslices + 1);
+  for(size_t i=0; i <= nslices; ++i)
+    bounds[i] = n * i / nslices;
+
+  std::vector<sort_key> tmp(n);
+  std::vector<std::thread> workers;
+  for(size_t i=1; i < nslices; ++i)
+    workers.push_back(std::thread(radix_sort, keys.data() + bounds[i], tmp.data() + bounds[i], bounds[i+1] - bounds[i]));
+  radix_sort(keys.data(), tmp.data(), bounds[1]);
+  for(size_t i=0; i < workers.size(); ++i)
+    workers[i].join();
+}
+
+std::string tsv_sorter::new_run() {
+  std::string fn = tmp_dir + "/tsv_sorter.XXXXXX";
+  std::vector<char> tmpl(fn.begin(), fn.end());
+  tmpl.push_back('\0');
+  int fd = mkstemp(tmpl.data());
+  if ( fd < 0 )
+    error("[E:%s:%d %s] Cannot create a temporary file in %s", __FILE__, __LINE__, __FUNCTION__, tmp_dir.c_str());
+  ::close(fd);
+  return std::string(tmpl.data());
+}
+
+// writes records of a run: the key (hi, lo), the length of the line and the line
+namespace {
+  struct run_writer {
+    gzFile gz;
+    std::string filename;
+
+    run_writer(const std::string& fn) : gz(gzopen(fn.c_str(), "wb1")), filename(fn) {
+      if ( gz == NULL )
+        error("[E:%s:%d %s] Cannot write to the temporary file %s", __FILE__, __LINE__, __FUNCTION__, fn.c_str());
+      gzbuffer(gz, 1 << 20);
+    }
+    inline void put(uint64_t hi, uint64_t lo, const char* s, uint32_t len) {
+      char rec[20];
+      memcpy(rec, &hi, 8);
+      memcpy(rec + 8, &lo, 8);
+      memcpy(rec + 16, &len, 4);
+      if ( ( gzwrite(gz, rec, 20) != 20 ) || ( ( len > 0 ) && ( gzwrite(gz, s, len) != (int)len ) ) )
+        error("[E:%s:%d %s] Cannot write to the temporary file %s; is the disk full?", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    }
+    void close() {
+      if ( gzclose(gz) != Z_OK )
+        error("[E:%s:%d %s] Cannot write to the temporary file %s; is the disk full?", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    }
+  };
+
+  // the current record of a run file or of a buffered slice
+  struct merge_cursor {
+    gzFile gz;                      // run file, NULL for a slice
+    const tsv_sorter::sort_key* it; // current key of a slice
+    const tsv_sorter::sort_key* end;
+    std::string line;               // current line of a run file
+    uint64_t hi, lo;
+  };
+
+  // heap entry: the smallest key on top, ties broken by the source order
+  struct merge_entry {
+    uint64_t hi, lo;
+    uint32_t src;
+    inline bool operator<(const merge_entry& o) const {
+      if ( hi != o.hi ) return hi > o.hi;
+      if ( lo != o.lo ) return lo > o.lo;
+      return src > o.src;
+    }
+  };
+
+  bool read_run_record(merge_cursor& c, const std::string& fn) {
+    char rec[20];
+    int n = gzread(c.gz, rec, 20);
+    if ( n == 0 )
+      return false;
+    uint32_t len;
+    memcpy(&c.hi, rec, 8);
+    memcpy(&c.lo, rec + 8, 8);
+    memcpy(&len, rec + 16, 4);
+    c.line.resize(len);
+    if ( ( n != 20 ) || ( ( len > 0 ) && ( gzread(c.gz, &c.line[0], len) != (int)len ) ) )
+      error("[E:%s:%d %s] Truncated temporary file %s", __FILE__, __LINE__, __FUNCTION__, fn.c_str());
+    return true;
+  }
+}
+
+// Each thread writes its sorted slice into its own run, so that spilling is
+// as parallel as sorting.
+void tsv_sorter::spill() {
+  if ( keys.empty() )
+    return;
+  std::vector<size_t> bounds;
+  sort_slices(bounds);
+
+  size_t nslices = bounds.size() - 1;
+  size_t first = run_files.size();
+  for(size_t i=0; i < nslices; ++i)
+    run_files.push_back(new_run());
+
+  std::vector<std::thread> workers;
+  for(size_t i=0; i < nslices; ++i) {
+    workers.push_back(std::thread([this, &bounds, first, i]() {
+      run_writer w(run_files[first + i]);
+      for(size_t j=bounds[i]; j < bounds[i+1]; ++j) {
+        const sort_key& k = keys[j];
+        w.put(k.hi, k.lo, arena.data() + rec_offsets[k.rec], rec_lengths[k.rec]);
+      }
+      w.close();
+    }));
+  }
+  for(size_t i=0; i < workers.size(); ++i)
+    workers[i].join();
+
+  std::vector<char>().swap(arena);
+  std::vector<uint64_t>().swap(rec_offsets);
+  std::vector<uint32_t>().swap(rec_lengths);
+  std::vector<sort_key>().swap(keys);
+}
+
+void tsv_sorter::merge(size_t run_beg, size_t run_end, const std::vector<size_t>* bounds,
+                       const std::function<void(uint64_t, uint64_t, const char*, uint32_t)>& sink) {
+  size_t nslices = ( bounds != NULL ) ? bounds->size() - 1 : 0;
+  std::vector<merge_cursor> cursors(run_end - run_beg + nslices);
+  std::vector<merge_entry> heap;
+  heap.reserve(cursors.size());
+  for(size_t i=0; i < cursors.size(); ++i) {
+    merge_cursor& c = cursors[i];
+    c.gz = NULL;
+    c.it = c.end = NULL;
+    if ( i < run_end - run_beg ) {
+      const std::string& fn = run_files[run_beg + i];
+      c.gz = gzopen(fn.c_str(), "rb");
+      if ( c.gz == NULL )
+        error("[E:%s:%d %s] Cannot read the temporary file %s", __FILE__, __LINE__, __FUNCTION__, fn.c_str());
+      gzbuffer(c.gz, 1 << 18);
+      if ( !read_run_record(c, fn) ) continue;
+    }
+    else {
+      size_t s = i - ( run_end - run_beg );
+      c.it = keys.data() + (*bounds)[s];
+      c.end = keys.data() + (*bounds)[s+1];
+      if ( c.it == c.end ) continue;
+      c.hi = c.it->hi;
+      c.lo = c.it->lo;
+    }
+    merge_entry m = { c.hi, c.lo, (uint32_t)i };
+    heap.push_back(m);
+  }
+  std::make_heap(heap.begin(), heap.end());
+
+  while( !heap.empty() ) {
+    std::pop_heap(heap.begin(), heap.end());
+    merge_entry& top = heap.back();
+    merge_cursor& c = cursors[top.src];
+    bool more;
+    if ( c.gz != NULL ) {
+      sink(c.hi, c.lo, c.line.data(), (uint32_t)c.line.size());
+      more = read_run_record(c, run_files[run_beg + top.src]);
+    }
+    else {
+      sink(c.hi, c.lo, arena.data() + rec_offsets[c.it->rec], rec_lengths[c.it->rec]);
+      if ( ( more = ( ++c.it != c.end ) ) ) {
+        c.hi = c.it->hi;
+        c.lo = c.it->lo;
+      }
+    }
+    if ( more ) {
+      top.hi = c.hi;
+      top.lo = c.lo;
+      std::push_heap(heap.begin(), heap.end());
+    }
+    else
+      heap.pop_back();
+  }
+  for(size_t i=0; i < cursors.size(); ++i)
+    if ( cursors[i].gz != NULL ) gzclose(cursors[i].gz);
+}
+
+// Consecutive groups of runs are merged into single runs, which keeps the
+// runs in input order; the groups of a pass are merged in parallel.
+void tsv_sorter::reduce_runs(size_t max_runs) {
+  if ( max_runs < 2 ) max_runs = 2;
+  while( run_files.size() > max_runs ) {
+    size_t ngroups = ( run_files.size() + TSV_SORTER_MAX_RUNS - 1 ) / TSV_SORTER_MAX_RUNS;
+    std::vector<std::string> merged(ngroups);
+    for(size_t g=0; g < ngroups; ++g)
+      merged[g] = new_run();
+
+    size_t nworkers = std::min((size_t)( nthreads > 1 ? nthreads : 1 ), ngroups);
+    std::vector<std::thread> workers;
+    for(size_t t=0; t < nworkers; ++t) {
+      workers.push_back(std::thread([this, &merged, ngroups, nworkers, t]() {
+        for(size_t g=t; g < ngroups; g += nworkers) {
+          size_t beg = g * TSV_SORTER_MAX_RUNS;
+          size_t end = std::min(beg + TSV_SORTER_MAX_RUNS, run_files.size());
+          run_writer w(merged[g]);
+          merge(beg, end, NULL, [&w](uint64_t hi, uint64_t lo, const char* s, uint32_t len) { w.put(hi, lo, s, len); });
+          w.close();
+        }
+      }));
+    }
+    for(size_t t=0; t < workers.size(); ++t)
+      workers[t].join();
+    remove_runs();
+    run_files.swap(merged);
+  }
+}
+
+bool tsv_sorter::write(const char* out_filename, bool index) {
+  std::vector<size_t> bounds;
+  sort_slices(bounds);
+  reduce_runs(TSV_SORTER_MAX_RUNS > bounds.size() ? TSV_SORTER_MAX_RUNS - bounds.size() + 1 : 2);
+
+  tsv_writer tw;
+  if ( !tw.open(out_filename, nthreads, level) ) {
+    warning("[%s:%d %s] Cannot open %s for writing", __FILE__, __LINE__, __FUNCTION__, out_filename);
+    return false;
+  }
+  if ( index && tw.bgzf ) {
+    tbx_conf_t conf;
+    conf.preset = zero_based ? TBX_UCSC : TBX_GENERIC;
+    conf.sc = chrom_col + 1;
+    conf.bc = beg_col + 1;
+    conf.ec = ( end_col >= 0 ) ? end_col + 1 : 0;
+    conf.meta_char = ( meta_char != 0 ) ? meta_char : '#';
+    conf.line_skip = 0;
+    if ( !tw.set_index(conf, max_pos >= ( 1LL << 29 ) ? 14 : 0) )
+      warning("[%s:%d %s] Cannot index %s", __FILE__, __LINE__, __FUNCTION__, out_filename);
+  }
+
+  if ( !header.empty() ) {
+    for(size_t b=0, e; b < header.size(); b = e + 1) {
+      e = header.find('\n', b);
+      tw.write_line(header.data() + b, (int32_t)( e - b ));
+    }
+  }
+  merge(0, run_files.size(), &bounds, [&tw](uint64_t, uint64_t, const char* s, uint32_t len) { tw.write_line(s, (int32_t)len); });
+  remove_runs();
+
+  std::vector<char>().swap(arena);
+  std::vector<uint64_t>().swap(rec_offsets);
+  std::vector<uint32_t>().swap(rec_lengths);
+  std::vector<sort_key>().swap(keys);
+  header.clear();
+  return tw.close();
+}
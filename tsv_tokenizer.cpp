@@ -0,0 +1,549 @@
+/* The MIT License
+
+   Copyright (c) 2016-2022 Hyun Min Kang <hmkang@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "qgenlib/tsv_tokenizer.h"
+
+extern "C" {
+#include "htslib/kstring.h"
+}
+
+#if ( defined(__x86_64__) || defined(__i386__) ) && ( defined(__GNUC__) || defined(__clang__) )
+#define TSV_TOKENIZER_X86
+#include <immintrin.h>
+#endif
+
+// whitespace in the sense of isspace() under the C locale, without the locale lookup
+static inline bool is_space_char(unsigned char c) {
+  return ( c == ' ' ) || ( (unsigned char)(c - 9) <= 4 );
+}
+
+// state carried across the chunks of a line
+struct tokenize_state {
+  uint64_t prev_delim; // 1 if the character before the chunk was a delimiter (or the line start)
+  int32_t n;           // number of field starts recorded
+  int32_t ne;          // number of field ends recorded (view mode only)
+  int32_t stop;        // offset where tokenization stopped
+  bool view;           // leave the input untouched instead of writing '\0' at field ends
+  uint64_t in_quote;   // all ones if the chunk starts inside a quoted field (CSV mode only)
+};
+
+// consume a chunk of w (<= 64) bytes starting at s[pos], where bit i of dmask
+// is set if s[pos+i] is a delimiter. Records the start and end of every field,
+// and terminates every field by overwriting the delimiter following it with
+// '\0' (except in view mode).
+static inline void consume_mask(char* s, int32_t pos, uint64_t dmask, int32_t w, tokenize_state& st, tsv_tokenizer* t) {
+  uint64_t wmask = ( w == 64 ) ? ~(uint64_t)0 : ( ( (uint64_t)1 << w ) - 1 );
+  uint64_t prevd = ( dmask << 1 ) | st.prev_delim;
+  uint64_t starts = ~dmask & prevd & wmask;
+  uint64_t ends = dmask & ~prevd & wmask;
+  int32_t* offsets = t->offsets;
+  while( starts ) {
+    offsets[st.n++] = pos + __builtin_ctzll(starts);
+    starts &= ( starts - 1 );
+  }
+  int32_t* fends = t->ends;
+  if ( st.view ) {
+    while( ends ) {
+      fends[st.ne++] = pos + __builtin_ctzll(ends);
+      ends &= ( ends - 1 );
+    }
+  }
+  else {
+    while( ends ) {
+      int32_t e = pos + __builtin_ctzll(ends);
+      fends[st.ne++] = e;
+      s[e] = '\0';
+      ends &= ( ends - 1 );
+    }
+  }
+  st.prev_delim = ( dmask >> (w-1) ) & 1;
+}
+
+// build delimiter and newline masks for the last (< 64) bytes one at a time
+static inline void tail_masks(const char* s, int32_t w, int32_t delimiter, uint64_t& dmask, uint64_t& nmask) {
+  dmask = nmask = 0;
+  for(int32_t i=0; i < w; ++i) {
+    unsigned char c = (unsigned char)s[i];
+    if ( delimiter == 0 ? is_space_char(c) : ( c == delimiter ) ) dmask |= ( (uint64_t)1 << i );
+    if ( c == '\n' ) nmask |= ( (uint64_t)1 << i );
+  }
+}
+
+// make room for the fields of the next w bytes
+static inline void reserve_chunk(tsv_tokenizer* t, tokenize_state& st, int32_t w) {
+  t->reserve_ends(st.n + w);
+}
+
+// shared driver for the chunked engines: stops at the first newline in a chunk,
+// or once max_tokens fields are complete
+static inline bool consume_chunk(char* s, int32_t pos, uint64_t dmask, uint64_t nmask, int32_t w, tokenize_state& st, tsv_tokenizer* t) {
+  if ( nmask ) {
+    w = __builtin_ctzll(nmask);
+    st.stop = pos + w;
+    if ( w > 0 ) consume_mask(s, pos, dmask, w, st, t);
+    if ( !st.view ) s[st.stop] = '\0';
+    return false;
+  }
+  consume_mask(s, pos, dmask, w, st, t);
+  if ( ( t->max_tokens > 0 ) && ( st.ne >= t->max_tokens ) ) {
+    st.stop = t->ends[t->max_tokens - 1];
+    return false;
+  }
+  return true;
+}
+
+// close the last field, drop the fields beyond max_tokens, and report the results
+static inline int32_t finish(tsv_tokenizer* t, tokenize_state& st) {
+  if ( st.ne < st.n )
+    t->ends[st.ne++] = st.stop;
+  if ( ( t->max_tokens > 0 ) && ( st.n > t->max_tokens ) ) {
+    st.n = st.ne = t->max_tokens;
+    st.stop = t->ends[st.n - 1];
+  }
+  t->line_length = st.stop;
+  return st.n;
+}
+
+static inline void init_state(tokenize_state& st, int32_t len, bool view) {
+  st.prev_delim = 1;
+  st.n = st.ne = 0;
+  st.stop = len;
+  st.view = view;
+  st.in_quote = 0;
+}
+
+static int32_t tokenize_scalar(tsv_tokenizer* t, char* s, int32_t len, int32_t delimiter, bool view) {
+  tokenize_state st;
+  init_state(st, len, view);
+  for(int32_t pos = 0; pos < len; pos += 64) {
+    int32_t w = ( len - pos < 64 ) ? len - pos : 64;
+    uint64_t dmask, nmask;
+    reserve_chunk(t, st, w);
+    tail_masks(s + pos, w, delimiter, dmask, nmask);
+    if ( !consume_chunk(s, pos, dmask, nmask, w, st, t) )
+      break;
+  }
+  return finish(t, st);
+}
+
+// CSV mode. Quoted sections are found for 64 bytes at a time: the prefix XOR
+// of the quote mask has bit i set if s[i] is inside quotes (counting the
+// opening quote), so that delimiters and newlines there can be masked out.
+// An escaped quote ("") closes and reopens the quotes, and only its second
+// character is marked as quoted, which masks the surrounding bytes correctly.
+static inline uint64_t prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+static inline void csv_tail_masks(const char* s, int32_t w, int32_t delimiter, int32_t quote, uint64_t& dmask, uint64_t& nmask, uint64_t& qmask) {
+  dmask = nmask = qmask = 0;
+  for(int32_t i=0; i < w; ++i) {
+    unsigned char c = (unsigned char)s[i];
+    if ( c == delimiter ) dmask |= ( (uint64_t)1 << i );
+    if ( c == '\n' ) nmask |= ( (uint64_t)1 << i );
+    if ( c == quote ) qmask |= ( (uint64_t)1 << i );
+  }
+}
+
+// consume a chunk of w (<= 64) bytes in CSV mode; every unquoted delimiter
+// ends a field and starts the next one. Nothing is written into the input
+// until csv_finish()
+static inline bool csv_consume_chunk(int32_t pos, uint64_t dmask, uint64_t nmask, uint64_t qmask, int32_t w, tokenize_state& st, tsv_tokenizer* t) {
+  uint64_t inq = prefix_xor(qmask) ^ st.in_quote;
+  dmask &= ~inq;
+  nmask &= ~inq;
+  bool more = true;
+  if ( nmask ) {
+    w = __builtin_ctzll(nmask);
+    st.stop = pos + w;
+    more = false;
+  }
+  if ( w > 0 ) {
+    uint64_t wmask = ( w == 64 ) ? ~(uint64_t)0 : ( ( (uint64_t)1 << w ) - 1 );
+    uint64_t starts = ( ( dmask << 1 ) | st.prev_delim ) & wmask;
+    uint64_t ends = dmask & wmask;
+    int32_t* offsets = t->offsets;
+    int32_t* fends = t->ends;
+    while( starts ) {
+      offsets[st.n++] = pos + __builtin_ctzll(starts);
+      starts &= ( starts - 1 );
+    }
+    while( ends ) {
+      fends[st.ne++] = pos + __builtin_ctzll(ends);
+      ends &= ( ends - 1 );
+    }
+    st.prev_delim = ( dmask >> (w-1) ) & 1;
+    st.in_quote = (uint64_t)0 - ( ( inq >> (w-1) ) & 1 );
+  }
+  if ( more && ( t->max_tokens > 0 ) && ( st.ne >= t->max_tokens ) ) {
+    st.stop = t->ends[t->max_tokens - 1];
+    return false;
+  }
+  return more;
+}
+
+// add the empty field after a trailing delimiter, strip the quotes of quoted
+// fields (unescaping them in place unless in view mode), and terminate the fields
+static int32_t csv_finish(tsv_tokenizer* t, tokenize_state& st, char* s, int32_t len) {
+  if ( st.prev_delim && ( st.stop > 0 ) && ( st.n == st.ne ) ) {
+    t->reserve_ends(st.n + 1);
+    t->offsets[st.n++] = st.stop;
+  }
+  int32_t n = finish(t, st);
+  char q = (char)t->quote;
+  for(int32_t i=0; i < n; ++i) {
+    int32_t b = t->offsets[i];
+    int32_t e = t->ends[i];
+    if ( ( b < e ) && ( s[b] == q ) ) {
+      if ( st.view ) {
+        if ( ( e - 1 > b ) && ( s[e-1] == q ) ) --e;
+      }
+      else {
+        int32_t r = b + 1;
+        int32_t w = b + 1;
+        while( r < e ) {
+          if ( s[r] == q ) {
+            if ( ( r + 1 < e ) && ( s[r+1] == q ) ) { // escaped quote
+              s[w++] = q;
+              r += 2;
+            }
+            else ++r; // closing quote
+          }
+          else s[w++] = s[r++];
+        }
+        e = w;
+      }
+      t->offsets[i] = b + 1;
+      t->ends[i] = e;
+    }
+    if ( !st.view && ( e < len ) )
+      s[e] = '\0';
+  }
+  return n;
+}
+
+static int32_t tokenize_csv_scalar(tsv_tokenizer* t, char* s, int32_t len, int32_t delimiter, bool view) {
+  tokenize_state st;
+  init_state(st, len, view);
+  for(int32_t pos = 0; pos < len; pos += 64) {
+    int32_t w = ( len - pos < 64 ) ? len - pos : 64;
+    uint64_t dmask, nmask, qmask;
+    reserve_chunk(t, st, w);
+    csv_tail_masks(s + pos, w, delimiter, t->quote, dmask, nmask, qmask);
+    if ( !csv_consume_chunk(pos, dmask, nmask, qmask, w, st, t) )
+      break;
+  }
+  return csv_finish(t, st, s, len);
+}
+
+#ifdef TSV_TOKENIZER_X86
+
+__attribute__((target("sse4.2")))
+static int32_t tokenize_csv_sse42(tsv_tokenizer* t, char* s, int32_t len, int32_t delimiter, bool view) {
+  tokenize_state st;
+  init_state(st, len, view);
+  __m128i vd = _mm_set1_epi8((char)delimiter);
+  __m128i vn = _mm_set1_epi8('\n');
+  __m128i vq = _mm_set1_epi8((char)t->quote);
+  int32_t pos = 0;
+  for(; pos + 64 <= len; pos += 64) {
+    uint64_t dmask = 0, nmask = 0, qmask = 0;
+    for(int32_t k=0; k < 4; ++k) {
+      __m128i x = _mm_loadu_si128((const __m128i*)(s + pos + 16*k));
+      dmask |= ( (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, vd)) << (16*k) );
+      nmask |= ( (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, vn)) << (16*k) );
+      qmask |= ( (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, vq)) << (16*k) );
+    }
+    reserve_chunk(t, st, 64);
+    if ( !csv_consume_chunk(pos, dmask, nmask, qmask, 64, st, t) )
+      return csv_finish(t, st, s, len);
+  }
+  if ( pos < len ) {
+    uint64_t dmask, nmask, qmask;
+    int32_t w = len - pos;
+    reserve_chunk(t, st, w);
+    csv_tail_masks(s + pos, w, delimiter, t->quote, dmask, nmask, qmask);
+    csv_consume_chunk(pos, dmask, nmask, qmask, w, st, t);
+  }
+  return csv_finish(t, st, s, len);
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t avx2_eq64(__m256i lo, __m256i hi, __m256i v) {
+  return (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, v))
+    | ( (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, v)) << 32 );
+}
+
+__attribute__((target("avx2")))
+static int32_t tokenize_csv_avx2(tsv_tokenizer* t, char* s, int32_t len, int32_t delimiter, bool view) {
+  tokenize_state st;
+  init_state(st, len, view);
+  __m256i vd = _mm256_set1_epi8((char)delimiter);
+  __m256i vn = _mm256_set1_epi8('\n');
+  __m256i vq = _mm256_set1_epi8((char)t->quote);
+  int32_t pos = 0;
+  for(; pos + 64 <= len; pos += 64) {
+    __m256i lo = _mm256_loadu_si256((const __m256i*)(s + pos));
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(s + pos + 32));
+    reserve_chunk(t, st, 64);
+    if ( !csv_consume_chunk(pos, avx2_eq64(lo, hi, vd), avx2_eq64(lo, hi, vn), avx2_eq64(lo, hi, vq), 64, st, t) )
+      return csv_finish(t, st, s, len);
+  }
+  if ( pos < len ) {
+    uint64_t dmask, nmask, qmask;
+    int32_t w = len - pos;
+    reserve_chunk(t, st, w);
+    csv_tail_masks(s + pos, w, delimiter, t->quote, dmask, nmask, qmask);
+    csv_consume_chunk(pos, dmask, nmask, qmask, w, st, t);
+  }
+  return csv_finish(t, st, s, len);
+}
+
+#endif // TSV_TOKENIZER_X86
+
+// dispatch the CSV mode to the engine in use; ksplit has no CSV mode, and is replaced by the scalar engine
+static int32_t tokenize_csv(tsv_tokenizer* t, char* s, int32_t len, int32_t delimiter, bool view) {
+  if ( delimiter == 0 ) delimiter = ',';
+  switch(t->engine) {
+#ifdef TSV_TOKENIZER_X86
+  case TSV_TOKENIZER_AVX2:
+    return tokenize_csv_avx2(t, s, len, delimiter, view);
+  case TSV_TOKENIZER_SSE42:
+    return tokenize_csv_sse42(t, s, len, delimiter, view);
+#endif
+  default:
+    return tokenize_csv_scalar(t, s, len, delimiter, view);
+  }
+}
+
+bool tsv_tokenizer::has_open_quote(const char* s, int32_t len) const {
+  if ( quote == 0 ) return false;
+  bool open = false;
+  const char* end = s + len;
+  while( ( s = (const char*)memchr(s, quote, end - s) ) != NULL ) {
+    open = !open;
+    ++s;
+  }
+  return open;
+}
+
+#ifdef TSV_TOKENIZER_X86
+
+__attribute__((target("sse4.2")))
+static inline uint64_t sse42_mask16(__m128i x, __m128i vd, bool ws) {
+  __m128i m;
+  if ( ws ) {
+    __m128i y = _mm_sub_epi8(x, _mm_set1_epi8(9));
+    m = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                     _mm_cmpeq_epi8(_mm_min_epu8(y, _mm_set1_epi8(4)), y));
+  }
+  else {
+    m = _mm_cmpeq_epi8(x, vd);
+  }
+  return (uint64_t)(uint32_t)_mm_movemask_epi8(m);
+}
+
+__attribute__((target("sse4.2")))
+static int32_t tokenize_sse42(tsv_tokenizer* t, char* s, int32_t len, int32_t delimiter, bool view) {
+  tokenize_state st;
+  init_state(st, len, view);
+  bool ws = ( delimiter == 0 );
+  __m128i vd = _mm_set1_epi8((char)delimiter);
+  __m128i vn = _mm_set1_epi8('\n');
+  int32_t pos = 0;
+  for(; pos + 64 <= len; pos += 64) {
+    uint64_t dmask = 0, nmask = 0;
+    for(int32_t k=0; k < 4; ++k) {
+      __m128i x = _mm_loadu_si128((const __m128i*)(s + pos + 16*k));
+      dmask |= ( sse42_mask16(x, vd, ws) << (16*k) );
+      nmask |= ( (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, vn)) << (16*k) );
+    }
+    reserve_chunk(t, st, 64);
+    if ( !consume_chunk(s, pos, dmask, nmask, 64, st, t) )
+      return finish(t, st);
+  }
+  if ( pos < len ) {
+    uint64_t dmask, nmask;
+    int32_t w = len - pos;
+    reserve_chunk(t, st, w);
+    tail_masks(s + pos, w, delimiter, dmask, nmask);
+    consume_chunk(s, pos, dmask, nmask, w, st, t);
+  }
+  return finish(t, st);
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t avx2_mask32(__m256i x, __m256i vd, bool ws) {
+  __m256i m;
+  if ( ws ) {
+    __m256i y = _mm256_sub_epi8(x, _mm256_set1_epi8(9));
+    m = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                        _mm256_cmpeq_epi8(_mm256_min_epu8(y, _mm256_set1_epi8(4)), y));
+  }
+  else {
+    m = _mm256_cmpeq_epi8(x, vd);
+  }
+  return (uint64_t)(uint32_t)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static int32_t tokenize_avx2(tsv_tokenizer* t, char* s, int32_t len, int32_t delimiter, bool view) {
+  tokenize_state st;
+  init_state(st, len, view);
+  bool ws = ( delimiter == 0 );
+  __m256i vd = _mm256_set1_epi8((char)delimiter);
+  __m256i vn = _mm256_set1_epi8('\n');
+  int32_t pos = 0;
+  for(; pos + 64 <= len; pos += 64) {
+    __m256i lo = _mm256_loadu_si256((const __m256i*)(s + pos));
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(s + pos + 32));
+    uint64_t dmask = avx2_mask32(lo, vd, ws) | ( avx2_mask32(hi, vd, ws) << 32 );
+    uint64_t nmask = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, vn))
+      | ( (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, vn)) << 32 );
+    reserve_chunk(t, st, 64);
+    if ( !consume_chunk(s, pos, dmask, nmask, 64, st, t) )
+      return finish(t, st);
+  }
+  if ( pos < len ) {
+    uint64_t dmask, nmask;
+    int32_t w = len - pos;
+    reserve_chunk(t, st, w);
+    tail_masks(s + pos, w, delimiter, dmask, nmask);
+    consume_chunk(s, pos, dmask, nmask, w, st, t);
+  }
+  return finish(t, st);
+}
+
+#endif // TSV_TOKENIZER_X86
+
+bool tsv_tokenizer::is_supported(int32_t _engine) {
+  switch(_engine) {
+  case TSV_TOKENIZER_KSPLIT:
+  case TSV_TOKENIZER_SCALAR:
+  case TSV_TOKENIZER_AUTO:
+    return true;
+#ifdef TSV_TOKENIZER_X86
+  case TSV_TOKENIZER_SSE42:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+  case TSV_TOKENIZER_AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+int32_t tsv_tokenizer::best_engine() {
+  static int32_t best = -1;
+  if ( best < 0 ) {
+    if ( is_supported(TSV_TOKENIZER_AVX2) ) best = TSV_TOKENIZER_AVX2;
+    else if ( is_supported(TSV_TOKENIZER_SSE42) ) best = TSV_TOKENIZER_SSE42;
+    else best = TSV_TOKENIZER_SCALAR;
+  }
+  return best;
+}
+
+const char* tsv_tokenizer::engine_name(int32_t _engine) {
+  switch(_engine) {
+  case TSV_TOKENIZER_KSPLIT: return "ksplit";
+  case TSV_TOKENIZER_SCALAR: return "scalar";
+  case TSV_TOKENIZER_SSE42:  return "sse4.2";
+  case TSV_TOKENIZER_AVX2:   return "avx2";
+  case TSV_TOKENIZER_AUTO:   return "auto";
+  default:                   return "unknown";
+  }
+}
+
+bool tsv_tokenizer::set_engine(int32_t _engine) {
+  if ( _engine == TSV_TOKENIZER_AUTO ) {
+    engine = best_engine();
+    return true;
+  }
+  else if ( is_supported(_engine) ) {
+    engine = _engine;
+    return true;
+  }
+  else {
+    engine = best_engine();
+    return false;
+  }
+}
+
+int32_t tsv_tokenizer::tokenize(char* s, int32_t len, int32_t delimiter) {
+  if ( quote != 0 ) {
+    nfields = tokenize_csv(this, s, len, delimiter, false);
+    return nfields;
+  }
+  switch(engine) {
+#ifdef TSV_TOKENIZER_X86
+  case TSV_TOKENIZER_AVX2:
+    nfields = tokenize_avx2(this, s, len, delimiter, false);
+    break;
+  case TSV_TOKENIZER_SSE42:
+    nfields = tokenize_sse42(this, s, len, delimiter, false);
+    break;
+#endif
+  case TSV_TOKENIZER_KSPLIT: // always splits the whole line
+    nfields = ksplit_core(s, delimiter, &max_fields, &offsets);
+    if ( ( max_tokens > 0 ) && ( nfields > max_tokens ) )
+      nfields = max_tokens;
+    reserve_ends(nfields);
+    for(int32_t i=0; i < nfields; ++i)
+      ends[i] = offsets[i] + (int32_t)strlen(s + offsets[i]);
+    line_length = len;
+    break;
+  default:
+    nfields = tokenize_scalar(this, s, len, delimiter, false);
+  }
+  return nfields;
+}
+
+// ksplit_core() always writes into the line, so the scalar engine stands in for it
+int32_t tsv_tokenizer::tokenize_view(const char* s, int32_t len, int32_t delimiter) {
+  char* p = const_cast<char*>(s); // never written in view mode
+  if ( quote != 0 ) {
+    nfields = tokenize_csv(this, p, len, delimiter, true);
+    return nfields;
+  }
+  switch(engine) {
+#ifdef TSV_TOKENIZER_X86
+  case TSV_TOKENIZER_AVX2:
+    nfields = tokenize_avx2(this, p, len, delimiter, true);
+    break;
+  case TSV_TOKENIZER_SSE42:
+    nfields = tokenize_sse42(this, p, len, delimiter, true);
+    break;
+#endif
+  default:
+    nfields = tokenize_scalar(this, p, len, delimiter, true);
+  }
+  return nfields;
+}
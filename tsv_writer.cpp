@@ -0,0 +1,400 @@
+/* The MIT License
+
+   Copyright (c) 2016-2022 Hyun Min Kang <hmkang@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "qgenlib/tsv_writer.h"
+
+#include <cstdio>
+#include <climits>
+#include <atomic>
+#include <zlib.h>
+
+#define BGZF_BLOCK_SIZE     0xff00  // uncompressed bytes per block, as in htslib
+#define BGZF_MAX_BLOCK_SIZE 0x10000 // maximum size of a compressed block
+#define BGZF_HEADER_SIZE    18
+#define BGZF_FOOTER_SIZE    8
+#define TSV_WRITER_BATCH    64      // blocks compressed together in the background
+#define TSV_WRITER_MAX_SHIFT 31     // largest position supported by CSI indices, as in tabix
+#define TSV_WRITER_MAX_COLS 64      // columns located for indexing (1-based)
+
+static const uint8_t bgzf_eof_block[28] = {
+  0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 0x42, 0x43, 0x02, 0, 0x1b, 0, 0x03, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+static inline void put_le16(uint8_t* p, uint32_t v) { p[0] = v & 0xff; p[1] = ( v >> 8 ) & 0xff; }
+static inline void put_le32(uint8_t* p, uint32_t v) { put_le16(p, v & 0xffff); put_le16(p + 2, v >> 16); }
+
+// compress src into a single BGZF block at dst, returns the size of the block
+static int32_t bgzf_compress_block(uint8_t* dst, const char* src, int32_t slen, int32_t level) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if ( deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK )
+    error("[E:%s:%d %s] deflateInit2() failed", __FILE__, __LINE__, __FUNCTION__);
+  zs.next_in = (Bytef*)src;
+  zs.avail_in = slen;
+  zs.next_out = dst + BGZF_HEADER_SIZE;
+  zs.avail_out = BGZF_MAX_BLOCK_SIZE - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+  if ( deflate(&zs, Z_FINISH) != Z_STREAM_END ) // a full block always fits, even if incompressible
+    error("[E:%s:%d %s] deflate() failed", __FILE__, __LINE__, __FUNCTION__);
+  int32_t clen = (int32_t)zs.total_out;
+  deflateEnd(&zs);
+
+  int32_t bsize = clen + BGZF_HEADER_SIZE + BGZF_FOOTER_SIZE;
+  memcpy(dst, bgzf_eof_block, BGZF_HEADER_SIZE); // same header, except for the block size
+  put_le16(dst + 16, bsize - 1);
+  put_le32(dst + BGZF_HEADER_SIZE + clen, (uint32_t)crc32(crc32(0L, NULL, 0), (const Bytef*)src, slen));
+  put_le32(dst + BGZF_HEADER_SIZE + clen + 4, (uint32_t)slen);
+  return bsize;
+}
+
+static inline bool has_suffix(const std::string& s, const char* suffix) {
+  size_t l = strlen(suffix);
+  return ( s.size() >= l ) && ( s.compare(s.size() - l, l, suffix) == 0 );
+}
+
+tsv_writer::~tsv_writer() {
+  if ( fp != NULL ) close();
+  if ( buf != NULL ) free(buf);
+  if ( spare != NULL ) free(spare);
+}
+
+bool tsv_writer::open(const char* _filename, int32_t threads, int32_t _level) {
+  filename = _filename;
+  fp = hopen(_filename, "w");
+  if ( fp == NULL )
+    return false;
+  bgzf = has_suffix(filename, ".gz") || has_suffix(filename, ".bgz");
+  nthreads = ( threads > 0 ) ? threads : 1;
+  level = _level;
+  nlines = 0;
+  len = line_beg = 0;
+  nfields_line = 0;
+  ubeg = 0;
+  nblocks_done = batch_first_block = 0;
+  caddr_done = 0;
+  grow((int64_t)TSV_WRITER_BATCH * BGZF_BLOCK_SIZE + 65536);
+  return true;
+}
+
+bool tsv_writer::set_bgzf(bool _bgzf) {
+  if ( ( ubeg > 0 ) || ( len > 0 ) )
+    return false;
+  bgzf = _bgzf;
+  return true;
+}
+
+bool tsv_writer::set_index(const tbx_conf_t& _conf, int32_t _min_shift) {
+  if ( !bgzf ) {
+    warning("[%s:%d %s] Cannot index %s, which is not BGZF-compressed", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    return false;
+  }
+  if ( ( ubeg > 0 ) || ( len > 0 ) || ( filename == "-" ) )
+    return false;
+  if ( ( _conf.preset & 0xffff ) == TBX_SAM ) {
+    warning("[%s:%d %s] On-the-fly indexing of SAM records is not supported", __FILE__, __LINE__, __FUNCTION__);
+    return false;
+  }
+  if ( ( _conf.sc < 1 ) || ( _conf.bc < 1 ) || ( _conf.sc >= TSV_WRITER_MAX_COLS ) || ( _conf.bc >= TSV_WRITER_MAX_COLS ) || ( _conf.ec >= TSV_WRITER_MAX_COLS ) ) {
+    warning("[%s:%d %s] Invalid tabix columns %d, %d, %d", __FILE__, __LINE__, __FUNCTION__, _conf.sc, _conf.bc, _conf.ec);
+    return false;
+  }
+  conf = _conf;
+  min_shift = _min_shift;
+  idx_fmt = ( min_shift > 0 ) ? HTS_FMT_CSI : HTS_FMT_TBI;
+  return true;
+}
+
+void tsv_writer::grow(int64_t need) {
+  if ( need <= cap ) return;
+  int64_t new_cap = ( cap > 0 ) ? cap : 65536;
+  while( new_cap < need ) new_cap *= 2;
+  buf = (char*)realloc(buf, new_cap);
+  if ( buf == NULL )
+    error("[E:%s:%d %s] Cannot allocate %lld bytes", __FILE__, __LINE__, __FUNCTION__, (long long)new_cap);
+  cap = new_cap;
+}
+
+void tsv_writer::put_int(int64_t v) {
+  char tmp[24];
+  char* e = tmp + sizeof(tmp);
+  char* p = e;
+  uint64_t u = ( v < 0 ) ? ( 0 - (uint64_t)v ) : (uint64_t)v;
+  do { *--p = (char)( '0' + u % 10 ); u /= 10; } while( u > 0 );
+  if ( v < 0 ) *--p = '-';
+  put_str(p, (int32_t)( e - p ));
+}
+
+void tsv_writer::put_uint(uint64_t v) {
+  char tmp[24];
+  char* e = tmp + sizeof(tmp);
+  char* p = e;
+  do { *--p = (char)( '0' + v % 10 ); v /= 10; } while( v > 0 );
+  put_str(p, (int32_t)( e - p ));
+}
+
+void tsv_writer::put_double(double v, int32_t digits) {
+  int32_t room = 32 + ( digits > 0 ? digits : 0 );
+  char* p = reserve_field(room);
+  len += snprintf(p, room, "%.*g", digits, v);
+}
+
+void tsv_writer::put_fixed(double v, int32_t decimals) {
+  int32_t room = 320 + ( decimals > 0 ? decimals : 0 ); // DBL_MAX has 309 integral digits
+  char* p = reserve_field(room);
+  len += snprintf(p, room, "%.*f", decimals, v);
+}
+
+void tsv_writer::end_line() {
+  if ( len + 1 > cap ) grow(len + 1);
+  buf[len++] = '\n';
+  if ( idx_fmt >= 0 )
+    index_line(buf + line_beg, (int32_t)( len - line_beg - 1 ));
+  ++nlines;
+  nfields_line = 0;
+  line_beg = len;
+  if ( len >= (int64_t)TSV_WRITER_BATCH * BGZF_BLOCK_SIZE )
+    flush(false);
+}
+
+// locate the interval of a record as tabix does, and queue it for the index
+void tsv_writer::index_line(const char* s, int32_t l) {
+  if ( ( (int64_t)nlines < conf.line_skip ) || ( ( l > 0 ) && ( s[0] == conf.meta_char ) ) )
+    return;
+  int32_t ncols = conf.sc;
+  if ( conf.bc > ncols ) ncols = conf.bc;
+  if ( conf.ec > ncols ) ncols = conf.ec;
+  if ( ( conf.preset & 0xffff ) == TBX_VCF ) ncols = 8;
+
+  const char* col[TSV_WRITER_MAX_COLS] = { NULL }; // start of the 1-based columns
+  int32_t clen[TSV_WRITER_MAX_COLS] = { 0 };
+  int32_t c = 1;
+  const char* p = s;
+  const char* e = s + l;
+  while( ( c <= ncols ) && ( p <= e ) ) {
+    const char* q = (const char*)memchr(p, '\t', e - p);
+    if ( q == NULL ) q = e;
+    col[c] = p;
+    clen[c] = (int32_t)( q - p );
+    ++c;
+    p = q + 1;
+  }
+  if ( ( col[conf.sc] == NULL ) || ( col[conf.bc] == NULL ) )
+    error("[E:%s:%d %s] Line %llu of %s has too few columns to be indexed", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)nlines + 1, filename.c_str());
+
+  idx_entry r;
+  r.beg = strtoll(col[conf.bc], NULL, 10);
+  if ( !( conf.preset & TBX_UCSC ) ) --r.beg;
+  if ( r.beg < 0 ) r.beg = 0;
+  r.end = r.beg + 1;
+  if ( ( conf.preset & 0xffff ) == TBX_VCF ) {
+    if ( col[4] != NULL ) r.end = r.beg + clen[4]; // length of REF
+    for(const char* q = col[8]; ( q != NULL ) && ( q + 4 <= col[8] + clen[8] ); ) { // END in INFO
+      if ( strncmp(q, "END=", 4) == 0 ) {
+        hts_pos_t end1 = strtoll(q + 4, NULL, 10);
+        if ( end1 > r.beg ) r.end = end1;
+        break;
+      }
+      q = (const char*)memchr(q, ';', col[8] + clen[8] - q);
+      if ( q != NULL ) ++q;
+    }
+  }
+  else if ( ( conf.ec > 0 ) && ( col[conf.ec] != NULL ) )
+    r.end = strtoll(col[conf.ec], NULL, 10);
+  if ( r.end <= r.beg ) r.end = r.beg + 1;
+
+  const char* name = col[conf.sc];
+  int32_t lname = clen[conf.sc];
+  if ( ( last_tid >= 0 ) && ( (int32_t)seqnames[last_tid].size() == lname ) && ( memcmp(seqnames[last_tid].data(), name, lname) == 0 ) )
+    r.tid = last_tid;
+  else {
+    std::string name(col[conf.sc], lname);
+    std::map<std::string,int32_t>::iterator it = seq2tid.find(name);
+    if ( it != seq2tid.end() )
+      error("[E:%s:%d %s] Records of %s are not contiguous in %s, which cannot be indexed", __FILE__, __LINE__, __FUNCTION__, name.c_str(), filename.c_str());
+    r.tid = (int32_t)seqnames.size();
+    seq2tid[name] = r.tid;
+    seqnames.push_back(name);
+  }
+  last_tid = r.tid;
+
+  if ( first_data < 0 )
+    first_data = (int64_t)( ubeg + line_beg );
+  r.uend = ubeg + len;
+  pending.push_back(r);
+}
+
+// hand the complete blocks of buf (or everything if final) to the background compressor
+void tsv_writer::flush(bool final) {
+  if ( !bgzf ) {
+    if ( ( len > 0 ) && ( hwrite(fp, buf, len) != (ssize_t)len ) )
+      error("[E:%s:%d %s] Cannot write to %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    ubeg += len;
+    len = line_beg = 0;
+    return;
+  }
+  wait();
+  int64_t n = final ? len : ( len / BGZF_BLOCK_SIZE * BGZF_BLOCK_SIZE );
+  if ( n == 0 ) return;
+
+  // swap the buffers, keeping the incomplete block in the new current buffer
+  if ( spare_cap < cap ) {
+    spare = (char*)realloc(spare, cap);
+    if ( spare == NULL )
+      error("[E:%s:%d %s] Cannot allocate %lld bytes", __FILE__, __LINE__, __FUNCTION__, (long long)cap);
+    spare_cap = cap;
+  }
+  memcpy(spare, buf + n, len - n);
+  std::swap(buf, spare);
+  std::swap(cap, spare_cap);
+  len -= n;
+  line_beg -= n;
+  ubeg += n;
+
+  batch_first_block = nblocks_done;
+  busy = true;
+  worker = std::thread(&tsv_writer::compress_blocks, this, n);
+  if ( final ) wait();
+}
+
+// runs in the background: compress the first n bytes of spare, and write the blocks.
+// The calling thread does not touch spare, cbuf, block_addrs or caddr_done until wait()
+void tsv_writer::compress_blocks(int64_t n) {
+  int32_t nb = (int32_t)( ( n + BGZF_BLOCK_SIZE - 1 ) / BGZF_BLOCK_SIZE );
+  if ( cbuf.size() < (size_t)nb * BGZF_MAX_BLOCK_SIZE )
+    cbuf.resize((size_t)nb * BGZF_MAX_BLOCK_SIZE);
+  std::vector<int32_t> sizes(nb);
+  std::atomic<int32_t> next(0);
+  auto compress = [&]() {
+    int32_t i;
+    while( ( i = next++ ) < nb ) {
+      int64_t off = (int64_t)i * BGZF_BLOCK_SIZE;
+      int32_t slen = (int32_t)( ( n - off < BGZF_BLOCK_SIZE ) ? n - off : BGZF_BLOCK_SIZE );
+      sizes[i] = bgzf_compress_block(&cbuf[(size_t)i * BGZF_MAX_BLOCK_SIZE], spare + off, slen, level);
+    }
+  };
+  std::vector<std::thread> helpers;
+  for(int32_t i=1; ( i < nthreads ) && ( i < nb ); ++i)
+    helpers.emplace_back(compress);
+  compress();
+  for(int32_t i=0; i < (int32_t)helpers.size(); ++i)
+    helpers[i].join();
+
+  block_addrs.resize(nb);
+  for(int32_t i=0; i < nb; ++i) {
+    if ( hwrite(fp, &cbuf[(size_t)i * BGZF_MAX_BLOCK_SIZE], sizes[i]) != sizes[i] )
+      error("[E:%s:%d %s] Cannot write to %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    block_addrs[i] = caddr_done;
+    caddr_done += sizes[i];
+  }
+}
+
+// wait for the background compression, and index the records it has written
+void tsv_writer::wait() {
+  if ( !busy ) return;
+  worker.join();
+  busy = false;
+  nblocks_done += block_addrs.size();
+  if ( idx_fmt >= 0 )
+    resolve_pending(false);
+}
+
+// virtual offset of an uncompressed offset, if its block was written by the last batch
+uint64_t tsv_writer::voffset(uint64_t u, bool& known) {
+  uint64_t k = u / BGZF_BLOCK_SIZE;
+  uint64_t w = u % BGZF_BLOCK_SIZE;
+  known = true;
+  if ( ( k == nblocks_done ) && ( w == 0 ) )
+    return (uint64_t)caddr_done << 16;
+  if ( ( k >= batch_first_block ) && ( k < nblocks_done ) )
+    return ( (uint64_t)block_addrs[k - batch_first_block] << 16 ) | w;
+  if ( k < batch_first_block )
+    error("[E:%s:%d %s] Offset %llu of %s was not indexed in time", __FILE__, __LINE__, __FUNCTION__, (unsigned long long)u, filename.c_str());
+  known = false;
+  return 0;
+}
+
+void tsv_writer::resolve_pending(bool final) {
+  bool known;
+  if ( ( idx == NULL ) && ( first_data >= 0 || final ) ) {
+    uint64_t v0 = voffset(first_data >= 0 ? (uint64_t)first_data : ubeg + len, known);
+    if ( known ) {
+      int32_t n_lvls = ( idx_fmt == HTS_FMT_CSI ) ? ( TSV_WRITER_MAX_SHIFT - min_shift + 2 ) / 3 : 5;
+      idx = hts_idx_init(0, idx_fmt, v0, idx_fmt == HTS_FMT_CSI ? min_shift : 14, n_lvls);
+      if ( idx == NULL )
+        error("[E:%s:%d %s] Cannot initialize the index of %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    }
+  }
+  while( !pending.empty() ) {
+    idx_entry& r = pending.front();
+    uint64_t v = voffset(r.uend, known);
+    if ( !known ) break;
+    if ( hts_idx_push(idx, r.tid, r.beg, r.end, v, 1) < 0 )
+      error("[E:%s:%d %s] Cannot index %s; are the records sorted?", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    pending.pop_front();
+  }
+}
+
+bool tsv_writer::close() {
+  if ( fp == NULL ) return false;
+  if ( nfields_line > 0 ) end_line();
+  flush(true);
+  wait();
+  bool ok = true;
+  if ( bgzf && ( hwrite(fp, bgzf_eof_block, sizeof(bgzf_eof_block)) != (ssize_t)sizeof(bgzf_eof_block) ) )
+    ok = false;
+
+  if ( idx_fmt >= 0 ) {
+    resolve_pending(true);
+    bool known;
+    uint64_t vend = voffset(ubeg, known);
+    if ( !known || !pending.empty() || ( hts_idx_finish(idx, vend) < 0 ) )
+      error("[E:%s:%d %s] Cannot finish the index of %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+
+    // tabix meta data: the configuration followed by the sequence names
+    std::string names;
+    for(int32_t i=0; i < (int32_t)seqnames.size(); ++i) {
+      names += seqnames[i];
+      names += '\0';
+    }
+    uint32_t l_meta = 28 + (uint32_t)names.size();
+    uint8_t* meta = (uint8_t*)malloc(l_meta);
+    int32_t x[7] = { conf.preset, conf.sc, conf.bc, conf.ec, conf.meta_char, conf.line_skip, (int32_t)names.size() };
+    for(int32_t i=0; i < 7; ++i)
+      put_le32(meta + 4 * i, (uint32_t)x[i]);
+    memcpy(meta + 28, names.data(), names.size());
+    if ( hts_idx_set_meta(idx, l_meta, meta, 0) < 0 ) // takes ownership of meta
+      error("[E:%s:%d %s] Cannot set the index meta data of %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    if ( hts_idx_save_as(idx, filename.c_str(), NULL, idx_fmt) < 0 )
+      error("[E:%s:%d %s] Cannot save the index of %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str());
+    hts_idx_destroy(idx);
+    idx = NULL;
+    idx_fmt = -1;
+    pending.clear();
+    seqnames.clear();
+    seq2tid.clear();
+    first_data = last_tid = -1;
+  }
+
+  if ( hclose(fp) != 0 ) ok = false;
+  fp = NULL;
+  return ok;
+}
@@ -0,0 +1,334 @@
+/* The MIT License
+
+   Copyright (c) 2016-2022 Hyun Min Kang <hmkang@umich.edu>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+
+#include "qgenlib/uring_reader.h"
+#include "qgenlib/qgen_error.h"
+
+#include <cstdlib>
+#include <cerrno>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(QGEN_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define QGEN_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef QGEN_HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// the submission and completion rings shared with the kernel
+struct uring_reader::uring {
+  int fd;
+  unsigned *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+  void* sq_ptr;
+  void* cq_ptr;
+  size_t sq_size, cq_size, sqes_size;
+  std::vector<struct iovec> iov; // one per slot, read by the kernel at submission
+
+  uring() : fd(-1), sqes((struct io_uring_sqe*)MAP_FAILED), sq_ptr(MAP_FAILED), cq_ptr(MAP_FAILED) {}
+
+  bool setup(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if ( fd < 0 )
+      return false;
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = ( p.features & IORING_FEAT_SINGLE_MMAP ) != 0;
+    if ( single ) {
+      if ( cq_size > sq_size ) sq_size = cq_size;
+      cq_size = sq_size;
+    }
+    sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if ( sq_ptr == MAP_FAILED )
+      return false;
+    cq_ptr = single ? sq_ptr : mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if ( cq_ptr == MAP_FAILED )
+      return false;
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe*)mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if ( sqes == MAP_FAILED )
+      return false;
+    sq_tail = (unsigned*)( (char*)sq_ptr + p.sq_off.tail );
+    sq_mask = (unsigned*)( (char*)sq_ptr + p.sq_off.ring_mask );
+    sq_array = (unsigned*)( (char*)sq_ptr + p.sq_off.array );
+    cq_head = (unsigned*)( (char*)cq_ptr + p.cq_off.head );
+    cq_tail = (unsigned*)( (char*)cq_ptr + p.cq_off.tail );
+    cq_mask = (unsigned*)( (char*)cq_ptr + p.cq_off.ring_mask );
+    cqes = (struct io_uring_cqe*)( (char*)cq_ptr + p.cq_off.cqes );
+    return true;
+  }
+
+  ~uring() {
+    if ( sqes != MAP_FAILED ) munmap(sqes, sqes_size);
+    if ( ( cq_ptr != MAP_FAILED ) && ( cq_ptr != sq_ptr ) ) munmap(cq_ptr, cq_size);
+    if ( sq_ptr != MAP_FAILED ) munmap(sq_ptr, sq_size);
+    if ( fd >= 0 ) ::close(fd);
+  }
+
+  inline int enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+  }
+};
+
+bool uring_reader::available() {
+  static int ok = -1; // probed once; a failed setup is cheap, but the answer does not change
+  if ( ok < 0 ) {
+    uring r;
+    ok = r.setup(2) ? 1 : 0;
+  }
+  return ok == 1;
+}
+#else
+struct uring_reader::uring {};
+
+bool uring_reader::available() {
+  return false;
+}
+#endif
+
+bool uring_reader::open(const char* _filename, int32_t _queue_depth, int64_t _block_size) {
+  if ( is_open() )
+    close();
+  filename = _filename;
+#ifdef QGEN_HAVE_IO_URING
+  if ( !available() )
+    return false;
+  fd = ::open(_filename, O_RDONLY);
+  if ( fd < 0 )
+    return false;
+  struct stat st;
+  if ( ( fstat(fd, &st) != 0 ) || !S_ISREG(st.st_mode) ) { // pipes are read in order by the usual path
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+  size = (uint64_t)st.st_size;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  queue_depth = _queue_depth > 1 ? _queue_depth : 2; // the previous block is kept until the next one is ready
+  block_size = ( _block_size + 4095 ) / 4096 * 4096;
+  if ( block_size <= 0 ) block_size = URING_READER_BLOCK_SIZE;
+
+  ring = new uring;
+  if ( !ring->setup((unsigned)queue_depth) ) {
+    close();
+    return false;
+  }
+  ring->iov.resize(queue_depth);
+  slots.resize(queue_depth);
+  for(int32_t i=0; i < queue_depth; ++i) {
+    slot& s = slots[i];
+    s.room = 65536;
+    if ( posix_memalign((void**)&s.mem, 4096, s.room + block_size + 4096) != 0 )
+      error("[E:%s:%d %s] Cannot allocate %lld bytes to read %s", __FILE__, __LINE__, __FUNCTION__, (long long)block_size, filename.c_str());
+    s.buf = s.mem + s.room;
+    s.want = s.got = 0;
+    s.off = 0;
+    s.done = true;
+  }
+  if ( !seek(0) ) {
+    close();
+    return false;
+  }
+  return true;
+#else
+  (void)_queue_depth;
+  (void)_block_size;
+  return false;
+#endif
+}
+
+bool uring_reader::close() {
+  if ( !is_open() )
+    return false;
+  if ( ring != NULL ) {
+    drain(); // the kernel must not write into freed buffers
+    delete ring;
+    ring = NULL;
+  }
+  for(size_t i=0; i < slots.size(); ++i)
+    free(slots[i].mem);
+  slots.clear();
+  int ret = ::close(fd);
+  fd = -1;
+  return ret == 0;
+}
+
+void uring_reader::issue(int32_t i) {
+  slot& s = slots[i];
+  s.got = 0;
+  if ( next_off >= size ) { // past the end: the slot stays idle
+    s.off = size;
+    s.want = 0;
+    s.done = true;
+    return;
+  }
+  s.off = next_off;
+  s.want = ( size - next_off < (uint64_t)block_size ) ? (int64_t)( size - next_off ) : block_size;
+  s.done = false;
+  next_off += s.want;
+  if ( !submit(i) )
+    error("[E:%s:%d %s] Cannot submit a read of %s: %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str(), strerror(errno));
+}
+
+bool uring_reader::submit(int32_t i) {
+#ifdef QGEN_HAVE_IO_URING
+  slot& s = slots[i];
+  ring->iov[i].iov_base = s.buf + s.got;
+  ring->iov[i].iov_len = (size_t)( s.want - s.got );
+
+  // at most queue_depth reads are in flight, so the submission ring never overflows
+  unsigned tail = *ring->sq_tail;
+  unsigned idx = tail & *ring->sq_mask;
+  struct io_uring_sqe* sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READV; // supported by every kernel with io_uring
+  sqe->fd = fd;
+  sqe->off = s.off + s.got;
+  sqe->addr = (uint64_t)(uintptr_t)&ring->iov[i];
+  sqe->len = 1;
+  sqe->user_data = (uint64_t)i;
+  ring->sq_array[idx] = idx;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  while( ring->enter(1, 0, 0) < 0 ) {
+    if ( errno != EINTR ) return false;
+  }
+  return true;
+#else
+  (void)i;
+  return false;
+#endif
+}
+
+// Short reads, which a signal or a busy device can cause, are resubmitted for
+// the rest of the block; a read returning nothing means that the file was
+// truncated, and the block ends there.
+void uring_reader::reap(bool wait) {
+#ifdef QGEN_HAVE_IO_URING
+  unsigned head = *ring->cq_head;
+  if ( wait && ( head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) ) ) {
+    while( ring->enter(0, 1, IORING_ENTER_GETEVENTS) < 0 ) {
+      if ( errno != EINTR )
+        error("[E:%s:%d %s] Cannot wait for reads of %s: %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str(), strerror(errno));
+    }
+  }
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  for( ; head != tail; ++head) {
+    const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+    int32_t i = (int32_t)cqe->user_data;
+    int32_t res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    slot& s = slots[i];
+    if ( res < 0 ) {
+      if ( ( res == -EINTR ) || ( res == -EAGAIN ) ) {
+        if ( !submit(i) )
+          error("[E:%s:%d %s] Cannot submit a read of %s: %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str(), strerror(errno));
+        continue;
+      }
+      error("[E:%s:%d %s] Error while reading %s: %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str(), strerror(-res));
+    }
+    if ( res == 0 ) {
+      s.want = s.got;
+      s.done = true;
+      continue;
+    }
+    s.got += res;
+    if ( s.got < s.want ) {
+      if ( !submit(i) )
+        error("[E:%s:%d %s] Cannot submit a read of %s: %s", __FILE__, __LINE__, __FUNCTION__, filename.c_str(), strerror(errno));
+    }
+    else
+      s.done = true;
+  }
+#else
+  (void)wait;
+#endif
+}
+
+void uring_reader::drain() {
+  for(int32_t i=0; i < (int32_t)slots.size(); ++i) {
+    while( !slots[i].done )
+      reap(true);
+  }
+}
+
+int64_t uring_reader::next_block(const char* tail, int64_t tail_len, char*& data) {
+  if ( !is_open() )
+    return 0;
+  slot& s = slots[head];
+  if ( s.want == 0 ) // idle slots come after the last block
+    return 0;
+  while( !s.done )
+    reap(true);
+  if ( s.got == 0 ) // truncated file
+    return 0;
+
+  if ( tail_len > s.room ) { // a long partial line: move the block further into a larger buffer
+    int64_t room = ( tail_len + 4095 ) / 4096 * 4096;
+    char* mem;
+    if ( posix_memalign((void**)&mem, 4096, room + block_size + 4096) != 0 )
+      error("[E:%s:%d %s] Cannot allocate %lld bytes to read %s", __FILE__, __LINE__, __FUNCTION__, (long long)( room + block_size ), filename.c_str());
+    memcpy(mem + room, s.buf, s.got);
+    free(s.mem);
+    s.mem = mem;
+    s.room = room;
+    s.buf = mem + room;
+  }
+  memcpy(s.buf - tail_len, tail, tail_len);
+  data = s.buf - tail_len;
+  pos = s.off + s.got;
+
+  if ( cur >= 0 )
+    issue(cur); // the tail has been copied: reuse the previous buffer for a later block
+  cur = head;
+  head = ( head + 1 ) % queue_depth;
+  return tail_len + s.got;
+}
+
+bool uring_reader::seek(uint64_t offset) {
+  if ( !is_open() )
+    return false;
+  drain();
+  if ( offset > size )
+    offset = size;
+  next_off = offset;
+  pos = offset;
+  for(int32_t i=0; i < queue_depth; ++i)
+    issue(i);
+  cur = -1;
+  head = 0;
+  return true;
+}